@@ -112,6 +112,44 @@ void* memcpy(void* dest, const void* src, size_t n) {
   return dest;
 }
 
+static uint64_t ReadTSC(void) {
+  uint32_t lo, hi;
+  __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return (uint64_t)hi << 32 | lo;
+}
+
+int clock_gettime(clockid_t clk_id, struct timespec* tp) {
+  // Reader side of the seqlock in the shared page. Retries while the kernel
+  // updates it.
+  struct ClockSharedPage* page =
+      (struct ClockSharedPage*)CLOCK_SHARED_PAGE_ADDR;
+  uint32_t sequence;
+  uint64_t ns;
+  do {
+    sequence = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+    if (sequence & 1)
+      continue;
+    if (!page->uses_tsc)
+      return clock_gettime_syscall(clk_id, tp);
+    ns = (uint64_t)(((unsigned __int128)ReadTSC() *
+                     page->nanosecond_per_count) >>
+                    page->scale_shift);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((sequence & 1) ||
+           __atomic_load_n(&page->sequence, __ATOMIC_RELAXED) != sequence);
+  tp->tv_sec = ns / 1000000000;
+  tp->tv_nsec = ns % 1000000000;
+  return 0;
+}
+
+int gettimeofday(struct timeval* tv, void* tz) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  tv->tv_sec = ts.tv_sec;
+  tv->tv_usec = ts.tv_nsec / 1000;
+  return 0;
+}
+
 bool is_big_endian(void) {
   union {
     uint32_t i;
@@ -21,6 +21,10 @@
 
 #define INADDR_ANY ((unsigned long int) 0x00000000)
 
+// All clocks count from boot.
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+
 #define __bswap_16(x) \
   ((__uint16_t) ((((x) >> 8) & 0xff) | (((x) & 0xff) << 8)))
 
@@ -43,6 +47,7 @@ typedef unsigned long size_t;
 typedef _Bool bool;
 
 typedef uint32_t socklen_t;
+typedef int clockid_t;
 
 int malloc_size;
 char malloc_array[MALLOC_MAX_SIZE];
@@ -60,6 +65,24 @@ struct timeval {
   long tv_usec;
 };
 
+// c.f.
+// https://elixir.bootlin.com/linux/v5.4.66/source/include/uapi/linux/time.h#L10
+struct timespec {
+  long tv_sec;
+  long tv_nsec;
+};
+
+// Page mapped read-only into every process by the kernel.
+// c.f. Clock::SharedPage in src/clock.h
+#define CLOCK_SHARED_PAGE_ADDR 0x7FFFFFFFF000UL
+struct ClockSharedPage {
+  uint32_t sequence;
+  uint32_t uses_tsc;
+  uint32_t scale_shift;
+  uint32_t reserved;
+  uint64_t nanosecond_per_count;
+};
+
 // c.f.
 // https://elixir.bootlin.com/linux/v4.15/source/include/uapi/linux/in.h#L232
 struct sockaddr_in {
@@ -103,6 +126,7 @@ int bind(int sockfd, struct sockaddr *addr,
 int listen(int sockfd, int backlog);
 int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen);
 void exit(int);
+int clock_gettime_syscall(clockid_t clk_id, struct timespec *tp);
 
 // Standard library functions.
 size_t strlen(const char *s);
@@ -115,6 +139,9 @@ char *strtok(char *str, const char *delim);
 void *malloc(unsigned long n);
 void *memset(void *s, int c, size_t n);
 void *memcpy(void *dest, const void *src, size_t n);
+// Read the time without syscalls.
+int clock_gettime(clockid_t clk_id, struct timespec *tp);
+int gettimeofday(struct timeval *tv, void *tz);
 // convert values between host and network byte order.
 uint16_t htons(uint16_t hostshort);
 uint32_t htonl(uint32_t hostlong);
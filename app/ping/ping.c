@@ -52,6 +52,8 @@ int main(int argc, char** argv) {
   memset(&icmp, 0, sizeof(icmp));
   icmp.type = 8; /* Echo Request */
   icmp.checksum = CalcChecksum(&icmp, 0, sizeof(icmp));
+  struct timespec sent_time;
+  clock_gettime(CLOCK_MONOTONIC, &sent_time);
   int n = sendto(soc, &icmp, sizeof(icmp), 0, (struct sockaddr*)&addr,
                  sizeof(addr));
   if (n < 1) {
@@ -66,6 +68,8 @@ int main(int argc, char** argv) {
   if (recv_len < 1) {
     panic("recvfrom() failed\n");
   }
+  struct timespec recv_time;
+  clock_gettime(CLOCK_MONOTONIC, &recv_time);
 
   Print("recvfrom returned: ");
   PrintNum(recv_len);
@@ -82,7 +86,10 @@ int main(int argc, char** argv) {
   PrintIPv4Addr(addr.sin_addr.s_addr);
   Print(" ICMP Type = ");
   PrintNum(recv_icmp->type);
-  Print("\n");
+  Print(" time = ");
+  PrintNum((recv_time.tv_sec - sent_time.tv_sec) * 1000000 +
+           (recv_time.tv_nsec - sent_time.tv_nsec) / 1000);
+  Print(" us\n");
 
   close(soc);
 }
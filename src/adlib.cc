@@ -241,8 +241,8 @@ void PlayMIDI(EFIFile& file) {
       has_next_event = true;
     }
     if (min_delta != 0) {
-      HPET::GetInstance().BusyWaitMicroSecond(state.micro_second_per_delta *
-                                              min_delta);
+      liumos->scheduler->SleepFor(1000ULL * state.micro_second_per_delta *
+                                  min_delta);
     }
     for (int i = 0; i < num_of_tracks; i++) {
       delta_used[i] += min_delta;
@@ -251,41 +251,45 @@ void PlayMIDI(EFIFile& file) {
   Adlib::TurnOffAllNotes();
 }
 
+static void SleepForMs(uint64_t ms) {
+  liumos->scheduler->SleepFor(ms * 1'000'000);
+}
+
 void TestAdlib() {
   if (!Adlib::DetectAndInit()) {
     return;
   }
 
   Adlib::NoteOn(60);
-  HPET::GetInstance().BusyWait(500);
+  SleepForMs(500);
   Adlib::NoteOff(60);
 
   Adlib::NoteOn(64);
-  HPET::GetInstance().BusyWait(500);
+  SleepForMs(500);
   Adlib::NoteOff(64);
 
   Adlib::NoteOn(67);
-  HPET::GetInstance().BusyWait(500);
+  SleepForMs(500);
   Adlib::NoteOff(67);
 
-  HPET::GetInstance().BusyWait(500);
+  SleepForMs(500);
 
   Adlib::NoteOn(60);
   Adlib::NoteOn(64);
   Adlib::NoteOn(67);
-  HPET::GetInstance().BusyWait(500);
+  SleepForMs(500);
   Adlib::NoteOff(60);
   Adlib::NoteOff(64);
   Adlib::NoteOff(67);
 
-  HPET::GetInstance().BusyWait(500);
+  SleepForMs(500);
 
   for (int i = 0; i < 10; i++) {
     Adlib::NoteOn(i + 60);
-    HPET::GetInstance().BusyWait(200);
+    SleepForMs(200);
   }
   for (int i = 0; i < 10; i++) {
-    HPET::GetInstance().BusyWait(200);
+    SleepForMs(200);
     Adlib::NoteOff(i + 60);
   }
 
@@ -34,9 +34,33 @@ void LocalAPIC::Init(void) {
   ReadCPUID(&cpuid, CPUIDIndex::kXTopology, 0);
   id_ = cpuid.edx;
   PutStringAndHex(" id", id_);
+  Enable();
   liumos->bsp_local_apic = this;
 }
 
+void LocalAPIC::InitForAP(const LocalAPIC& bsp_local_apic) {
+  base_addr_ = bsp_local_apic.base_addr_;
+  kernel_virt_base_addr_ = bsp_local_apic.kernel_virt_base_addr_;
+  is_x2apic_ = bsp_local_apic.is_x2apic_;
+  if (is_x2apic_) {
+    uint64_t base_msr = ReadMSR(MSRIndex::kLocalAPICBase);
+    WriteMSR(MSRIndex::kLocalAPICBase,
+             base_msr | kLocalAPICBaseBitx2APICEnabled);
+  }
+  CPUID cpuid;
+  ReadCPUID(&cpuid, CPUIDIndex::kXTopology, 0);
+  id_ = cpuid.edx;
+  Enable();
+}
+
+void LocalAPIC::Enable() {
+  // Local APICs of APs are software-disabled after INIT.
+  constexpr uint32_t kSVRBitAPICSoftwareEnable = 1 << 8;
+  WriteRegister(kRegSpuriousInterruptVector,
+                ReadRegister(kRegSpuriousInterruptVector) |
+                    kSVRBitAPICSoftwareEnable);
+}
+
 void LocalAPIC::SendEndOfInterrupt(void) {
   if (is_x2apic_) {
     // WRMSR of a non-zero value causes #GP(0).
@@ -46,6 +70,68 @@ void LocalAPIC::SendEndOfInterrupt(void) {
   WriteRegister(0xB0ULL, 0);
 }
 
+void LocalAPIC::SendInterProcessorInterrupt(uint32_t apic_id,
+                                            uint32_t command) {
+  if (is_x2apic_) {
+    WriteMSR(static_cast<MSRIndex>(kx2APICMSRBase +
+                                   (kRegInterruptCommandLow >> 4)),
+             (static_cast<uint64_t>(apic_id) << 32) | command);
+    return;
+  }
+  constexpr uint32_t kICRBitDeliveryPending = 1 << 12;
+  WriteRegister(kRegInterruptCommandHigh, apic_id << 24);
+  WriteRegister(kRegInterruptCommandLow, command);
+  while (ReadRegister(kRegInterruptCommandLow) & kICRBitDeliveryPending) {
+  }
+}
+
+void LocalAPIC::SendINIT(uint32_t apic_id) {
+  constexpr uint32_t kICRDeliveryModeINIT = 0b101 << 8;
+  constexpr uint32_t kICRBitLevelAssert = 1 << 14;
+  SendInterProcessorInterrupt(apic_id,
+                              kICRDeliveryModeINIT | kICRBitLevelAssert);
+}
+
+void LocalAPIC::SendFixedIPI(uint32_t apic_id, uint8_t vector) {
+  constexpr uint32_t kICRDeliveryModeFixed = 0b000 << 8;
+  SendInterProcessorInterrupt(apic_id, kICRDeliveryModeFixed | vector);
+}
+
+void LocalAPIC::SendStartupIPI(uint32_t apic_id, uint8_t vector) {
+  // The AP starts at vector << 12 in real mode.
+  constexpr uint32_t kICRDeliveryModeStartUp = 0b110 << 8;
+  constexpr uint32_t kICRBitLevelAssert = 1 << 14;
+  SendInterProcessorInterrupt(
+      apic_id, kICRDeliveryModeStartUp | kICRBitLevelAssert | vector);
+}
+
+void LocalAPIC::StartTimer(uint32_t initial_count,
+                           uint8_t vector,
+                           bool is_periodic) {
+  constexpr uint32_t kTimerDivideBy16 = 0b0011;
+  constexpr uint32_t kLVTTimerBitPeriodic = 1 << 17;
+  WriteRegister(kRegTimerDivideConfig, kTimerDivideBy16);
+  WriteRegister(kRegLVTTimer,
+                vector | (is_periodic ? kLVTTimerBitPeriodic : 0));
+  WriteRegister(kRegTimerInitialCount, initial_count);
+}
+
+void LocalAPIC::EnableTSCDeadlineTimer(uint8_t vector) {
+  constexpr uint32_t kLVTTimerModeTSCDeadline = 0b10 << 17;
+  WriteRegister(kRegLVTTimer, vector | kLVTTimerModeTSCDeadline);
+  // Orders the write above before writes to the deadline MSR.
+  // c.f. Intel SDM Vol.3 10.5.4.1
+  __sync_synchronize();
+}
+
+void LocalAPIC::StopTimer() {
+  WriteRegister(kRegTimerInitialCount, 0);
+}
+
+uint32_t LocalAPIC::GetTimerCurrentCount() {
+  return ReadRegister(kRegTimerCurrentCount);
+}
+
 static uint32_t ReadIOAPICRegister(uint8_t reg_index) {
   *reinterpret_cast<volatile uint32_t*>(kIOAPICRegIndexAddr) = reg_index;
   return *reinterpret_cast<volatile uint32_t*>(kIOAPICRegDataAddr);
@@ -77,7 +163,6 @@ static void SetInterruptRedirection(uint64_t local_apic_id,
 }
 
 void InitIOAPIC(uint64_t local_apic_id) {
-  SetInterruptRedirection(local_apic_id, 2, 0x20);   // HPET
   SetInterruptRedirection(local_apic_id, 1, 0x21);   // KBC
   SetInterruptRedirection(local_apic_id, 12, 0x22);  // MOUSE
 }
@@ -1,19 +1,55 @@
 #pragma once
+#include "asm.h"
 #include "generic.h"
 
 class LocalAPIC {
  public:
   void Init(void);
+  // Registers of each local APIC are at the same address, so an AP shares
+  // the mapping with the BSP.
+  void InitForAP(const LocalAPIC& bsp_local_apic);
   uint32_t GetID() { return id_; }
   bool Isx2APIC() { return is_x2apic_; }
   void SendEndOfInterrupt(void);
+  void SendINIT(uint32_t apic_id);
+  void SendStartupIPI(uint32_t apic_id, uint8_t vector);
+  // Sends an interrupt with vector to the processor.
+  void SendFixedIPI(uint32_t apic_id, uint8_t vector);
+  void StartTimer(uint32_t initial_count, uint8_t vector, bool is_periodic);
+  // Raises vector when TSC reaches the value written to
+  // MSRIndex::kTSCDeadline. Writing 0 there disarms the timer.
+  void EnableTSCDeadlineTimer(uint8_t vector);
+  void StopTimer();
+  uint32_t GetTimerCurrentCount();
 
  private:
+  static constexpr uint64_t kRegSpuriousInterruptVector = 0xF0;
+  static constexpr uint64_t kRegInterruptCommandLow = 0x300;
+  static constexpr uint64_t kRegInterruptCommandHigh = 0x310;
+  static constexpr uint64_t kRegLVTTimer = 0x320;
+  static constexpr uint64_t kRegTimerInitialCount = 0x380;
+  static constexpr uint64_t kRegTimerCurrentCount = 0x390;
+  static constexpr uint64_t kRegTimerDivideConfig = 0x3E0;
+  static constexpr uint32_t kx2APICMSRBase = 0x800;
+
+  void Enable();
+  void SendInterProcessorInterrupt(uint32_t apic_id, uint32_t command);
   uint32_t ReadRegister(uint64_t offset) {
-    return *reinterpret_cast<uint32_t*>(kernel_virt_base_addr_ + offset);
+    if (is_x2apic_)
+      return static_cast<uint32_t>(ReadMSR(static_cast<MSRIndex>(
+          kx2APICMSRBase + static_cast<uint32_t>(offset >> 4))));
+    return *reinterpret_cast<volatile uint32_t*>(kernel_virt_base_addr_ +
+                                                 offset);
   }
   void WriteRegister(uint64_t offset, uint32_t data) {
-    *reinterpret_cast<uint32_t*>(kernel_virt_base_addr_ + offset) = data;
+    if (is_x2apic_) {
+      WriteMSR(static_cast<MSRIndex>(kx2APICMSRBase +
+                                     static_cast<uint32_t>(offset >> 4)),
+               data);
+      return;
+    }
+    *reinterpret_cast<volatile uint32_t*>(kernel_virt_base_addr_ + offset) =
+        data;
   }
   uint32_t* GetRegisterAddr(uint64_t offset) {
     return (uint32_t*)(base_addr_ + offset);
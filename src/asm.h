@@ -7,6 +7,7 @@ extern "C" {
 
 namespace CPUIDIndex {
 constexpr uint32_t kXTopology = 0x0B;
+constexpr uint32_t kAdvancedPowerManagement = 0x8000'0007;
 constexpr uint32_t kMaxAddr = 0x8000'0008;
 }  // namespace CPUIDIndex
 
@@ -21,12 +22,27 @@ constexpr uint64_t kLocalAPICBaseBitx2APICEnabled = (1 << 10);
 constexpr uint64_t kRFlagsInterruptEnable = (1ULL << 9);
 
 struct CPUFeatureIndex {
-  enum { kX2APIC, kXSAVE, kOSXSAVE, kAPIC, kFXSR, kSize };
+  enum {
+    kX2APIC,
+    kXSAVE,
+    kOSXSAVE,
+    kAPIC,
+    kFXSR,
+    kPGE,
+    kPCID,
+    kINVPCID,
+    kTSCDeadline,
+    kInvariantTSC,
+    kSSE2,
+    kAVX2,
+    kSize
+  };
   int dummy;
 };
 
 static const char* CPUFeatureString[] = {
-    "x2APIC", "XSAVE", "OSXSAVE", "APIC", "FXSR",
+    "x2APIC", "XSAVE", "OSXSAVE", "APIC", "FXSR", "PGE", "PCID", "INVPCID",
+    "TSC-deadline", "invariant TSC", "SSE2", "AVX2",
 };
 
 packed_struct CPUFeatureSet {
@@ -86,26 +102,21 @@ packed_struct InterruptContext {
 };
 static_assert(sizeof(InterruptContext) == 40);
 
-struct FPUContenxt {
-  uint8_t data[512];
-};
-
 packed_struct CPUContext {
   uint64_t cr3;
   GeneralRegisterContext greg;
   InterruptContext int_ctx;
-  FPUContenxt fpu_context;
 };
 
 packed_struct InterruptInfo {
   // This struct is placed at top of the interrupt stack.
-  FPUContenxt fpu_context;  // used by FXSAVE / FXRSTOR
-  uint64_t dummy;
+  // FPU state which is loaded on return, or nullptr. See fpu.h.
+  void* fpu_state;
   GeneralRegisterContext greg;
   uint64_t error_code;
   InterruptContext int_ctx;
 };
-static_assert(sizeof(InterruptInfo) == (16 + 4 + 1) * 8 + 8 + 512);
+static_assert(sizeof(InterruptInfo) == (16 + 4 + 1) * 8 + 8);
 
 enum class IDTType {
   kInterruptGate = 0xE,
@@ -178,6 +189,7 @@ static_assert(sizeof(IA_TSS64) == 104);
 
 enum class MSRIndex : uint32_t {
   kLocalAPICBase = 0x1b,
+  kTSCDeadline = 0x6e0,
   kx2APICEndOfInterrupt = 0x80b,
   kEFER = 0xC0000080,
   kSTAR = 0xC0000081,
@@ -195,6 +207,9 @@ __attribute__((ms_abi)) void WriteMSR(MSRIndex, uint64_t);
 
 __attribute__((ms_abi)) void FXSave(void*);
 __attribute__((ms_abi)) void FXRestore(void*);
+__attribute__((ms_abi)) void XSave(void*, uint64_t mask);
+__attribute__((ms_abi)) void XRestore(void*, uint64_t mask);
+__attribute__((ms_abi)) void WriteXCR0(uint64_t);
 
 __attribute__((ms_abi)) void ReadGDTR(GDTR*);
 __attribute__((ms_abi)) void WriteGDTR(GDTR*);
@@ -211,15 +226,24 @@ __attribute__((ms_abi)) void WriteIOPort32(uint16_t addr, uint32_t data);
 __attribute__((ms_abi)) void StoreIntFlag(void);
 __attribute__((ms_abi)) void StoreIntFlagAndHalt(void);
 __attribute__((ms_abi)) void ClearIntFlag(void);
+__attribute__((ms_abi)) uint64_t ReadRFLAGS(void);
 [[noreturn]] __attribute__((ms_abi)) void Die(void);
 __attribute__((ms_abi)) uint16_t ReadCSSelector(void);
 __attribute__((ms_abi)) uint16_t ReadSSSelector(void);
 __attribute__((ms_abi)) void WriteCSSelector(uint16_t);
 __attribute__((ms_abi)) void WriteSSSelector(uint16_t);
 __attribute__((ms_abi)) void WriteDataAndExtraSegmentSelectors(uint16_t);
+__attribute__((ms_abi)) uint64_t ReadCR0(void);
+__attribute__((ms_abi)) void WriteCR0(uint64_t);
 __attribute__((ms_abi)) uint64_t ReadCR2(void);
 __attribute__((ms_abi)) uint64_t ReadCR3(void);
 __attribute__((ms_abi)) void WriteCR3(uint64_t);
+__attribute__((ms_abi)) uint64_t ReadCR4(void);
+__attribute__((ms_abi)) void WriteCR4(uint64_t);
+__attribute__((ms_abi)) void InvalidatePage(uint64_t addr);
+__attribute__((ms_abi)) void InvalidatePCID(uint64_t type,
+                                            uint64_t pcid,
+                                            uint64_t addr);
 __attribute__((ms_abi)) uint64_t CompareAndSwap(uint64_t*, uint64_t);
 __attribute__((ms_abi)) void SwapGS(void);
 __attribute__((ms_abi)) uint64_t ReadRSP(void);
@@ -240,9 +264,6 @@ __attribute__((ms_abi)) void RepeatStore8Bytes(size_t count,
                                                const void* dst,
                                                uint64_t data);
 __attribute__((ms_abi)) void CLFlushOptimized(const void*);
-__attribute__((ms_abi)) bool CompareAndExchange64(uint64_t* dst,
-                                                  uint64_t expected,
-                                                  uint64_t value);
 __attribute__((ms_abi)) void JumpToKernel(void* kernel_entry_point,
                                           void* vram_sheet,
                                           uint64_t kernel_stack_pointer,
@@ -260,6 +281,27 @@ __attribute__((ms_abi)) void AsmIntHandler13_SIMDFPException(void);
 __attribute__((ms_abi)) void AsmIntHandler20(void);
 __attribute__((ms_abi)) void AsmIntHandler21(void);
 __attribute__((ms_abi)) void AsmIntHandler22(void);
+__attribute__((ms_abi)) void AsmIntHandler2F(void);
+__attribute__((ms_abi)) void AsmIntHandler30(void);
+__attribute__((ms_abi)) void AsmIntHandler31(void);
+__attribute__((ms_abi)) void AsmIntHandler32(void);
+__attribute__((ms_abi)) void AsmIntHandler33(void);
+__attribute__((ms_abi)) void AsmIntHandler34(void);
+__attribute__((ms_abi)) void AsmIntHandler35(void);
+__attribute__((ms_abi)) void AsmIntHandler36(void);
+__attribute__((ms_abi)) void AsmIntHandler37(void);
 __attribute__((ms_abi)) void AsmIntHandlerNotImplemented(void);
 __attribute__((ms_abi)) void Disable8259PIC(void);
 }
+
+// Returns whether interrupts were enabled, to be passed to RestoreInterrupts.
+static inline bool DisableInterrupts() {
+  const bool was_enabled = ReadRFLAGS() & kRFlagsInterruptEnable;
+  ClearIntFlag();
+  return was_enabled;
+}
+
+static inline void RestoreInterrupts(bool was_enabled) {
+  if (was_enabled)
+    StoreIntFlag();
+}
@@ -0,0 +1,74 @@
+#include "clock.h"
+
+#include "liumos.h"
+#include "util.h"
+
+void Clock::Init() {
+  // Counts the TSC for a while measured with HPET. Sleep() is not used
+  // since the scheduler may not be ready.
+  constexpr uint64_t kCalibrationMs = 10;
+  HPET& hpet = HPET::GetInstance();
+  const uint64_t hpet_start = hpet.ReadMainCounterValue();
+  const uint64_t end = hpet_start + 1'000'000'000'000ULL * kCalibrationMs /
+                                        hpet.GetFemtosecondPerCount();
+  const uint64_t tsc_start = __builtin_ia32_rdtsc();
+  uint64_t hpet_end;
+  while ((hpet_end = hpet.ReadMainCounterValue()) < end) {
+  }
+  const uint64_t tsc_elapsed = __builtin_ia32_rdtsc() - tsc_start;
+  assert(tsc_elapsed);
+  const uint128_t elapsed_fs =
+      static_cast<uint128_t>(hpet_end - hpet_start) *
+      hpet.GetFemtosecondPerCount();
+  const uint64_t tsc_femtosecond_per_count =
+      static_cast<uint64_t>((elapsed_fs << kScaleShift) / tsc_elapsed);
+  tsc_count_per_nanosecond_ = static_cast<uint64_t>(
+      ((static_cast<uint128_t>(tsc_elapsed) * 1'000'000)
+       << kScaleShift) /
+      elapsed_fs);
+
+  uses_tsc_ = GetBit<CPUFeatureIndex::kInvariantTSC>(
+      liumos->cpu_features->features);
+  if (uses_tsc_) {
+    femtosecond_per_count_ = tsc_femtosecond_per_count;
+    count_per_nanosecond_ = tsc_count_per_nanosecond_;
+  } else {
+    femtosecond_per_count_ = hpet.GetFemtosecondPerCount() << kScaleShift;
+    count_per_nanosecond_ = static_cast<uint64_t>(
+        (1'000'000ULL << kScaleShift) / hpet.GetFemtosecondPerCount());
+  }
+  nanosecond_per_count_ = femtosecond_per_count_ / 1'000'000;
+
+  shared_page_paddr_ = GetSystemDRAMAllocator().AllocPages<uint64_t>(1);
+  shared_page_ = GetKernelVirtAddrForPhysAddr(
+      reinterpret_cast<SharedPage*>(shared_page_paddr_));
+  bzero(shared_page_, kPageSize);
+  UpdateSharedPage();
+  Print();
+}
+
+void Clock::UpdateSharedPage() {
+  // Writer side of a seqlock. Readers retry while sequence is odd or has
+  // changed.
+  SharedPage& page = *shared_page_;
+  const uint32_t sequence = page.sequence;
+  __atomic_store_n(&page.sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  page.uses_tsc = uses_tsc_;
+  page.scale_shift = kScaleShift;
+  page.nanosecond_per_count = nanosecond_per_count_;
+  __atomic_store_n(&page.sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+uint64_t Clock::GetSharedPagePhysAddr() {
+  assert(shared_page_paddr_);
+  return shared_page_paddr_;
+}
+
+void Clock::Print() {
+  PutStringAndBool("Clock uses invariant TSC", uses_tsc_);
+  PutStringAndDecimal("  femtosecond per count",
+                      femtosecond_per_count_ >> kScaleShift);
+  PutStringAndDecimal("  TSC count per ms",
+                      NanoSecondToTSCCount(1'000'000));
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "generic.h"
+#include "hpet.h"
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+class Clock {
+  // Clock source for timestamps in the kernel. The invariant TSC is used if
+  // available, since reading it is a single RDTSC while reading HPET is an
+  // uncached MMIO access. HPET is used otherwise. Counts of the TSC are in
+  // sync across processors and do not depend on the page table loaded.
+  // Conversions use fixed-point factors calibrated against HPET at boot.
+ public:
+  // Read-only page mapped into user processes, so they read the time without
+  // syscalls. The layout is also defined in app/liumlib/liumlib.h.
+  struct SharedPage {
+    // Odd while the others are updated
+    uint32_t sequence;
+    // If false, user processes should use the clock_gettime syscall.
+    uint32_t uses_tsc;
+    uint32_t scale_shift;
+    uint32_t reserved;
+    // Nanoseconds = (TSC * nanosecond_per_count) >> scale_shift
+    uint64_t nanosecond_per_count;
+  };
+  static_assert(sizeof(SharedPage) == 24);
+  // The last page of the lower half, which has its own page tables.
+  static constexpr uint64_t kSharedPageUserAddr = 0x7FFF'FFFF'F000ULL;
+
+  // Calibrates the TSC against HPET, which should be initialized.
+  static void Init();
+  static uint64_t GetSharedPagePhysAddr();
+  static bool UsesTSC() { return uses_tsc_; }
+  static uint64_t ReadCount() {
+    if (uses_tsc_)
+      return __builtin_ia32_rdtsc();
+    return HPET::GetInstance().ReadMainCounterValue();
+  }
+  static uint64_t CountToFemtoSecond(uint64_t count) {
+    return Scale(count, femtosecond_per_count_);
+  }
+  static uint64_t CountToNanoSecond(uint64_t count) {
+    return Scale(count, nanosecond_per_count_);
+  }
+  static uint64_t NanoSecondToCount(uint64_t ns) {
+    return Scale(ns, count_per_nanosecond_);
+  }
+  // For the TSC-deadline timer, which uses the TSC even if it is not
+  // invariant.
+  static uint64_t NanoSecondToTSCCount(uint64_t ns) {
+    return Scale(ns, tsc_count_per_nanosecond_);
+  }
+  static uint64_t ReadNanoSecond() { return CountToNanoSecond(ReadCount()); }
+  static void Print();
+
+ private:
+  // Number of fraction bits of the factors
+  static constexpr int kScaleShift = 32;
+  static uint64_t Scale(uint64_t value, uint64_t factor) {
+    return static_cast<uint64_t>(
+        (static_cast<uint128_t>(value) * factor) >> kScaleShift);
+  }
+  static void UpdateSharedPage();
+
+  inline static bool uses_tsc_ = false;
+  inline static uint64_t femtosecond_per_count_;
+  inline static uint64_t nanosecond_per_count_;
+  inline static uint64_t count_per_nanosecond_;
+  inline static uint64_t tsc_count_per_nanosecond_;
+  inline static uint64_t shared_page_paddr_;
+  inline static SharedPage* shared_page_;
+};
@@ -363,9 +363,32 @@ void ShowEFIMemoryMap() {
   }
 }
 
+static uint64_t GetNumOfFreeDRAMPages() {
+  return GetSystemDRAMAllocator().GetNumOfFreePages() +
+         GetCPULocalPageCache().GetNumOfCachedPages();
+}
+
 void Free() {
   PutString("DRAM Free List:\n");
   GetSystemDRAMAllocator().Print();
+  PutStringAndHex("Pages cached in this CPU",
+                  GetCPULocalPageCache().GetNumOfCachedPages());
+  PutStringAndDecimal("Free DRAM (KiB)", GetNumOfFreeDRAMPages()
+                                             << (kPageSizeExponent - 10));
+  PutString("Slab caches: name, object size, used objects, slabs\n");
+  GetKernelSlabAllocator().ForEachCache([](KernelSlabAllocator::Cache& c) {
+    kprintf("  %s, %llu, %llu, %llu\n", c.GetName(), c.GetObjectSize(),
+            c.GetNumOfUsedObjects(), c.GetNumOfSlabs());
+  });
+  PutStringAndDecimal("Pages for large objects",
+                      GetKernelSlabAllocator().GetNumOfLargeObjectPages());
+  ExecutionContext& root_ctx = liumos->root_process->GetExecutionContext();
+  const uint64_t heap_base =
+      root_ctx.GetProcessMappingInfo().heap.GetVirtAddr();
+  PutStringAndDecimal("Kernel heap used (KiB)",
+                      (root_ctx.GetHeapEndVirtAddr() - heap_base) >> 10);
+  PutStringAndDecimal("Kernel heap mapped (KiB)",
+                      root_ctx.GetHeapMappedSize() >> 10);
 }
 
 void label(uint64_t i) {
@@ -479,7 +502,7 @@ void TestMem(
 }
 
 void TestMemWrite(
-    PhysicalPageAllocator<UsePhysicalAddressInternallyStrategy> allocator,
+    PhysicalPageAllocator<UsePhysicalAddressInternallyStrategy>& allocator,
     uint32_t proximity_domain) {
   constexpr uint64_t kRangeMin = 1ULL << 10;
   constexpr uint64_t kRangeMax = 1ULL << 24;
@@ -592,6 +615,88 @@ void Version() {
   kprintf("\nliumOS version: %s\n\n", GetVersionStr());
 }
 
+enum class AddressSpaceSwitch {
+  kFlushAll,
+  kFlushNonGlobal,
+  kKeepPCID,
+};
+
+static uint64_t MeasureAddressSpaceSwitches(AddressSpaceSwitch type,
+                                            uint64_t kernel_cr3,
+                                            uint64_t user_cr3,
+                                            uint64_t working_set_base,
+                                            int num_of_pages) {
+  // Returns TSC counts per round trip between the page tables, reading each
+  // page of the working set after switching to user_cr3.
+  constexpr int kNumOfRounds = 1000;
+  const uint64_t no_flush =
+      type == AddressSpaceSwitch::kKeepPCID ? kCR3NoFlush : 0;
+  const bool should_flush_all = type == AddressSpaceSwitch::kFlushAll;
+  volatile uint8_t* pages =
+      reinterpret_cast<volatile uint8_t*>(working_set_base);
+  uint8_t sum = 0;
+  const bool was_enabled = DisableInterrupts();
+  const uint64_t t0 = __builtin_ia32_rdtsc();
+  for (int r = 0; r < kNumOfRounds; r++) {
+    WriteCR3(user_cr3 | no_flush);
+    if (should_flush_all)
+      TLB::FlushAll();
+    for (int i = 0; i < num_of_pages; i++) {
+      sum += pages[i << kPageSizeExponent];
+    }
+    WriteCR3(kernel_cr3 | no_flush);
+    if (should_flush_all)
+      TLB::FlushAll();
+  }
+  const uint64_t t1 = __builtin_ia32_rdtsc();
+  RestoreInterrupts(was_enabled);
+  pages[0] = sum;
+  return (t1 - t0) / kNumOfRounds;
+}
+
+static void BenchContextSwitch() {
+  // Switches between the kernel page table and a page table with a small
+  // user working set, as context switches between a kernel task and a
+  // process do. Flushing all entries is how switches worked without PGE and
+  // PCID.
+  constexpr uint64_t kWorkingSetBase = 0x1000'0000;
+  constexpr int kNumOfPages = 64;
+  KernelPageCache& allocator = GetCPULocalPageCache();
+  IA_PML4& pml4 = AllocPageTable(allocator);
+  SetKernelPageEntries(pml4);
+  CreatePageMapping(allocator, pml4, kWorkingSetBase,
+                    allocator.AllocPages<uint64_t>(kNumOfPages),
+                    kNumOfPages << kPageSizeExponent,
+                    kPageAttrPresent | kPageAttrWritable);
+  const uint64_t kernel_cr3 = ReadCR3() & ~kCR3PCIDMask;
+  // Entries of kUntrackedPCID are flushed whenever a process loads it.
+  const uint64_t user_cr3 =
+      reinterpret_cast<uint64_t>(&pml4) |
+      (TLB::IsPCIDEnabled() ? TLB::kUntrackedPCID : TLB::kKernelPCID);
+
+  PutStringAndDecimal("TSC counts per round trip. Pages touched",
+                      kNumOfPages);
+  PutStringAndDecimal(
+      "  flush all",
+      MeasureAddressSpaceSwitches(AddressSpaceSwitch::kFlushAll, kernel_cr3,
+                                  user_cr3, kWorkingSetBase, kNumOfPages));
+  PutStringAndDecimal(
+      "  keep global",
+      MeasureAddressSpaceSwitches(AddressSpaceSwitch::kFlushNonGlobal,
+                                  kernel_cr3, user_cr3, kWorkingSetBase,
+                                  kNumOfPages));
+  if (TLB::IsPCIDEnabled()) {
+    PutStringAndDecimal(
+        "  keep PCID",
+        MeasureAddressSpaceSwitches(AddressSpaceSwitch::kKeepPCID, kernel_cr3,
+                                    user_cr3, kWorkingSetBase, kNumOfPages));
+  } else {
+    PutString("  PCID not supported\n");
+  }
+  TLB::FlushAll();
+  FreePageTable(allocator, pml4);
+}
+
 static void ListPCIDevices() {
   PutString("lspci:\n");
   PCI::GetInstance().PrintDevices();
@@ -688,6 +793,30 @@ void Run(TextBox& tbox) {
       PutStringAndHex("  proximity_domain",
                       liumos->acpi.srat->GetProximityDomainForLocalAPIC(
                           *liumos->bsp_local_apic));
+    for (int i = 0; i < GetNumOfProcessors(); i++) {
+      PutStringAndDecimal("CPU", i);
+      PutStringAndHex("  APIC ID", GetProcessor(i).GetLocalAPIC().GetID());
+    }
+  } else if (IsEqualString(line, "lockstat on")) {
+    LockStats::SetEnabled(true);
+  } else if (IsEqualString(line, "lockstat off")) {
+    LockStats::SetEnabled(false);
+  } else if (IsEqualString(line, "lockstat reset")) {
+    LockStats::ResetAll();
+  } else if (IsEqualString(line, "lockstat")) {
+    LockStats::PrintAll();
+  } else if (IsEqualString(line, "show sched")) {
+    liumos->scheduler->PrintStatistics();
+  } else if (IsEqualString(line, "show tlb")) {
+    TLB::PrintStatistics();
+  } else if (IsEqualString(line, "show syscall")) {
+    PrintSyscallStatistics();
+  } else if (IsEqualString(line, "show sockets")) {
+    Network::GetInstance().PrintSockets();
+  } else if (IsEqualString(line, "show net")) {
+    Virtio::Net::GetInstance().PrintStatistics();
+  } else if (IsEqualString(line, "bench ctxsw")) {
+    BenchContextSwitch();
   } else if (IsEqualString(line, "pmem show")) {
     for (int i = 0; i < LiumOS::kNumOfPMEMManagers; i++) {
       if (!liumos->pmem[i])
@@ -732,6 +861,7 @@ void Run(TextBox& tbox) {
         liumos->proc_ctrl->RestoreFromPersistentProcessInfo(*pp_info);
     liumos->scheduler->RegisterProcess(proc);
     proc.WaitUntilExit();
+    liumos->proc_ctrl->Destroy(proc);
   } else if (IsEqualString(line, "pmem run pi.bin")) {
     assert(liumos->pmem[0]);
     int idx = GetLoaderInfo().FindFile("pi.bin");
@@ -772,18 +902,14 @@ void Run(TextBox& tbox) {
     EFIFile& pi_bin = GetLoaderInfo().root_files[idx];
     int us = atoi(&line[5]);
     PutStringAndHex("Eval in time slice", us);
-    ClearIntFlag();
-    HPET::GetInstance().SetTimerNs(
-        0, us,
-        HPET::TimerConfig::kUsePeriodicMode | HPET::TimerConfig::kEnable);
-
-    StoreIntFlag();
+    liumos->time_slice_count = Clock::NanoSecondToCount(us * 1000ULL);
 
     assert(liumos->pmem[0]);
     constexpr int kNumOfTestRun = 5;
 
     PutString("Ephemeral Process:\n");
     uint64_t ns_sum_ephemeral = 0;
+    const uint64_t free_pages_before_runs = GetNumOfFreeDRAMPages();
     for (int i = 0; i < kNumOfTestRun; i++) {
       Process& proc = LoadELFAndCreateEphemeralProcess(pi_bin);
       ns_sum_ephemeral += liumos->scheduler->LaunchAndWaitUntilExit(proc);
@@ -796,6 +922,8 @@ void Run(TextBox& tbox) {
           LoadELFAndCreatePersistentProcess(pi_bin, *liumos->pmem[0]);
       ns_sum_persistent += liumos->scheduler->LaunchAndWaitUntilExit(proc);
     }
+    PutStringAndDecimal("Free DRAM pages before runs", free_pages_before_runs);
+    PutStringAndDecimal("Free DRAM pages after runs", GetNumOfFreeDRAMPages());
     PutString("timeslice(us), ephemeral avg(ns), persistent avg(ns)\n");
     PutString("0x");
     PutHex64(us);
@@ -835,6 +963,13 @@ void Run(TextBox& tbox) {
     PutString("show srat: Print SRAT Entries\n");
     PutString("show slit: Print SLIT Entries\n");
     PutString("show mmap: Print UEFI MemoryMap\n");
+    PutString("show sched: Print scheduler statistics of each CPU\n");
+    PutString("lockstat [on|off|reset]: Print or control lock statistics\n");
+    PutString("show tlb: Print PCID usage and TLB flushes of each CPU\n");
+    PutString("show syscall: Print calls and cycles of each syscall\n");
+    PutString("show sockets: Print RX packets and drops of each socket\n");
+    PutString("show net: Print statistics of virtio-net\n");
+    PutString("bench ctxsw: Measure page table switches with each TLB mode\n");
     PutString("test mem: Test memory access \n");
     PutString("free: show memory free entries\n");
     PutString("time: show HPET main counter value\n");
@@ -967,7 +1102,14 @@ void Run(TextBox& tbox) {
     proc.GetExecutionContext().PushDataToStack(&argc64, sizeof(argc64));
     liumos->scheduler->RegisterProcess(proc);
     while (proc.GetStatus() != Process::Status::kStopped) {
-      uint16_t keyid = liumos->main_console->GetCharWithoutBlocking();
+      uint16_t keyid = KeyID::kNoInput;
+      // The input wait queue is also woken on every timer tick, so the exit
+      // of proc is noticed without a key press.
+      liumos->main_console->GetInputWaitQueue().WaitUntil([&keyid, &proc] {
+        keyid = liumos->main_console->GetCharWithoutBlocking();
+        return keyid != KeyID::kNoInput ||
+               proc.GetStatus() == Process::Status::kStopped;
+      });
       if (KeyID::IsWithCtrl(keyid) && KeyID::IsChar(keyid, 'c')) {
         // Ctrl-C
         proc.Kill();
@@ -975,8 +1117,8 @@ void Run(TextBox& tbox) {
         PutString("\nkilled.\n");
         break;
       }
-      Sleep();
     }
+    liumos->proc_ctrl->Destroy(proc);
   }
 }
 
@@ -984,12 +1126,12 @@ void WaitAndProcess(TextBox& tbox) {
   PutString("(liumos)$ ");
   tbox.StartRecording();
   while (1) {
-    uint16_t keyid;
-    while ((keyid = liumos->main_console->GetCharWithoutBlocking()) ==
-           KeyID::kNoInput) {
+    uint16_t keyid = KeyID::kNoInput;
+    liumos->main_console->GetInputWaitQueue().WaitUntil([&keyid] {
       XHCI::Controller::GetInstance().PollEvents();
-      StoreIntFlagAndHalt();
-    }
+      keyid = liumos->main_console->GetCharWithoutBlocking();
+      return keyid != KeyID::kNoInput;
+    });
     if (keyid == '\n') {
       tbox.StopRecording();
       tbox.putc('\n');
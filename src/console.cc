@@ -50,17 +50,17 @@ void Console::PutCharWithoutLocking(char c) {
 }
 
 void Console::PutChar(char c) {
-  lock_.Lock();
+  const bool was_enabled = lock_.LockIRQSave();
   PutCharWithoutLocking(c);
-  lock_.Unlock();
+  lock_.UnlockIRQRestore(was_enabled);
 }
 
 void Console::PutString(const char* s) {
-  lock_.Lock();
+  const bool was_enabled = lock_.LockIRQSave();
   while (*s) {
     PutCharWithoutLocking(*(s++));
   }
-  lock_.Unlock();
+  lock_.UnlockIRQRestore(was_enabled);
 }
 
 #ifndef LIUMOS_LOADER
@@ -1,6 +1,7 @@
 #pragma once
 #include "generic.h"
-#include "process_lock.h"
+#include "spinlock.h"
+#include "wait_queue.h"
 
 class Sheet;
 class SerialPort;
@@ -11,7 +12,9 @@ class Console {
     int x, y;
   };
   Console()
-      : cursor_x_(0), cursor_y_(0), sheet_(nullptr), serial_port_(nullptr) {}
+      : cursor_x_(0), cursor_y_(0), sheet_(nullptr), serial_port_(nullptr) {
+    lock_.SetStats(lock_stats_);
+  }
   void SetCursorPosition(int x, int y) {
     cursor_x_ = x;
     cursor_y_ = y;
@@ -27,13 +30,19 @@ class Console {
 
 #ifndef LIUMOS_LOADER
   uint16_t GetCharWithoutBlocking();
+  // Woken on key presses. Serial ports and xHCI keyboards are polled, so it
+  // is also woken on every timer tick.
+  WaitQueue& GetInputWaitQueue() { return input_wait_queue_; }
 #endif
 
  private:
   int cursor_x_, cursor_y_;
   Sheet* sheet_;
   SerialPort* serial_port_;
-  ProcessLock lock_;
+  // Taken also by interrupt handlers and other processors
+  SpinLock lock_;
+  inline static LockStats lock_stats_{"Console"};
+  WaitQueue input_wait_queue_;
 
   void PutCharWithoutLocking(char c);
 };
@@ -172,6 +172,15 @@ void* EFI::AllocatePages(UINTN pages) {
   return mem;
 }
 
+void* EFI::AllocatePagesBelow(UINTN pages, uint64_t limit) {
+  void* mem = reinterpret_cast<void*>(limit - 1);
+  Status status = system_table_->boot_services->AllocatePages(
+      AllocateType::kMaxAddress, MemoryType::kLoaderData, pages, &mem);
+  if (status != EFI::Status::kSuccess)
+    Panic("Failed to alloc pages");
+  return mem;
+}
+
 void EFI::Init(Handle image_handle, SystemTable* system_table) {
   image_handle_ = image_handle;
   system_table_ = system_table;
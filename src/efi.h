@@ -424,6 +424,8 @@ class EFI {
   EFI::FileProtocol* OpenFile(const wchar_t* path);
   void ReadFileInfo(FileProtocol* file, FileInfo* info);
   void* AllocatePages(UINTN pages);
+  // Allocates pages which end at or below limit.
+  void* AllocatePagesBelow(UINTN pages, uint64_t limit);
   void Init(Handle, SystemTable*);
   const GraphicsOutputProtocol::ModeInfo& GetGraphicsModeInfo() {
     assert(graphics_output_protocol_);
@@ -150,13 +150,17 @@ static void LoadAndMap(TAllocator& allocator,
                          should_clflush);
 }
 
+#ifndef LIUMOS_LOADER
+
 Process& LoadELFAndCreateEphemeralProcess(EFIFile& file) {
-  ExecutionContext& ctx =
-      *liumos->kernel_heap_allocator->Alloc<ExecutionContext>();
+  ExecutionContext& ctx = *AllocKernelObject<ExecutionContext>();
   ProcessMappingInfo& map_info = ctx.GetProcessMappingInfo();
   PhdrMappingInfo phdr_map_info;
-  IA_PML4& user_page_table = AllocPageTable(GetSystemDRAMAllocator());
+  IA_PML4& user_page_table = AllocPageTable(GetCPULocalPageCache());
   SetKernelPageEntries(user_page_table);
+  CreatePageMapping(GetCPULocalPageCache(), user_page_table,
+                    Clock::kSharedPageUserAddr, Clock::GetSharedPagePhysAddr(),
+                    kPageSize, kPageAttrPresent | kPageAttrUser);
 
   const Elf64_Ehdr* ehdr = ParseProgramHeader(file, map_info, phdr_map_info);
   assert(ehdr);
@@ -175,7 +179,7 @@ Process& LoadELFAndCreateEphemeralProcess(EFIFile& file) {
   if (liumos->debug_mode_enabled) {
     map_info.Print();
   }
-  LoadAndMap(GetSystemDRAMAllocator(), user_page_table, map_info, phdr_map_info,
+  LoadAndMap(GetCPULocalPageCache(), user_page_table, map_info, phdr_map_info,
              kPageAttrUser, false);
 
   uint8_t* entry_point = reinterpret_cast<uint8_t*>(ehdr->e_entry);
@@ -251,6 +255,8 @@ Process& LoadELFAndCreatePersistentProcess(EFIFile& file,
   return liumos->proc_ctrl->RestoreFromPersistentProcessInfo(pp_info);
 }
 
+#endif
+
 void LoadKernelELF(EFIFile& file, LoaderInfo& loader_info) {
   ProcessMappingInfo map_info;
   PhdrMappingInfo phdr_map_info;
@@ -280,7 +286,7 @@ void LoadKernelELF(EFIFile& file, LoaderInfo& loader_info) {
       kNumOfKernelHeapPages << kPageSizeExponent);
 
   LoadAndMap(GetSystemDRAMAllocator(), GetKernelPML4(), map_info, phdr_map_info,
-             0, false);
+             kPageAttrGlobal, false);
 
   uint8_t* entry_point = reinterpret_cast<uint8_t*>(ehdr->e_entry);
   PutStringAndHex("Entry address: ", entry_point);
@@ -11,7 +11,9 @@ class PersistentMemoryManager;
 
 const Elf64_Shdr* FindSectionHeader(EFIFile& file, const char* name);
 
+#ifndef LIUMOS_LOADER
 Process& LoadELFAndCreateEphemeralProcess(EFIFile& file);
 Process& LoadELFAndCreatePersistentProcess(EFIFile& file,
                                            PersistentMemoryManager& pmem);
+#endif
 void LoadKernelELF(EFIFile& liumos_elf, LoaderInfo&);
@@ -1,5 +1,7 @@
 #include "liumos.h"
+#include "page_cache.h"
 #include "pmem.h"
+#include "tlb.h"
 
 void SegmentMapping::Print() {
   PutString("vaddr:");
@@ -52,17 +54,58 @@ void ExecutionContext::AlignStack(int align) {
   assert(false);
 }
 
-void ExecutionContext::ExpandHeap(int64_t diff) {
-  uint64_t diff_abs = diff < 0 ? -diff : diff;
-  if (diff_abs > map_info_.heap.GetMapSize()) {
-    PutStringAndDecimal("diff_abs", diff_abs);
-    PutStringAndDecimal("map_size", map_info_.heap.GetMapSize());
-    Panic("Too large heap expansion request");
+bool ExecutionContext::ExpandHeap(int64_t diff) {
+  // Returns false if the heap cannot be resized as requested.
+  if (!map_info_.heap.GetVirtAddr())
+    return false;
+  if (diff < 0 && static_cast<uint64_t>(-diff) > heap_used_size_)
+    return false;
+  const uint64_t new_used_size = heap_used_size_ + diff;
+  if (new_used_size > heap_limit_size_)
+    return false;
+  while (GetHeapMappedSize() < new_used_size) {
+    GrowHeap();
   }
-  heap_used_size_ += diff;
-  if (heap_used_size_ > map_info_.heap.GetMapSize())
-    Panic("No more heap");
-};
+  heap_used_size_ = new_used_size;
+  // Keep up to one spare chunk to avoid remapping on every small shrink.
+  while (heap_expanded_size_ &&
+         GetHeapMappedSize() - heap_used_size_ >= 2 * kHeapChunkSize) {
+    ShrinkHeap();
+  }
+  return true;
+}
+
+void ExecutionContext::GrowHeap() {
+  // Maps pages up to the next chunk boundary. Physical pages of a chunk are
+  // contiguous and aligned by the buddy allocator, so every chunk after the
+  // first one is mapped with a 2MB page.
+  const uint64_t vaddr = map_info_.heap.GetVirtAddr() + GetHeapMappedSize();
+  const uint64_t byte_size = kHeapChunkSize - (vaddr & (kHeapChunkSize - 1));
+  KernelPageCache& allocator = GetCPULocalPageCache();
+  const uint64_t paddr = allocator.AllocPages<uint64_t>(
+      byte_size >> kPageSizeExponent);
+  const uint64_t attr = (cpu_context_.int_ctx.cs & 3) ? kPageAttrUser : 0;
+  CreatePageMapping(allocator, GetCR3(), vaddr, paddr, byte_size,
+                    kPageAttrPresent | kPageAttrWritable | attr);
+  heap_expanded_size_ += byte_size;
+}
+
+void ExecutionContext::ShrinkHeap() {
+  // Unmaps and frees the last chunk mapped by GrowHeap.
+  const uint64_t initial_end = map_info_.heap.GetVirtEndAddr();
+  const uint64_t end = map_info_.heap.GetVirtAddr() + GetHeapMappedSize();
+  uint64_t vaddr = (end - 1) & ~(kHeapChunkSize - 1);
+  if (vaddr < initial_end)
+    vaddr = initial_end;
+  const uint64_t byte_size = end - vaddr;
+  const uint64_t paddr = GetCR3().v2p(vaddr);
+  assert(paddr != kAddrCannotTranslate);
+  RemovePageMapping(GetCR3(), vaddr, byte_size);
+  // The kernel heap is shared by all address spaces via the upper half.
+  TLB::InvalidateRange(vaddr, byte_size);
+  GetCPULocalPageCache().FreePages(paddr, byte_size >> kPageSizeExponent);
+  heap_expanded_size_ -= byte_size;
+}
 
 void ExecutionContext::Flush(IA_PML4& pml4, uint64_t& num_of_clflush_issued) {
   map_info_.Flush(pml4, num_of_clflush_issued);
@@ -78,10 +78,20 @@ class ExecutionContext {
   uint64_t GetRSP() { return cpu_context_.int_ctx.rsp; }
   uint64_t GetKernelRSP() { return kernel_rsp_; }
   void SetKernelRSP(uint64_t kernel_rsp) { kernel_rsp_ = kernel_rsp; }
-  void ExpandHeap(int64_t diff);
+  // The heap starts with map_info_.heap and grows on demand, by chunks
+  // aligned to kHeapChunkSize so that they can be mapped with 2MB pages.
+  static constexpr uint64_t kHeapChunkSize = IA_PDE::kChunkSize;
+  static constexpr uint64_t kDefaultHeapLimitSize = 256ULL * 1024 * 1024;
+  bool ExpandHeap(int64_t diff);
   uint64_t GetHeapEndVirtAddr() {
     return heap_used_size_ + map_info_.heap.GetVirtAddr();
   }
+  uint64_t GetHeapMappedSize() {
+    return map_info_.heap.GetMapSize() + heap_expanded_size_;
+  }
+  void SetHeapLimitSize(uint64_t heap_limit_size) {
+    heap_limit_size_ = heap_limit_size;
+  }
   void SetCR3(IA_PML4& cr3) {
     cpu_context_.cr3 = reinterpret_cast<uint64_t>(&cr3);
   }
@@ -98,20 +108,11 @@ class ExecutionContext {
     cpu_context_.int_ctx.rsp = reinterpret_cast<uint64_t>(rsp);
     cpu_context_.int_ctx.ss = ss;
     cpu_context_.int_ctx.rflags = rflags | 2;
-    // 10.2.3 MXCSR Control and Status Register
-    // Mask all FPU exceptions
-    /*
-    for(int i = 0; i < 512; i++){
-      cpu_context_.fpu_context.data[i] = 0;
-    }
-    cpu_context_.fpu_context.data[24] = 0x80;
-    cpu_context_.fpu_context.data[25] = 0x1F;
-    cpu_context_.fpu_context.data[26] = 0x00;
-    cpu_context_.fpu_context.data[27] = 0x00;
-    */
     cpu_context_.cr3 = cr3;
     kernel_rsp_ = kernel_rsp;
     heap_used_size_ = 0;
+    heap_expanded_size_ = 0;
+    heap_limit_size_ = kDefaultHeapLimitSize;
   }
   void Flush(IA_PML4& pml4, uint64_t& stat);
   void CopyContextFrom(ExecutionContext& from, uint64_t& stat_copied_bytes) {
@@ -124,10 +125,15 @@ class ExecutionContext {
   }
 
  private:
+  void GrowHeap();
+  void ShrinkHeap();
+
   CPUContext cpu_context_;
   ProcessMappingInfo map_info_;
   uint64_t kernel_rsp_;
   uint64_t heap_used_size_;
+  uint64_t heap_expanded_size_;
+  uint64_t heap_limit_size_;
 };
 
 class PersistentProcessInfo {
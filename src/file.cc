@@ -0,0 +1,37 @@
+#include "file.h"
+
+#include "liumos.h"
+
+class ConsoleFile : public File {
+ public:
+  ConsoleFile() : File(Type::kConsole) {}
+  int64_t Read(void* buf, size_t count) override {
+    // Returns one key at a time.
+    if (count < 1)
+      return kInvalid;
+    uint16_t keyid = KeyID::kNoInput;
+    liumos->main_console->GetInputWaitQueue().WaitUntil([&keyid] {
+      keyid = liumos->main_console->GetCharWithoutBlocking();
+      return keyid != KeyID::kNoInput && !(keyid & KeyID::kMaskBreak);
+    });
+    reinterpret_cast<uint8_t*>(buf)[0] = static_cast<uint8_t>(keyid);
+    return 1;
+  }
+  int64_t Write(const void* buf, size_t count) override {
+    const char* p = reinterpret_cast<const char*>(buf);
+    for (size_t i = 0; i < count; i++)
+      PutChar(p[i]);
+    return static_cast<int64_t>(count);
+  }
+};
+
+static ConsoleFile* console_file_;
+
+void OpenStandardFiles(FileDescriptorTable& table) {
+  if (!console_file_)
+    console_file_ = new ConsoleFile();
+  for (int fd = 0; fd < 3; fd++) {
+    const int opened = table.Open(*console_file_);
+    assert(opened == fd);
+  }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "generic.h"
+
+// https://elixir.bootlin.com/linux/v4.15/source/include/uapi/asm-generic/errno-base.h#L6
+enum ErrorNumber {
+  kBadFileDescriptor = -9,
+  kInvalid = -22,
+  kTooManyOpenFiles = -24,
+  kNoSystemCall = -38,
+};
+
+class File {
+  // Object referred by file descriptors. Freed when the last reference is
+  // dropped. Files are used only on the BSP, since syscalls are served there.
+ public:
+  enum class Type {
+    kConsole,
+    kSocket,
+  };
+  Type GetType() const { return type_; }
+  void Ref() { num_of_refs_++; }
+  void Unref() {
+    assert(num_of_refs_ > 0);
+    if (--num_of_refs_ == 0)
+      delete this;
+  }
+  // Return the number of bytes or a negative ErrorNumber.
+  virtual int64_t Read(void*, size_t) { return kInvalid; }
+  virtual int64_t Write(const void*, size_t) { return kInvalid; }
+
+ protected:
+  File(Type type) : type_(type), num_of_refs_(1) {}
+  virtual ~File() {}
+
+ private:
+  const Type type_;
+  int num_of_refs_;
+};
+
+class FileDescriptorTable {
+  // Files opened by a process, indexed by file descriptors.
+ public:
+  static constexpr int kMaxNumOfFiles = 64;
+  FileDescriptorTable() : used_(0), files_{} {}
+  // Takes a reference of file and returns the lowest free fd, or
+  // kTooManyOpenFiles.
+  int Open(File& file) {
+    if (~used_ == 0)
+      return kTooManyOpenFiles;
+    const int fd = __builtin_ctzll(~used_);
+    used_ |= 1ULL << fd;
+    file.Ref();
+    files_[fd] = &file;
+    return fd;
+  }
+  File* Get(int fd) {
+    if (fd < 0 || fd >= kMaxNumOfFiles)
+      return nullptr;
+    return files_[fd];
+  }
+  // Returns false if fd is not opened.
+  bool Close(int fd) {
+    File* file = Get(fd);
+    if (!file)
+      return false;
+    files_[fd] = nullptr;
+    used_ &= ~(1ULL << fd);
+    file->Unref();
+    return true;
+  }
+  void CloseAll() {
+    for (int fd = 0; fd < kMaxNumOfFiles; fd++)
+      Close(fd);
+  }
+
+ private:
+  static_assert(kMaxNumOfFiles == 64, "used_ is uint64_t");
+  uint64_t used_;
+  File* files_[kMaxNumOfFiles];
+};
+
+// Opens the console as fd 0, 1 and 2.
+void OpenStandardFiles(FileDescriptorTable& table);
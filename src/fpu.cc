@@ -0,0 +1,67 @@
+#include "fpu.h"
+
+#include "liumos.h"
+#include "scheduler.h"
+#include "util.h"
+
+constexpr uint64_t kCR0BitMonitorCoprocessor = 1ULL << 1;
+constexpr uint64_t kCR0BitEmulation = 1ULL << 2;
+constexpr uint64_t kCR4BitOSXSAVE = 1ULL << 18;
+// x87, SSE, AVX and AVX-512 states
+constexpr uint64_t kXCR0UserStates = 0b1110'0111;
+
+constexpr int kOffsetOfFCW = 0;
+constexpr int kOffsetOfMXCSR = 24;
+
+void FPU::InitForCurrentProcessor() {
+  // FPU instructions raise #NM only if TS is set.
+  WriteCR0((ReadCR0() & ~kCR0BitEmulation) | kCR0BitMonitorCoprocessor);
+  if (!GetBit<CPUFeatureIndex::kXSAVE>(liumos->cpu_features->features))
+    return;
+  WriteCR4(ReadCR4() | kCR4BitOSXSAVE);
+  CPUID cpuid;
+  ReadCPUID(&cpuid, 0xD, 0);
+  const uint64_t xsave_mask =
+      ((static_cast<uint64_t>(cpuid.edx) << 32) | cpuid.eax) & kXCR0UserStates;
+  WriteXCR0(xsave_mask);
+  // EBX reports the size for the states enabled in XCR0.
+  ReadCPUID(&cpuid, 0xD, 0);
+  IntHandlerFPUStateSize = cpuid.ebx;
+  IntHandlerXSaveMask = xsave_mask;
+}
+
+void FPU::InitState(void* state) {
+  // Same as the state after FNINIT, with all exceptions masked. XRSTOR
+  // initializes the other states since XSTATE_BV in the header is zero.
+  uint8_t* p = reinterpret_cast<uint8_t*>(state);
+  bzero(p, IntHandlerFPUStateSize);
+  constexpr uint16_t kInitialFCW = 0x037F;
+  constexpr uint32_t kInitialMXCSR = 0x1F80;
+  memcpy(p + kOffsetOfFCW, &kInitialFCW, sizeof(kInitialFCW));
+  memcpy(p + kOffsetOfMXCSR, &kInitialMXCSR, sizeof(kInitialMXCSR));
+}
+
+void FPU::OnSwitch(InterruptInfo& info, Process& from) {
+  // The handler may have used the registers, so the state of from is valid
+  // only if IntHandlerWrapper saved it. Otherwise it is in fpu_state_
+  // already. The registers are not restored on return, so the next process
+  // raises #NM on its first FPU instruction.
+  if (!info.fpu_state)
+    return;
+  memcpy(from.fpu_state_, info.fpu_state, IntHandlerFPUStateSize);
+  from.has_fpu_state_ = true;
+  info.fpu_state = nullptr;
+}
+
+void FPU::DeviceNotAvailableHandler(uint64_t, InterruptInfo* info) {
+  // Raised by the first FPU instruction of the current process after a
+  // switch. Handlers never raise it, since they run with CR0.TS cleared.
+  Process& proc = liumos->scheduler->GetCurrentProcess();
+  if (!proc.has_fpu_state_) {
+    InitState(proc.fpu_state_);
+    proc.has_fpu_state_ = true;
+  }
+  // IntHandlerWrapper loads it on return.
+  info->fpu_state = proc.fpu_state_;
+  proc.num_of_fpu_restores_++;
+}
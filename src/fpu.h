@@ -0,0 +1,39 @@
+#pragma once
+
+#include "generic.h"
+
+class Process;
+class Processor;
+struct InterruptInfo;
+
+// Defined in inthandler.S
+extern "C" uint64_t IntHandlerFPUStateSize;
+extern "C" uint64_t IntHandlerXSaveMask;
+
+class FPU {
+  // Lazy switching of x87/SSE/AVX registers. Switching to a process sets
+  // CR0.TS, and its state is restored on #NM raised by its first FPU
+  // instruction. Processes which do not use FPU pay nothing on switches.
+  // Interrupt handlers may use FPU, since the compiler emits SSE for
+  // struct copies and newlib is optimized. On interrupts, IntHandlerWrapper
+  // saves the registers on the stack if they have the state of the
+  // interrupted code, i.e. CR0.TS is clear, and clears CR0.TS otherwise.
+  // The saved state is restored on return, or moved to the process by
+  // OnSwitch(). Syscalls run as a part of the process, so they may clobber
+  // the caller-saved registers as a function call does.
+ public:
+  // Enables XSAVE if available and sets up the current processor.
+  static void InitForCurrentProcessor();
+  // Size of the save area for each process, which should be 64-byte
+  // aligned.
+  static uint32_t GetStateSize() { return IntHandlerFPUStateSize; }
+  // True if the YMM registers are enabled in XCR0.
+  static bool IsAVXEnabled() { return (IntHandlerXSaveMask & 0b110) == 0b110; }
+  static constexpr uint64_t kStateAlign = 64;
+  // Called on context switches in interrupt handlers.
+  static void OnSwitch(InterruptInfo& info, Process& from);
+  static void DeviceNotAvailableHandler(uint64_t intcode, InterruptInfo* info);
+
+ private:
+  static void InitState(void* state);
+};
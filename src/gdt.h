@@ -32,6 +32,9 @@ class GDT {
   static constexpr uint64_t kTSS64Selector = kTSS64Index << 3;
 
   void Init(uint64_t kernel_stack_pointer, uint64_t ist1_pointer);
+  void SetIST(int index, uint64_t stack_pointer) {
+    tss64_.ist[index] = stack_pointer;
+  }
   void Print(void);
 
  private:
@@ -75,12 +75,6 @@ void HPET::BusyWait(uint64_t ms) {
   while (ReadMainCounterValue() < count)
     Sleep();
 }
-void HPET::BusyWaitMicroSecond(uint64_t microsec) {
-  uint64_t count = 1'000'000'000ULL * microsec / femtosecond_per_count_ +
-                   ReadMainCounterValue();
-  while (ReadMainCounterValue() < count)
-    Sleep();
-}
 uint64_t HPET::GetFemtosecondPerCount() {
   return femtosecond_per_count_;
 }
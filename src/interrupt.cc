@@ -1,6 +1,8 @@
 #include "liumos.h"
 #include "panic_printer.h"
+#ifndef LIUMOS_LOADER
 #include "scheduler.h"
+#endif
 
 IDT* IDT::idt_;
 
@@ -40,10 +42,12 @@ void IDT::IntHandler(uint64_t intcode, InterruptInfo* info) {
   }
   auto& pp = PanicPrinter::BeginPanic();
   PrintInterruptInfo(pp, intcode, info);
+#ifndef LIUMOS_LOADER
   if (liumos->is_multi_task_enabled) {
     Process& proc = liumos->scheduler->GetCurrentProcess();
     pp.PrintLineWithHex("Context#", proc.GetID());
   }
+#endif
   if (intcode == 0x08) {
     pp.EndPanicAndDie("Double Fault");
   }
@@ -62,7 +66,8 @@ void IDT::IntHandler(uint64_t intcode, InterruptInfo* info) {
     pp.PrintLineWithHex("CR2", ReadCR2());
     if (info->error_code & 1) {
       // present but not ok. print entries.
-      reinterpret_cast<IA_PML4*>(ReadCR3())->DebugPrintEntryForAddr(ReadCR2());
+      reinterpret_cast<IA_PML4*>(ReadCR3() & ~kCR3PCIDMask)
+          ->DebugPrintEntryForAddr(ReadCR2());
     }
     pp.EndPanicAndDie("Page Fault");
   }
@@ -93,6 +98,17 @@ void IDT::SetIntHandler(uint64_t intcode, InterruptHandler handler) {
   handler_list_[intcode] = handler;
 }
 
+uint8_t IDT::AllocDeviceVector(InterruptHandler handler) {
+  const bool was_enabled = DisableInterrupts();
+  if (num_of_device_vectors_ >= kNumOfDeviceVectors)
+    Panic("No device vector left");
+  const uint8_t vector =
+      static_cast<uint8_t>(kDeviceVectorBase + num_of_device_vectors_++);
+  SetIntHandler(vector, handler);
+  RestoreInterrupts(was_enabled);
+  return vector;
+}
+
 void PrintIDTGateDescriptor(IDTGateDescriptor* desc) {
   PutStringAndHex("desc.ofs", ((uint64_t)desc->offset_high << 32) |
                                   ((uint64_t)desc->offset_mid << 16) |
@@ -131,15 +147,19 @@ void IDT::Init() {
   idt_->InitInternal();
 }
 
-void IDT::InitInternal() {
-  uint16_t cs = ReadCSSelector();
-
+void IDT::Load() {
   IDTR idtr;
   idtr.limit = sizeof(descriptors_) - 1;
   idtr.base = descriptors_;
+  WriteIDTR(&idtr);
+}
+
+void IDT::InitInternal() {
+  uint16_t cs = ReadCSSelector();
 
   for (int i = 0; i < 0x100; i++) {
-    SetEntry(i, cs, 1, IDTType::kInterruptGate, 0, AsmIntHandlerNotImplemented);
+    SetEntry(i, cs, kISTForExceptions, IDTType::kInterruptGate, 0,
+             AsmIntHandlerNotImplemented);
     handler_list_[i] = nullptr;
   }
 
@@ -149,15 +169,40 @@ void IDT::InitInternal() {
   SetEntry(0x06, cs, 0, IDTType::kInterruptGate, 0, AsmIntHandler06);
   SetEntry(0x07, cs, 0, IDTType::kInterruptGate, 0,
            AsmIntHandler07_DeviceNotAvailable);
-  SetEntry(0x08, cs, 1, IDTType::kInterruptGate, 0, AsmIntHandler08);
+  SetEntry(0x08, cs, kISTForExceptions, IDTType::kInterruptGate, 0,
+           AsmIntHandler08);
   SetEntry(0x0d, cs, 0, IDTType::kInterruptGate, 0, AsmIntHandler0D);
-  SetEntry(0x0e, cs, 1, IDTType::kInterruptGate, 0, AsmIntHandler0E);
+  SetEntry(0x0e, cs, kISTForExceptions, IDTType::kInterruptGate, 0,
+           AsmIntHandler0E);
   SetEntry(0x10, cs, 0, IDTType::kInterruptGate, 0,
            AsmIntHandler10_x87FPUError);
   SetEntry(0x13, cs, 0, IDTType::kInterruptGate, 0,
            AsmIntHandler13_SIMDFPException);
-  SetEntry(0x20, cs, 0, IDTType::kInterruptGate, 0, AsmIntHandler20);
-  SetEntry(0x21, cs, 0, IDTType::kInterruptGate, 0, AsmIntHandler21);
-  SetEntry(0x22, cs, 0, IDTType::kInterruptGate, 0, AsmIntHandler22);
-  WriteIDTR(&idtr);
+  SetEntry(0x20, cs, kISTForInterrupts, IDTType::kInterruptGate, 0,
+           AsmIntHandler20);
+  SetEntry(0x21, cs, kISTForInterrupts, IDTType::kInterruptGate, 0,
+           AsmIntHandler21);
+  SetEntry(0x22, cs, kISTForInterrupts, IDTType::kInterruptGate, 0,
+           AsmIntHandler22);
+  SetEntry(kSleepVector, cs, kISTForInterrupts, IDTType::kInterruptGate, 0,
+           AsmIntHandler2F);
+  SetEntry(0x30, cs, kISTForInterrupts, IDTType::kInterruptGate, 0,
+           AsmIntHandler30);
+  SetEntry(0x31, cs, kISTForInterrupts, IDTType::kInterruptGate, 0,
+           AsmIntHandler31);
+  SetEntry(0x32, cs, kISTForInterrupts, IDTType::kInterruptGate, 0,
+           AsmIntHandler32);
+  SetEntry(0x33, cs, kISTForInterrupts, IDTType::kInterruptGate, 0,
+           AsmIntHandler33);
+  SetEntry(0x34, cs, kISTForInterrupts, IDTType::kInterruptGate, 0,
+           AsmIntHandler34);
+  SetEntry(0x35, cs, kISTForInterrupts, IDTType::kInterruptGate, 0,
+           AsmIntHandler35);
+  SetEntry(0x36, cs, kISTForInterrupts, IDTType::kInterruptGate, 0,
+           AsmIntHandler36);
+  SetEntry(0x37, cs, kISTForInterrupts, IDTType::kInterruptGate, 0,
+           AsmIntHandler37);
+  static_assert(kDeviceVectorBase == 0x30 && kNumOfDeviceVectors == 8);
+  num_of_device_vectors_ = 0;
+  Load();
 }
@@ -6,19 +6,35 @@ using InterruptHandler = void (*)(uint64_t intcode, InterruptInfo* info);
 
 class IDT {
  public:
+  // Stacks in TSS. Interrupts are handled on the interrupt stack of each
+  // processor, so the context of the interrupted process is saved there, not
+  // on its own stack, which another processor may resume right after that.
+  static constexpr uint8_t kISTForExceptions = 1;
+  static constexpr uint8_t kISTForInterrupts = 2;
+  // Raised by Sleep() to switch processes.
+  static constexpr uint8_t kSleepVector = 0x2F;
+  // Vectors given to devices by AllocDeviceVector
+  static constexpr uint8_t kDeviceVectorBase = 0x30;
+  static constexpr int kNumOfDeviceVectors = 8;
+
   void IntHandler(uint64_t intcode, InterruptInfo* info);
   void SetIntHandler(uint64_t intcode, InterruptHandler handler);
+  // Returns a free vector for MSI or MSI-X, which is handled by handler.
+  uint8_t AllocDeviceVector(InterruptHandler handler);
 
   static IDT& GetInstance() {
     assert(idt_);
     return *idt_;
   }
   static void Init();
+  // Loads the IDT on the current processor.
+  void Load();
 
  private:
   static IDT* idt_;
   IDTGateDescriptor descriptors_[256];
   InterruptHandler handler_list_[256];
+  int num_of_device_vectors_;
 
   IDT() = delete;
   void InitInternal();
@@ -11,18 +11,19 @@
 #include "pci.h"
 #include "ps2_mouse.h"
 #include "rtl81xx.h"
+#include "tlb.h"
 #include "virtio_net.h"
 #include "xhci.h"
 
 LiumOS* liumos;
 
-GDT gdt_;
 KeyboardController keyboard_ctrl_;
 LiumOS liumos_;
 Sheet virtual_vram_;
 Sheet virtual_screen_;
 Console virtual_console_;
-LocalAPIC bsp_local_apic_;
+KernelPageCache bsp_page_cache_;
+KernelSlabAllocator kernel_slab_allocator_;
 CPUFeatureSet cpu_features_;
 SerialPort com1_;
 SerialPort com2_;
@@ -100,7 +101,8 @@ void InitializeVRAMForKernel() {
   CreatePageMapping(
       GetSystemDRAMAllocator(), GetKernelPML4(), kernel_virtual_vram_base,
       reinterpret_cast<uint64_t>(liumos->vram_sheet->GetBuf()),
-      liumos->vram_sheet->GetBufSize(), kPageAttrPresent | kPageAttrWritable);
+      liumos->vram_sheet->GetBufSize(),
+      kPageAttrPresent | kPageAttrWritable | kPageAttrGlobal);
   virtual_vram_.Init(reinterpret_cast<uint32_t*>(kernel_virtual_vram_base),
                      xsize, ysize, ppsl);
 
@@ -108,7 +110,8 @@ void InitializeVRAMForKernel() {
   CreatePageMapping(
       GetSystemDRAMAllocator(), GetKernelPML4(), kernel_virtual_screen_base,
       reinterpret_cast<uint64_t>(liumos->screen_sheet->GetBuf()),
-      liumos->screen_sheet->GetBufSize(), kPageAttrPresent | kPageAttrWritable);
+      liumos->screen_sheet->GetBufSize(),
+      kPageAttrPresent | kPageAttrWritable | kPageAttrGlobal);
   virtual_screen_.Init(reinterpret_cast<uint32_t*>(kernel_virtual_screen_base),
                        xsize, ysize, ppsl);
   virtual_screen_.SetParent(&virtual_vram_);
@@ -119,93 +122,103 @@ void InitializeVRAMForKernel() {
   liumos->screen_sheet = &virtual_screen_;
 }
 
-void CreateAndLaunchKernelTask(void (*entry_point)()) {
-  const int kNumOfStackPages = 64;
+constexpr int kNumOfKernelTaskStackPages = 64;
+
+Process& CreateKernelTask(void (*entry_point)(), int priority) {
   void* sub_context_stack_base =
-      liumos->kernel_heap_allocator->AllocPages<void*>(kNumOfStackPages);
+      liumos->kernel_heap_allocator->AllocPages<void*>(
+          kNumOfKernelTaskStackPages);
   kprintf("KernelTask stack: [%p - %p)\n", sub_context_stack_base,
           reinterpret_cast<uint8_t*>(sub_context_stack_base) +
-              kNumOfStackPages * kPageSize);
+              kNumOfKernelTaskStackPages * kPageSize);
   void* sub_context_rsp = reinterpret_cast<void*>(
       reinterpret_cast<uint64_t>(sub_context_stack_base) +
-      (kNumOfStackPages << kPageSizeExponent) - 8);
+      (kNumOfKernelTaskStackPages << kPageSizeExponent) - 8);
   kprintf("Initial RSP: %p\n", sub_context_rsp);
   // -8 here for alignment (which is usually used to store return pointer)
 
-  ExecutionContext& sub_context =
-      *liumos->kernel_heap_allocator->Alloc<ExecutionContext>();
+  ExecutionContext& sub_context = *AllocKernelObject<ExecutionContext>();
   sub_context.SetRegisters(entry_point, GDT::kKernelCSSelector, sub_context_rsp,
-                           GDT::kKernelDSSelector, ReadCR3(),
+                           GDT::kKernelDSSelector,
+                           ReadCR3() & ~kCR3PCIDMask,
                            kRFlagsInterruptEnable, 0);
 
   Process& proc = liumos->proc_ctrl->Create();
   proc.InitAsEphemeralProcess(sub_context);
-  liumos->scheduler->RegisterProcess(proc);
+  liumos->scheduler->SetPriority(proc, priority);
+  return proc;
 }
 
-static void EnsureAddrIs16ByteAligned(Process& from,
-                                      Process& to,
-                                      const char* label,
-                                      void* addr) {
-  if ((reinterpret_cast<uint64_t>(addr) & 0xF) == 0)
-    return;
-  PutStringAndHex(label, addr);
-  PutStringAndHex("From Process#", from.GetID());
-  PutStringAndHex("To   Process#", to.GetID());
-  Panic("Not 16-byte aligned\n");
+void DestroyUnstartedKernelTask(Process& proc) {
+  // The stack is found from the initial RSP, since the task has never run.
+  assert(proc.GetStatus() == Process::Status::kNotScheduled);
+  const uint64_t stack_end = proc.GetExecutionContext().GetRSP() + 8;
+  liumos->kernel_heap_allocator->FreePages(
+      stack_end - (kNumOfKernelTaskStackPages << kPageSizeExponent),
+      kNumOfKernelTaskStackPages);
+  liumos->proc_ctrl->Destroy(proc);
+}
+
+void CreateAndLaunchKernelTask(void (*entry_point)(),
+                               int priority = Process::kDefaultPriority) {
+  liumos->scheduler->RegisterProcess(CreateKernelTask(entry_point, priority));
+}
+
+void IdleTask() {
+  // Runs only when all the other processes are blocked.
+  for (;;) {
+    StoreIntFlagAndHalt();
+    // Switch to the process woken by the interrupt, if any.
+    Sleep();
+  }
 }
 
 void SwitchContext(InterruptInfo& int_info,
                    Process& from_proc,
                    Process& to_proc) {
-  static uint64_t proc_last_time_count = 0;
-  const uint64_t now_count = HPET::GetInstance().ReadMainCounterValue();
-  if ((proc_last_time_count - now_count) < liumos->time_slice_count)
-    return;
-
-  from_proc.AddProcTimeFemtoSec(
-      (HPET::GetInstance().ReadMainCounterValue() - proc_last_time_count) *
-      HPET::GetInstance().GetFemtosecondPerCount());
-
   CPUContext& from = from_proc.GetExecutionContext().GetCPUContext();
-  const uint64_t t0 = HPET::GetInstance().ReadMainCounterValue();
-
-  EnsureAddrIs16ByteAligned(from_proc, to_proc, "int_info.fpu_context",
-                            &int_info.fpu_context);
+  const uint64_t t0 = Clock::ReadCount();
 
-  from.cr3 = ReadCR3();
   from.greg = int_info.greg;
   from.int_ctx = int_info.int_ctx;
   from_proc.NotifyContextSaving();
-  const uint64_t t1 = HPET::GetInstance().ReadMainCounterValue();
+  // Before FinishSwitch, since from_proc may be resumed on another processor
+  // after it.
+  FPU::OnSwitch(int_info, from_proc);
+  const uint64_t t1 = Clock::ReadCount();
   from_proc.AddTimeConsumedInContextSavingFemtoSec(
-      (t1 - t0) * HPET::GetInstance().GetFemtosecondPerCount());
+      Clock::CountToFemtoSecond(t1 - t0));
 
   CPUContext& to = to_proc.GetExecutionContext().GetCPUContext();
   int_info.greg = to.greg;
   int_info.int_ctx = to.int_ctx;
-  if (from.cr3 == to.cr3)
-    return;
-  WriteCR3(to.cr3);
-  // TODO: Investigate why this line causes #GP on pi.bin
-  // maybe ReadMainCounterValue accesses physical addr with
-  // user pagetable?
-  // proc_last_time_count = HPET::GetInstance().ReadMainCounterValue();
+  TLB::OnSwitch(GetCurrentProcessor(), to_proc);
 }
 
-__attribute__((ms_abi)) extern "C" void SleepHandler(uint64_t,
-                                                     InterruptInfo* info) {
+static void SwitchToNextProcess(InterruptInfo* info, bool should_yield) {
   Process& proc = liumos->scheduler->GetCurrentProcess();
-  Process* next_proc = liumos->scheduler->SwitchProcess();
-  if (!next_proc)
-    return;  // no need to switching context.
-  assert(info);
-  SwitchContext(*info, proc, *next_proc);
+  Process* next_proc = liumos->scheduler->SwitchProcess(should_yield);
+  if (next_proc) {
+    assert(info);
+    SwitchContext(*info, proc, *next_proc);
+    liumos->scheduler->FinishSwitch(proc);
+  }
+  // Input from the serial port is polled on ticks.
+  liumos->scheduler->ArmTimer(
+      !liumos->main_console->GetInputWaitQueue().IsEmpty());
+}
+
+void SleepHandler(uint64_t, InterruptInfo* info) {
+  SwitchToNextProcess(info, true);
 }
 
 void TimerHandler(uint64_t, InterruptInfo* info) {
-  liumos->bsp_local_apic->SendEndOfInterrupt();
-  SleepHandler(0, info);
+  // Each processor has its own local APIC timer.
+  Processor& cpu = GetCurrentProcessor();
+  cpu.GetLocalAPIC().SendEndOfInterrupt();
+  if (liumos->scheduler->OnTimerInterrupt(cpu))
+    liumos->main_console->GetInputWaitQueue().WakeUpAll();
+  SwitchToNextProcess(info, false);
 }
 
 void CoreFunc::PutChar(char c) {
@@ -229,6 +242,33 @@ KernelPhysPageAllocator& GetKernelPhysPageAllocator() {
       GetKernelStraightMappingBase());
 }
 
+KernelPageCache& GetCPULocalPageCache() {
+  // Only the BSP allocates pages, as the backing allocator has no lock
+  // either. APs run only processes in user mode, which do not allocate.
+  // GetCurrentProcessor is not available until the BSP loads its GDT, which
+  // is done before APs are started.
+  assert(GetNumOfProcessors() == 1 || GetCurrentProcessor().IsBSP());
+  return bsp_page_cache_;
+}
+
+KernelSlabAllocator& GetKernelSlabAllocator() {
+  return kernel_slab_allocator_;
+}
+
+void* kmalloc(size_t size) {
+  return kernel_slab_allocator_.Alloc(size);
+}
+
+void* kzalloc(size_t size) {
+  void* p = kmalloc(size);
+  bzero(p, size);
+  return p;
+}
+
+void kfree(void* p) {
+  kernel_slab_allocator_.Free(p);
+}
+
 void SubTask();  // @subtask.cc
 
 extern "C" void KernelEntry(LiumOS* liumos_passed, LoaderInfo& loader_info) {
@@ -237,27 +277,34 @@ extern "C" void KernelEntry(LiumOS* liumos_passed, LoaderInfo& loader_info) {
   liumos = &liumos_;
 
   auto& kernel_phys_page_allocator = GetKernelPhysPageAllocator();
+  bsp_page_cache_.Init(kernel_phys_page_allocator);
   InitPMEMManagement();
 
-  KernelVirtualHeapAllocator kernel_heap_allocator(GetKernelPML4(),
-                                                   kernel_phys_page_allocator);
+  KernelVirtualHeapAllocator kernel_heap_allocator(GetKernelPML4());
   liumos->kernel_heap_allocator = &kernel_heap_allocator;
+  kernel_slab_allocator_.Init(kernel_heap_allocator);
 
   Disable8259PIC();
-  bsp_local_apic_.Init();
+  LocalAPIC& bsp_local_apic = GetProcessor(0).GetLocalAPIC();
+  bsp_local_apic.Init();
 
-  InitIOAPIC(bsp_local_apic_.GetID());
+  InitIOAPIC(bsp_local_apic.GetID());
 
   HPET& hpet = HPET::GetInstance();
   hpet.Init(static_cast<HPET::RegisterSpace*>(
       liumos->acpi.hpet->base_address.address));
-  hpet.SetTimerNs(
-      0, 1000,
-      HPET::TimerConfig::kUsePeriodicMode | HPET::TimerConfig::kEnable);
-  liumos->time_slice_count = 1e12 * 100 / hpet.GetFemtosecondPerCount();
+  CalibrateLocalAPICTimer(bsp_local_apic);
 
   cpu_features_ = *liumos->cpu_features;
   liumos->cpu_features = &cpu_features_;
+  Clock::Init();
+  liumos->time_slice_count = Clock::NanoSecondToCount(1'000'000);
+  FPU::InitForCurrentProcessor();
+  Network::InternetChecksum::InitSIMD(
+      GetBit<CPUFeatureIndex::kSSE2>(cpu_features_.features),
+      GetBit<CPUFeatureIndex::kAVX2>(cpu_features_.features) &&
+          FPU::IsAVXEnabled());
+  TLB::InitForCurrentProcessor();
 
   InitializeVRAMForKernel();
 
@@ -272,16 +319,42 @@ extern "C" void KernelEntry(LiumOS* liumos_passed, LoaderInfo& loader_info) {
 
   liumos->main_console->SetSerial(&com2_);
 
-  PanicPrinter::Init(liumos->kernel_heap_allocator->Alloc<PanicPrinter>(),
-                     virtual_vram_, com2_);
+  PanicPrinter::Init(AllocKernelObject<PanicPrinter>(), virtual_vram_, com2_);
+
+  bsp_local_apic.Init();
+
+  constexpr uint64_t kNumOfKernelStackPages = 128;
+  uint64_t kernel_stack_physical_base =
+      GetSystemDRAMAllocator().AllocPages<uint64_t>(kNumOfKernelStackPages);
+  uint64_t kernel_stack_virtual_base = 0xFFFF'FFFF'2000'0000ULL;
+  CreatePageMapping(GetSystemDRAMAllocator(), GetKernelPML4(),
+                    kernel_stack_virtual_base, kernel_stack_physical_base,
+                    kNumOfKernelStackPages << kPageSizeExponent,
+                    kPageAttrPresent | kPageAttrWritable | kPageAttrGlobal);
+  uint64_t kernel_stack_pointer =
+      kernel_stack_virtual_base + (kNumOfKernelStackPages << kPageSizeExponent);
+
+  uint64_t ist1_virt_base =
+      kernel_heap_allocator.AllocPages<uint64_t>(kNumOfKernelStackPages);
+  uint64_t ist2_virt_base =
+      kernel_heap_allocator.AllocPages<uint64_t>(kNumOfKernelStackPages);
 
-  bsp_local_apic_.Init();
+  // The scheduler finds the current processor from its GDT, so the GDT of
+  // the BSP is loaded before creating the scheduler.
+  Processor& bsp = GetProcessor(0);
+  bsp.Init(0, kernel_stack_pointer,
+           ist1_virt_base + (kNumOfKernelStackPages << kPageSizeExponent),
+           ist2_virt_base + (kNumOfKernelStackPages << kPageSizeExponent));
+  bsp.LoadGDT();
+  bsp.InitProximityDomain();
+  IDT::Init();
+  IDT::GetInstance().SetIntHandler(IDT::kSleepVector, SleepHandler);
+  IDT::GetInstance().SetIntHandler(0x07, FPU::DeviceNotAvailableHandler);
 
-  ProcessController proc_ctrl_(kernel_heap_allocator);
+  ProcessController proc_ctrl_(kernel_heap_allocator, FPU::GetStateSize());
   liumos->proc_ctrl = &proc_ctrl_;
 
-  ExecutionContext& root_context =
-      *liumos->kernel_heap_allocator->Alloc<ExecutionContext>();
+  ExecutionContext& root_context = *AllocKernelObject<ExecutionContext>();
   root_context.SetRegisters(nullptr, 0, nullptr, 0, ReadCR3(), 0, 0);
   ProcessMappingInfo& map_info = root_context.GetProcessMappingInfo();
   constexpr uint64_t kNumOfKernelHeapPages = 4;
@@ -328,23 +401,6 @@ extern "C" void KernelEntry(LiumOS* liumos_passed, LoaderInfo& loader_info) {
   kprintf("KernelPhysPageAllocator alloc 1: %p\n",
           kernel_phys_page_allocator.AllocPages<void*>(1));
 
-  constexpr uint64_t kNumOfKernelStackPages = 128;
-  uint64_t kernel_stack_physical_base =
-      GetSystemDRAMAllocator().AllocPages<uint64_t>(kNumOfKernelStackPages);
-  uint64_t kernel_stack_virtual_base = 0xFFFF'FFFF'2000'0000ULL;
-  CreatePageMapping(GetSystemDRAMAllocator(), GetKernelPML4(),
-                    kernel_stack_virtual_base, kernel_stack_physical_base,
-                    kNumOfKernelStackPages << kPageSizeExponent,
-                    kPageAttrPresent | kPageAttrWritable);
-  uint64_t kernel_stack_pointer =
-      kernel_stack_virtual_base + (kNumOfKernelStackPages << kPageSizeExponent);
-
-  uint64_t ist1_virt_base =
-      kernel_heap_allocator.AllocPages<uint64_t>(kNumOfKernelStackPages);
-
-  gdt_.Init(kernel_stack_pointer,
-            ist1_virt_base + (kNumOfKernelStackPages << kPageSizeExponent));
-  IDT::Init();
   keyboard_ctrl_.Init();
 
   PS2MouseController& mouse_ctrl = PS2MouseController::GetInstance();
@@ -356,13 +412,22 @@ extern "C" void KernelEntry(LiumOS* liumos_passed, LoaderInfo& loader_info) {
   pci.DetectDevices();
 
   // CreateAndLaunchKernelTask(SubTask);
-  CreateAndLaunchKernelTask(NetworkManager);
+  liumos->scheduler->RegisterIdleProcess(
+      CreateKernelTask(IdleTask, Process::kLowestPriority));
+  // Serve packets before other processes.
+  CreateAndLaunchKernelTask(NetworkManager, Process::kDefaultPriority - 4);
   CreateAndLaunchKernelTask(MouseManager);
 
+  InitSyscallTable();
   EnableSyscall();
 
+  InitLocalTimer(bsp_local_apic);
+  // The scheduler arms the next one on the first interrupt.
+  ArmLocalTimer(bsp_local_apic, 0);
   StoreIntFlag();
 
+  StartApplicationProcessors();
+
   // XHCI::Controller::GetInstance().Init();
   Virtio::Net::GetInstance().Init();
   RTL81::GetInstance().Init();
@@ -1,13 +1,20 @@
 #pragma once
 
+#include "clock.h"
+#include "fpu.h"
 #include "kernel.h"
 #include "liumos.h"
 #include "paging.h"
 #include "phys_page_allocator.h"
+#include "tlb.h"
 
 KernelPhysPageAllocator& GetKernelPhysPageAllocator();
 uint64_t GetKernelStraightMappingBase();
 void kprintf(const char* fmt, ...);
+Process& CreateKernelTask(void (*entry_point)(), int priority);
+// Frees a task from CreateKernelTask which has not been registered.
+void DestroyUnstartedKernelTask(Process& proc);
+void IdleTask();
 void kprintbuf(const char* desc,
                const volatile void* data,
                size_t start,
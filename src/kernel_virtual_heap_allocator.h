@@ -1,25 +1,31 @@
 #pragma once
 
 #include "generic.h"
+#include "page_cache.h"
 #include "paging.h"
 #include "phys_page_allocator.h"
+#include "slab_allocator.h"
 
 class KernelVirtualHeapAllocator {
  public:
-  KernelVirtualHeapAllocator(IA_PML4& pml4,
-                             KernelPhysPageAllocator& dram_allocator)
-      : next_base_(kKernelHeapBaseAddr),
-        pml4_(pml4),
-        dram_allocator_(dram_allocator){};
+  KernelVirtualHeapAllocator(IA_PML4& pml4)
+      : next_base_(kKernelHeapBaseAddr), pml4_(pml4){};
   template <typename T>
   T AllocPages(uint64_t num_of_pages) {
     // Returns a memory region writable && present (in the kernel straight
     // mapping). This function is safe to be called under a user mappings.
     return reinterpret_cast<T>(
-        dram_allocator_.AllocPages<uint64_t>(num_of_pages) +
+        GetCPULocalPageCache().AllocPages<uint64_t>(num_of_pages) +
         GetKernelStraightMappingBase());
   }
   template <typename T>
+  void FreePages(T addr, uint64_t num_of_pages) {
+    // Counterpart of AllocPages.
+    GetCPULocalPageCache().FreePages(
+        reinterpret_cast<uint64_t>(addr) - GetKernelStraightMappingBase(),
+        num_of_pages);
+  }
+  template <typename T>
   T MapPages(uint64_t paddr, uint64_t num_of_pages, uint64_t page_attr) {
     uint64_t byte_size = (num_of_pages << kPageSizeExponent);
     if (byte_size > kKernelHeapSize ||
@@ -27,8 +33,8 @@ class KernelVirtualHeapAllocator {
       Panic("Cannot allocate kernel virtual heap");
     uint64_t vaddr = next_base_;
     next_base_ += byte_size + (1 << kPageSizeExponent);
-    CreatePageMapping(dram_allocator_, pml4_, vaddr, paddr, byte_size,
-                      page_attr);
+    CreatePageMapping(GetCPULocalPageCache(), pml4_, vaddr, paddr, byte_size,
+                      page_attr | kPageAttrGlobal);
     return reinterpret_cast<T>(vaddr);
   }
 
@@ -38,11 +44,27 @@ class KernelVirtualHeapAllocator {
     // mapping). This function is safe to be called under a user mappings.
     return AllocPages<T*>(ByteSizeToPageSize(sizeof(T)));
   }
+  template <typename T>
+  void Free(T* p) {
+    FreePages(p, ByteSizeToPageSize(sizeof(T)));
+  }
 
  private:
   static constexpr uint64_t kKernelHeapBaseAddr = 0xFFFF'FFFF'9000'0000;
   static constexpr uint64_t kKernelHeapSize = 0x0000'0000'4000'0000;
   uint64_t next_base_;
   IA_PML4& pml4_;
-  KernelPhysPageAllocator& dram_allocator_;
 };
+
+using KernelSlabAllocator = SlabAllocator<KernelVirtualHeapAllocator>;
+KernelSlabAllocator& GetKernelSlabAllocator();
+void* kmalloc(size_t size);
+void* kzalloc(size_t size);
+void kfree(void* p);
+
+template <typename T>
+T* AllocKernelObject() {
+  // Returns a zero-cleared region for T from the kernel slab allocator
+  // (in the kernel straight mapping).
+  return reinterpret_cast<T*>(kzalloc(sizeof(T)));
+}
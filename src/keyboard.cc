@@ -81,6 +81,7 @@ void KeyboardController::Init() {
 
 void KeyboardController::IntHandlerSub(uint64_t, InterruptInfo*) {
   keycode_buffer_.Push(ReadIOPort8(kIOPortKeyboardData));
+  liumos->main_console->GetInputWaitQueue().WakeUpAll();
   liumos->bsp_local_apic->SendEndOfInterrupt();
 }
 
@@ -1,9 +1,13 @@
 #include "generic.h"
+#include "liumos.h"
 
-void* operator new(unsigned long, std::align_val_t) {
-  Panic("void * operator new(unsigned long, std::align_val_t)");
+// operator new without alignment goes to malloc, which is backed by the
+// kernel slab allocator (see newlib_support.cc).
+
+void* operator new(unsigned long size, std::align_val_t align) {
+  return GetKernelSlabAllocator().Alloc(size, static_cast<uint64_t>(align));
 }
 
-void operator delete(void*, std::align_val_t) {
-  Panic("void operator delete(void*, std::align_val_t)");
+void operator delete(void* p, std::align_val_t) {
+  kfree(p);
 }
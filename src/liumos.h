@@ -99,4 +99,8 @@ T GetKernelVirtAddrForPhysAddr(T paddr) {
 void MainForBootProcessor(void* image_handle, EFI::SystemTable* system_table);
 
 // @syscall.cc
+// Called once on the BSP before EnableSyscall.
+void InitSyscallTable();
+// Sets up the syscall instruction on the current processor.
 void EnableSyscall();
+void PrintSyscallStatistics();
@@ -79,6 +79,11 @@ void IdentifyCPU() {
   f.features |= ((cpuid.ecx >> 27) & 1) << CPUFeatureIndex::kOSXSAVE;
   f.features |= ((cpuid.edx >> 9) & 1) << CPUFeatureIndex::kAPIC;
   f.features |= ((cpuid.edx >> 24) & 1) << CPUFeatureIndex::kFXSR;
+  f.features |= ((cpuid.edx >> 13) & 1) << CPUFeatureIndex::kPGE;
+  f.features |= ((cpuid.ecx >> 17) & 1) << CPUFeatureIndex::kPCID;
+  f.features |= ((cpuid.ecx >> 24) & 1) << CPUFeatureIndex::kTSCDeadline;
+  f.features |= ((cpuid.edx >> 26) & 1) << CPUFeatureIndex::kSSE2;
+  const bool has_avx = cpuid.ecx & (1 << 28);
   if (!(cpuid.edx & kCPUID01H_EDXBitAPIC))
     Panic("APIC not supported");
   if (!(cpuid.edx & kCPUID01H_EDXBitMSR))
@@ -89,6 +94,9 @@ void IdentifyCPU() {
   if (7 <= f.max_cpuid) {
     ReadCPUID(&cpuid, 7, 0);
     f.clflushopt = cpuid.ebx & (1 << 23);
+    f.features |= ((cpuid.ebx >> 10) & 1) << CPUFeatureIndex::kINVPCID;
+    if (has_avx)
+      f.features |= ((cpuid.ebx >> 5) & 1) << CPUFeatureIndex::kAVX2;
   }
 
   if (0x8000'0004 <= f.max_extended_cpuid) {
@@ -105,6 +113,11 @@ void IdentifyCPU() {
     }
   }
 
+  if (CPUIDIndex::kAdvancedPowerManagement <= f.max_extended_cpuid) {
+    ReadCPUID(&cpuid, CPUIDIndex::kAdvancedPowerManagement, 0);
+    f.features |= ((cpuid.edx >> 8) & 1) << CPUFeatureIndex::kInvariantTSC;
+  }
+
   if (CPUIDIndex::kMaxAddr <= f.max_extended_cpuid) {
     ReadCPUID(&cpuid, CPUIDIndex::kMaxAddr, 0);
     IA32_MaxPhyAddr maxaddr;
@@ -147,6 +160,8 @@ void MainForBootProcessor(EFI::Handle image_handle,
 
   loader_info.root_files_used =
       efi_.LoadRootFiles(loader_info.root_files, kNumOfRootFiles);
+  loader_info.ap_boot_pages = reinterpret_cast<uint64_t>(
+      efi_.AllocatePagesBelow(kNumOfAPBootPages, kAPBootPagesLimit));
 
   efi_.GetMemoryMapAndExitBootServices(image_handle, efi_memory_map);
   liumos->efi_memory_map = &efi_memory_map;
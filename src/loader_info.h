@@ -4,11 +4,15 @@
 #include "phys_page_allocator.h"
 
 constexpr int kNumOfRootFiles = 32;
+// APs start in real mode, so their boot code should be below 1MiB.
+constexpr uint64_t kNumOfAPBootPages = 2;
+constexpr uint64_t kAPBootPagesLimit = 0xA0000;
 packed_struct LoaderInfo {
   PhysicalPageAllocator<UsePhysicalAddressInternallyStrategy>* dram_allocator;
   EFIFile root_files[kNumOfRootFiles];
   int root_files_used;
   EFI* efi;
+  uint64_t ap_boot_pages;
 
   int FindFile(const char* name) {
     for (int i = 0; i < root_files_used; i++) {
@@ -0,0 +1,30 @@
+#include "lock_stats.h"
+
+#include "liumos.h"
+
+void LockStats::PrintAll() {
+  PutString(
+      "lock, acquisitions, contentions, wait [tsc], max wait [tsc], hold "
+      "[tsc], max hold [tsc]\n");
+  for (LockStats* s = GetFirst(); s; s = s->GetNext()) {
+    PutString(s->name_);
+    PutString(", ");
+    PutDecimal64(s->num_of_acquisitions_);
+    PutString(", ");
+    PutDecimal64(s->num_of_contentions_);
+    PutString(", ");
+    PutDecimal64(s->wait_tsc_);
+    PutString(", ");
+    PutDecimal64(s->max_wait_tsc_);
+    PutString(", ");
+    PutDecimal64(s->hold_tsc_);
+    PutString(", ");
+    PutDecimal64(s->max_hold_tsc_);
+    PutString("\n");
+  }
+}
+
+void LockStats::ResetAll() {
+  for (LockStats* s = GetFirst(); s; s = s->GetNext())
+    s->Reset();
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "generic.h"
+
+class LockStats {
+  // Contention statistics of a lock site, which may be shared by several
+  // locks. Locks record into it only while recording is enabled, since
+  // reading TSC on every acquisition is not free. Times are in TSC counts.
+ public:
+  constexpr LockStats(const char* name)
+      : name_(name),
+        num_of_acquisitions_(0),
+        num_of_contentions_(0),
+        wait_tsc_(0),
+        max_wait_tsc_(0),
+        hold_tsc_(0),
+        max_hold_tsc_(0),
+        next_(nullptr),
+        is_registered_(false) {}
+  static bool IsEnabled() {
+    return __atomic_load_n(&is_enabled_, __ATOMIC_RELAXED);
+  }
+  static void SetEnabled(bool is_enabled) {
+    __atomic_store_n(&is_enabled_, is_enabled, __ATOMIC_RELAXED);
+  }
+  static uint64_t ReadTimestamp() { return __builtin_ia32_rdtsc(); }
+  void RecordAcquisition(bool is_contended, uint64_t wait_tsc) {
+    Register();
+    __atomic_fetch_add(&num_of_acquisitions_, 1, __ATOMIC_RELAXED);
+    if (!is_contended)
+      return;
+    __atomic_fetch_add(&num_of_contentions_, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&wait_tsc_, wait_tsc, __ATOMIC_RELAXED);
+    UpdateMax(max_wait_tsc_, wait_tsc);
+  }
+  void RecordRelease(uint64_t hold_tsc) {
+    __atomic_fetch_add(&hold_tsc_, hold_tsc, __ATOMIC_RELAXED);
+    UpdateMax(max_hold_tsc_, hold_tsc);
+  }
+  const char* GetName() const { return name_; }
+  uint64_t GetNumOfAcquisitions() const { return num_of_acquisitions_; }
+  uint64_t GetNumOfContentions() const { return num_of_contentions_; }
+  uint64_t GetWaitTSC() const { return wait_tsc_; }
+  uint64_t GetHoldTSC() const { return hold_tsc_; }
+  // Sites are listed once they are recorded.
+  static LockStats* GetFirst() {
+    return __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+  }
+  LockStats* GetNext() const { return next_; }
+  void Reset() {
+    num_of_acquisitions_ = 0;
+    num_of_contentions_ = 0;
+    wait_tsc_ = 0;
+    max_wait_tsc_ = 0;
+    hold_tsc_ = 0;
+    max_hold_tsc_ = 0;
+  }
+  // @lock_stats.cc
+  static void PrintAll();
+  static void ResetAll();
+
+ private:
+  static void UpdateMax(uint64_t& max, uint64_t value) {
+    uint64_t current = __atomic_load_n(&max, __ATOMIC_RELAXED);
+    while (current < value &&
+           !__atomic_compare_exchange_n(&max, &current, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+  }
+  void Register() {
+    if (__atomic_load_n(&is_registered_, __ATOMIC_ACQUIRE) ||
+        __atomic_exchange_n(&is_registered_, true, __ATOMIC_ACQ_REL))
+      return;
+    LockStats* head = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+    do {
+      next_ = head;
+    } while (!__atomic_compare_exchange_n(&head_, &head, this, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+
+  inline static bool is_enabled_ = false;
+  inline static LockStats* head_ = nullptr;
+  const char* name_;
+  uint64_t num_of_acquisitions_;
+  uint64_t num_of_contentions_;
+  uint64_t wait_tsc_;
+  uint64_t max_wait_tsc_;
+  uint64_t hold_tsc_;
+  uint64_t max_hold_tsc_;
+  LockStats* next_;
+  bool is_registered_;
+};
+
+class LockStatsRecorder {
+  // Embedded in locks to record into the LockStats given by SetStats().
+ public:
+  constexpr LockStatsRecorder() : stats_(nullptr), locked_at_(0) {}
+  void SetStats(LockStats& stats) { stats_ = &stats; }
+  bool IsRecording() const { return stats_ && LockStats::IsEnabled(); }
+  // Called after acquiring the lock. wait_start is the timestamp when the
+  // lock was found held, or 0 if it was not.
+  void OnAcquired(uint64_t wait_start) {
+    if (!IsRecording())
+      return;
+    locked_at_ = LockStats::ReadTimestamp();
+    stats_->RecordAcquisition(wait_start != 0,
+                              wait_start ? locked_at_ - wait_start : 0);
+  }
+  // Called before releasing the lock.
+  void OnReleasing() {
+    if (!locked_at_)
+      return;
+    if (stats_)
+      stats_->RecordRelease(LockStats::ReadTimestamp() - locked_at_);
+    locked_at_ = 0;
+  }
+
+ private:
+  LockStats* stats_;
+  uint64_t locked_at_;
+};
@@ -0,0 +1,53 @@
+#include "mutex.h"
+
+#include "liumos.h"
+#include "panic_printer.h"
+
+static uint64_t GetCurrentPID() {
+  assert(liumos->scheduler);
+  return liumos->scheduler->GetCurrentProcess().GetID();
+}
+
+void Mutex::Lock() {
+  const uint64_t pid = GetCurrentPID();
+  if (TryAcquire(pid)) {
+    stats_.OnAcquired(0);
+    return;
+  }
+  const uint64_t owner_pid = __atomic_load_n(&owner_pid_, __ATOMIC_RELAXED);
+  if (owner_pid == pid) {
+    auto& pp = PanicPrinter::BeginPanic();
+    StringBuffer<128> buf;
+
+    buf.WriteString("pid 0x");
+    buf.WriteHex64(pid);
+    buf.WriteString(" tried to acquire a mutex");
+    pp.PrintLine(buf.GetString());
+    buf.Clear();
+
+    buf.WriteString("which is locked by pid 0x");
+    buf.WriteHex64(owner_pid);
+    pp.PrintLine(buf.GetString());
+    buf.Clear();
+
+    pp.EndPanicAndDie("Mutex::Lock() called by the owner (deadlock)");
+  }
+  const uint64_t wait_start =
+      stats_.IsRecording() ? LockStats::ReadTimestamp() : 0;
+  wait_queue_.WaitUntil([this, pid] { return TryAcquire(pid); });
+  stats_.OnAcquired(wait_start);
+}
+
+bool Mutex::TryLock() {
+  if (!TryAcquire(GetCurrentPID()))
+    return false;
+  stats_.OnAcquired(0);
+  return true;
+}
+
+void Mutex::Unlock() {
+  assert(owner_pid_ == GetCurrentPID());
+  stats_.OnReleasing();
+  __atomic_store_n(&owner_pid_, 0, __ATOMIC_RELEASE);
+  wait_queue_.WakeUpAll();
+}
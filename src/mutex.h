@@ -0,0 +1,32 @@
+#pragma once
+
+#include "generic.h"
+#include "lock_stats.h"
+#include "wait_queue.h"
+
+class Mutex {
+  // Sleeping lock for processes. Waiters block on a WaitQueue instead of
+  // spinning, so the holder may sleep while holding it. Not for interrupt
+  // handlers, and not before the scheduler starts.
+ public:
+  constexpr Mutex() : owner_pid_(0) {}
+  void SetStats(LockStats& stats) { stats_.SetStats(stats); }
+  void Lock();
+  bool TryLock();
+  void Unlock();
+  bool IsLocked() const {
+    return __atomic_load_n(&owner_pid_, __ATOMIC_RELAXED) != 0;
+  }
+
+ private:
+  bool TryAcquire(uint64_t pid) {
+    uint64_t expected = 0;
+    return __atomic_compare_exchange_n(&owner_pid_, &expected, pid, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+  }
+
+  // ID of the process holding this, or 0 if not locked
+  uint64_t owner_pid_;
+  WaitQueue wait_queue_;
+  LockStatsRecorder stats_;
+};
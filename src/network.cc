@@ -31,21 +31,148 @@ Network* Network::network_;
 
 Network& Network::GetInstance() {
   if (!network_) {
-    network_ = liumos->kernel_heap_allocator->Alloc<Network>();
-    bzero(network_, sizeof(Network));
+    network_ = AllocKernelObject<Network>();
     new (network_) Network();
   }
   assert(network_);
   return *network_;
 }
 
+Network::Socket::~Socket() {
+  Network::GetInstance().UnregisterSocket(*this);
+  while (!rx_queue.IsEmpty())
+    rx_queue.Pop()->Unref();
+}
+
+void Network::Socket::PushPacket(PacketBuffer& buf) {
+  if (rx_queue.IsFull()) {
+    num_of_rx_drops++;
+    return;
+  }
+  buf.Ref();
+  rx_queue.Push(&buf);
+  num_of_rx_packets++;
+  rx_wait_queue.WakeUpAll();
+}
+
+// Sockets are registered and unregistered with interrupts disabled, since
+// DeliverToSockets is called from NetworkManager, which may preempt them.
+
+bool Network::RegisterSocket(Socket& sock) {
+  if (sock.type != Socket::Type::kUDP) {
+    const bool was_enabled = DisableInterrupts();
+    icmp_sockets_.push_back(&sock);
+    RestoreInterrupts(was_enabled);
+    return false;
+  }
+  constexpr int kNumOfEphemeralPorts = 0x10000 - kEphemeralPortBase;
+  for (int i = 0; i < kNumOfEphemeralPorts; i++) {
+    const uint16_t port = next_ephemeral_port_;
+    next_ephemeral_port_ =
+        port == 0xFFFF ? kEphemeralPortBase : static_cast<uint16_t>(port + 1);
+    if (!BindToPort(sock, port))
+      return false;
+  }
+  return true;
+}
+
+bool Network::BindToPort(Socket& sock, uint16_t port) {
+  if (sock.type != Socket::Type::kUDP)
+    return true;
+  const uint32_t key = GetSocketKey(IPv4Packet::Protocol::kUDP, port);
+  const bool was_enabled = DisableInterrupts();
+  const bool in_use = sockets_.find(key) != sockets_.end();
+  if (!in_use) {
+    if (sock.listen_port)
+      sockets_.erase(
+          GetSocketKey(IPv4Packet::Protocol::kUDP, sock.listen_port));
+    sockets_[key] = &sock;
+    sock.listen_port = port;
+  }
+  RestoreInterrupts(was_enabled);
+  return in_use;
+}
+
+void Network::UnregisterSocket(Socket& sock) {
+  const bool was_enabled = DisableInterrupts();
+  if (sock.type != Socket::Type::kUDP) {
+    for (auto it = icmp_sockets_.begin(); it != icmp_sockets_.end(); it++) {
+      if (*it == &sock) {
+        icmp_sockets_.erase(it);
+        break;
+      }
+    }
+  } else {
+    auto it = sockets_.find(
+        GetSocketKey(IPv4Packet::Protocol::kUDP, sock.listen_port));
+    if (it != sockets_.end() && it->second == &sock)
+      sockets_.erase(it);
+  }
+  RestoreInterrupts(was_enabled);
+}
+
+void Network::DeliverToSockets(PacketBuffer& buf) {
+  uint8_t* frame = buf.GetFrame();
+  const size_t frame_size = buf.GetFrameSize();
+  if (frame_size < sizeof(IPv4Packet))
+    return;
+  EtherFrame& eth = *reinterpret_cast<EtherFrame*>(frame);
+  if (!eth.HasEthType(EtherFrame::kTypeIPv4))
+    return;
+  IPv4Packet& p = *reinterpret_cast<IPv4Packet*>(frame);
+  if (p.protocol == IPv4Packet::Protocol::kICMP) {
+    for (auto sock : icmp_sockets_)
+      sock->PushPacket(buf);
+    return;
+  }
+  if (p.protocol != IPv4Packet::Protocol::kUDP ||
+      frame_size < sizeof(IPv4UDPPacket))
+    return;
+  IPv4UDPPacket& udp = *reinterpret_cast<IPv4UDPPacket*>(frame);
+  auto it = sockets_.find(
+      GetSocketKey(IPv4Packet::Protocol::kUDP, udp.GetDestinationPort()));
+  if (it != sockets_.end())
+    it->second->PushPacket(buf);
+}
+
+void Network::PrintSockets() {
+  PutString("type, port, rx packets, rx drops\n");
+  auto print = [](const Socket& sock) {
+    const char* type = "UDP";
+    if (sock.type == Socket::Type::kICMPRaw)
+      type = "ICMP raw";
+    if (sock.type == Socket::Type::kICMPDatagram)
+      type = "ICMP dgram";
+    kprintf("%s, %d, %llu, %llu\n", type, sock.listen_port,
+            sock.num_of_rx_packets, sock.num_of_rx_drops);
+  };
+  for (auto it : sockets_)
+    print(*it.second);
+  for (auto sock : icmp_sockets_)
+    print(*sock);
+}
+
 void NetworkManager() {
+  // Like NAPI, an RX interrupt wakes this task, which polls the queue with
+  // the interrupt suppressed while frames keep coming, and enables it again
+  // once a poll drains the queues within the budget.
+  constexpr int kRXBudget = 64;
   auto& virtio_net = Virtio::Net::GetInstance();
   while (true) {
     ClearIntFlag();
-    virtio_net.PollRXQueue();
+    const bool is_busy = virtio_net.PollRXQueues(kRXBudget);
     StoreIntFlag();
-    Sleep();
+    if (!virtio_net.UsesRXInterrupt()) {
+      // RX is polled on every timer tick without MSI-X.
+      liumos->scheduler->WaitForNextTick();
+      continue;
+    }
+    if (is_busy) {
+      // Still busy. Other processes run before the next poll.
+      Sleep();
+      continue;
+    }
+    virtio_net.WaitForRXPackets();
   }
 }
 
@@ -4,8 +4,11 @@
 #include <unordered_map>
 #include <vector>
 
+#include "file.h"
 #include "generic.h"
+#include "packet_buffer.h"
 #include "ring_buffer.h"
+#include "wait_queue.h"
 
 class Network {
  public:
@@ -58,19 +61,126 @@ class Network {
              *reinterpret_cast<const uint16_t*>(to.csum);
     }
     static InternetChecksum Calc(void* buf, size_t start, size_t end) {
-      // https://tools.ietf.org/html/rfc1071
-      uint8_t* p = reinterpret_cast<uint8_t*>(buf);
-      uint32_t sum = 0;
-      for (size_t i = start; i < end; i += 2) {
-        sum += (static_cast<uint16_t>(p[i + 0])) << 8 | p[i + 1];
+      return FromSum(Sum(reinterpret_cast<uint8_t*>(buf) + start, end - start));
+    }
+
+    // Sums are one's complement sums of 16-bit words in the native byte
+    // order, which give the same checksum as in the network byte order
+    // (RFC 1071 2.(B)). A packet can be summed in parts at even offsets,
+    // passing the sum of the former parts as sum.
+    // Adds 64 bits at a time with end-around carry.
+    static uint64_t Sum(const void* buf, size_t size, uint64_t sum = 0) {
+      const uint8_t* p = reinterpret_cast<const uint8_t*>(buf);
+      for (; size >= 32; p += 32, size -= 32) {
+        sum = AddWithCarry(sum, Load<uint64_t>(p));
+        sum = AddWithCarry(sum, Load<uint64_t>(p + 8));
+        sum = AddWithCarry(sum, Load<uint64_t>(p + 16));
+        sum = AddWithCarry(sum, Load<uint64_t>(p + 24));
+      }
+      for (; size >= 8; p += 8, size -= 8)
+        sum = AddWithCarry(sum, Load<uint64_t>(p));
+      if (size >= 4) {
+        sum = AddWithCarry(sum, Load<uint32_t>(p));
+        p += 4;
+        size -= 4;
       }
+      if (size >= 2) {
+        sum = AddWithCarry(sum, Load<uint16_t>(p));
+        p += 2;
+        size -= 2;
+      }
+      // The last odd byte is padded with zero.
+      if (size)
+        sum = AddWithCarry(sum, *p);
+      return sum;
+    }
+    // Same as Sum, with the SSE2 or AVX2 version chosen by InitSIMD. These
+    // use vector registers, which are switched lazily with processes and not
+    // saved on interrupts or syscalls. So this should be called only from
+    // kernel tasks, which own their FPU state.
+    static uint64_t SumWithSIMD(const void* buf,
+                                size_t size,
+                                uint64_t sum = 0) {
+      return sum_with_simd_(buf, size, sum);
+    }
+    static void InitSIMD(bool has_sse2, bool has_avx2) {
+      if (has_avx2)
+        sum_with_simd_ = SumWithAVX2;
+      else if (has_sse2)
+        sum_with_simd_ = SumWithSSE2;
+    }
+    // 32-bit halves of 64-bit lanes are added separately, so the lanes do
+    // not overflow for any packet. Vector extensions are used since
+    // immintrin.h in this tree does not provide the intrinsics.
+    __attribute__((target("sse2"))) static uint64_t SumWithSSE2(
+        const void* buf,
+        size_t size,
+        uint64_t sum = 0) {
+      return SumWithVector<VectorUint64x2>(buf, size, sum);
+    }
+    __attribute__((target("avx2"))) static uint64_t SumWithAVX2(
+        const void* buf,
+        size_t size,
+        uint64_t sum = 0) {
+      return SumWithVector<VectorUint64x4>(buf, size, sum);
+    }
+    static InternetChecksum FromSum(uint64_t sum) {
+      return FromFoldedSum(static_cast<uint16_t>(~Fold(sum)));
+    }
+    // Sum of the packet with this checksum, for incremental updates.
+    uint64_t ToSum() const {
+      return static_cast<uint16_t>(~Load<uint16_t>(csum));
+    }
+    // RFC 1624 3.: Returns the checksum after a 16-bit word at an even
+    // offset is changed from old_word to new_word, both in the native byte
+    // order.
+    InternetChecksum Update(uint16_t old_word, uint16_t new_word) const {
+      return FromSum(ToSum() + static_cast<uint16_t>(~old_word) + new_word);
+    }
+    template <typename T>
+    static T Load(const void* p) {
+      T v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    static uint64_t AddWithCarry(uint64_t a, uint64_t b) {
+      a += b;
+      return a + (a < b);
+    }
+    static uint16_t Fold(uint64_t sum) {
       while (sum >> 16) {
         sum = (sum & 0xffff) + (sum >> 16);
       }
-      sum = ~sum;
-      return {static_cast<uint8_t>((sum >> 8) & 0xFF),
-              static_cast<uint8_t>(sum & 0xFF)};
+      return static_cast<uint16_t>(sum);
+    }
+    static InternetChecksum FromFoldedSum(uint16_t sum) {
+      InternetChecksum c;
+      memcpy(c.csum, &sum, sizeof(sum));
+      return c;
+    }
+
+   private:
+    typedef uint64_t VectorUint64x2 __attribute__((vector_size(16)));
+    typedef uint64_t VectorUint64x4 __attribute__((vector_size(32)));
+    template <typename V>
+    __attribute__((always_inline)) static uint64_t SumWithVector(
+        const void* buf,
+        size_t size,
+        uint64_t sum) {
+      const uint8_t* p = reinterpret_cast<const uint8_t*>(buf);
+      V acc = {};
+      for (; size >= sizeof(V); p += sizeof(V), size -= sizeof(V)) {
+        V v;
+        memcpy(&v, p, sizeof(v));
+        acc += v & 0xFFFF'FFFFULL;
+        acc += v >> 32;
+      }
+      for (size_t i = 0; i < sizeof(V) / sizeof(uint64_t); i++)
+        sum = AddWithCarry(sum, acc[i]);
+      return Sum(p, size, sum);
     }
+    inline static uint64_t (*sum_with_simd_)(const void*, size_t, uint64_t) =
+        Sum;
   };
 
   //
@@ -286,31 +396,51 @@ class Network {
       length[1] = size & 0xFF;
     }
   };
+  // Hash of a flow seen from this host, which selects the queue pair of the
+  // NIC used for the flow.
+  static uint32_t GetFlowHash(IPv4Addr remote_addr,
+                              IPv4Packet::Protocol protocol,
+                              uint16_t local_port,
+                              uint16_t remote_port) {
+    const uint64_t key =
+        (static_cast<uint64_t>(
+             *reinterpret_cast<const uint32_t*>(remote_addr.addr))
+         << 32) ^
+        (static_cast<uint64_t>(protocol) << 56) ^
+        (static_cast<uint32_t>(local_port) << 16) ^ remote_port;
+    // Fibonacci hashing
+    return static_cast<uint32_t>((key * 0x9E37'79B9'7F4A'7C15ULL) >> 32);
+  }
+  static uint64_t SumUDPPseudoHeader(Network::IPv4Addr src_addr,
+                                     Network::IPv4Addr dst_addr,
+                                     uint8_t (&udp_length)[2]) {
+    const uint8_t protocol[2] = {0, 17};  // UDP
+    uint64_t sum = InternetChecksum::Sum(src_addr.addr, sizeof(src_addr));
+    sum = InternetChecksum::Sum(dst_addr.addr, sizeof(dst_addr), sum);
+    sum = InternetChecksum::Sum(udp_length, sizeof(udp_length), sum);
+    return InternetChecksum::Sum(protocol, sizeof(protocol), sum);
+  }
+  // Folded sum of the pseudo-header without complement. This is put in the
+  // checksum field when the NIC computes the rest of the checksum.
+  static InternetChecksum CalcUDPPseudoHeaderChecksum(
+      Network::IPv4Addr src_addr,
+      Network::IPv4Addr dst_addr,
+      uint8_t (&udp_length)[2]) {
+    return InternetChecksum::FromFoldedSum(InternetChecksum::Fold(
+        SumUDPPseudoHeader(src_addr, dst_addr, udp_length)));
+  }
   static InternetChecksum CalcUDPChecksum(void* buf,
                                           size_t start,
                                           size_t end,
                                           Network::IPv4Addr src_addr,
                                           Network::IPv4Addr dst_addr,
                                           uint8_t (&udp_length)[2]) {
-    // https://tools.ietf.org/html/rfc1071
-    uint8_t* p = reinterpret_cast<uint8_t*>(buf);
-    uint32_t sum = 0;
-    // Pseudo-header
-    sum += (static_cast<uint16_t>(src_addr.addr[0]) << 8) | src_addr.addr[1];
-    sum += (static_cast<uint16_t>(src_addr.addr[2]) << 8) | src_addr.addr[3];
-    sum += (static_cast<uint16_t>(dst_addr.addr[0]) << 8) | dst_addr.addr[1];
-    sum += (static_cast<uint16_t>(dst_addr.addr[2]) << 8) | dst_addr.addr[3];
-    sum += (static_cast<uint16_t>(udp_length[0]) << 8) | udp_length[1];
-    sum += 17;  // Protocol: UDP
-    for (size_t i = start; i < end; i += 2) {
-      sum += (static_cast<uint16_t>(p[i + 0])) << 8 | p[i + 1];
-    }
-    while (sum >> 16) {
-      sum = (sum & 0xffff) + (sum >> 16);
-    }
-    sum = ~sum;
-    return {static_cast<uint8_t>((sum >> 8) & 0xFF),
-            static_cast<uint8_t>(sum & 0xFF)};
+    // https://tools.ietf.org/html/rfc768
+    return InternetChecksum::FromSum(
+        InternetChecksum::Sum(reinterpret_cast<uint8_t*>(buf) + start,
+                              end - start,
+                              SumUDPPseudoHeader(src_addr, dst_addr,
+                                                 udp_length)));
   }
 
   //
@@ -407,80 +537,66 @@ class Network {
     return arp_table_[ip_addr];
   }
 
-  //
-  // RX buffer
-  //
-  static constexpr int kPacketContainerSize = 2048;
-  static constexpr int kRXBufferSize = 32;
-  packed_struct PacketContainer {
-    size_t size;
-    uint8_t data[kPacketContainerSize];
-  };
-  void PushToRXBuffer(const void* data, size_t begin, size_t end) {
-    assert(begin < end);
-    PacketContainer buf;
-    buf.size = end - begin;
-    assert(buf.size <= kPacketContainerSize);
-    memcpy(buf.data, reinterpret_cast<const uint8_t*>(data) + begin, buf.size);
-    rx_buffer_.Push(buf);
-  }
-  PacketContainer PopFromRXBuffer() { return rx_buffer_.Pop(); }
-  bool HasPacketInRXBuffer() { return !rx_buffer_.IsEmpty(); }
-
   static Network& GetInstance();
 
   //
   // sockets
   //
-  struct Socket {
-    uint64_t pid;
-    int fd;
-    uint16_t listen_port;
+  struct Socket : public File {
     enum class Type {
       kICMPRaw,
       kICMPDatagram,
       kUDP,
-    } type;
+    };
+    // One slot of the ring is kept empty.
+    static constexpr int kRXQueueSize = 17;
+    Socket(Type type)
+        : File(File::Type::kSocket),
+          listen_port(0),
+          type(type),
+          num_of_rx_packets(0),
+          num_of_rx_drops(0) {}
+    ~Socket() override;
+    // Takes a reference of a received frame and wakes up the receivers.
+    // The frame is dropped if the queue is full.
+    void PushPacket(PacketBuffer& buf);
+    uint16_t listen_port;
+    const Type type;
+    // Frames delivered to this socket, filled by the demultiplexer. The
+    // receiver should drop the reference of popped buffers.
+    RingBuffer<PacketBuffer*, kRXQueueSize> rx_queue;
+    WaitQueue rx_wait_queue;
+    uint64_t num_of_rx_packets;
+    uint64_t num_of_rx_drops;
   };
-
-  bool RegisterSocket(uint64_t pid, int fd, Socket::Type type) {
-    // returns true on failure
-    if (FindSocket(pid, fd).has_value()) {
-      return true;
-    }
-    sockets_.push_back({pid, fd, 12345 /* TODO: use random port */, type});
-    return false;
-  }
-  bool BindToPort(uint64_t pid, int fd, uint16_t port) {
-    // returns true on failure
-    for (auto& it : sockets_) {
-      if (it.pid == pid && it.fd == fd) {
-        it.listen_port = port;
-        return false;
-      }
-    }
-    return true;
-  }
-  std::optional<Socket> FindSocket(uint64_t pid, int fd) {
-    for (auto& it : sockets_) {
-      if (it.pid == pid && it.fd == fd) {
-        return it;
-      }
-    }
-    return std::nullopt;
-  }
+  // Makes sock receive packets. UDP sockets get an ephemeral port.
+  // returns true on failure
+  bool RegisterSocket(Socket& sock);
+  // returns true on failure
+  bool BindToPort(Socket& sock, uint16_t port);
+  void UnregisterSocket(Socket& sock);
+  // Delivers a received frame to the sockets which it is destined to.
+  void DeliverToSockets(PacketBuffer& buf);
+  void PrintSockets();
 
  private:
   static Network* network_;
 
+  static constexpr uint16_t kEphemeralPortBase = 49152;
+  static uint32_t GetSocketKey(IPv4Packet::Protocol protocol, uint16_t port) {
+    return static_cast<uint32_t>(protocol) << 16 | port;
+  }
+
   ARPTable arp_table_;
-  // +1ACD0
-  RingBuffer<PacketContainer, kRXBufferSize> rx_buffer_;  // (2048 + 8) * 32
-  std::vector<Socket> sockets_;
+  // Sockets by (protocol, local port)
+  std::unordered_map<uint32_t, Socket*> sockets_;
+  // Raw and datagram ICMP sockets, which receive every ICMP packet
+  std::vector<Socket*> icmp_sockets_;
+  uint16_t next_ephemeral_port_;
   IPv4Addr gateway_;
   IPv4NetMask netmask_;
 
-  Network(){};
+  Network() : next_ephemeral_port_(kEphemeralPortBase){};
 };
 
 void NetworkManager();
@@ -5,6 +5,112 @@
 #include <stdio.h>
 
 #include <cassert>
+#include <chrono>
+#include <random>
+#include <vector>
+
+using InternetChecksum = Network::InternetChecksum;
+
+// The former implementation, which sums 16-bit words in the network byte
+// order. The last odd byte is padded with zero.
+static InternetChecksum CalcReference(const uint8_t* p, size_t size) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < size; i += 2) {
+    sum += static_cast<uint16_t>(p[i] << 8) | (i + 1 < size ? p[i + 1] : 0);
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  sum = ~sum;
+  return {static_cast<uint8_t>((sum >> 8) & 0xFF),
+          static_cast<uint8_t>(sum & 0xFF)};
+}
+
+static bool HasAVX2() {
+  return __builtin_cpu_supports("avx2");
+}
+
+static void TestChecksum() {
+  std::mt19937 rand(1);
+  std::vector<uint8_t> buf(1024);
+  for (auto& b : buf)
+    b = static_cast<uint8_t>(rand());
+  for (size_t ofs = 0; ofs < 8; ofs++) {
+    for (size_t size = 0; size <= 300; size++) {
+      const uint8_t* p = buf.data() + ofs;
+      const InternetChecksum expected = CalcReference(p, size);
+      assert(InternetChecksum::FromSum(InternetChecksum::Sum(p, size))
+                 .IsEqualTo(expected));
+      assert(InternetChecksum::FromSum(InternetChecksum::SumWithSSE2(p, size))
+                 .IsEqualTo(expected));
+      if (HasAVX2()) {
+        assert(
+            InternetChecksum::FromSum(InternetChecksum::SumWithAVX2(p, size))
+                .IsEqualTo(expected));
+      }
+      // Parts at even offsets can be summed separately.
+      const size_t half = size / 2 & ~1;
+      const uint64_t sum = InternetChecksum::SumWithSSE2(
+          p + half, size - half, InternetChecksum::Sum(p, half));
+      assert(InternetChecksum::FromSum(sum).IsEqualTo(expected));
+    }
+  }
+  // All ones do not overflow the accumulators.
+  std::vector<uint8_t> ones(65536, 0xFF);
+  assert(InternetChecksum::FromSum(
+             InternetChecksum::SumWithSSE2(ones.data(), ones.size()))
+             .IsEqualTo(CalcReference(ones.data(), ones.size())));
+
+  // Updating a word gives the same checksum as summing again.
+  for (int i = 0; i < 1000; i++) {
+    const size_t ofs = rand() % 150 * 2;
+    const InternetChecksum before = CalcReference(buf.data(), 300);
+    const uint16_t old_word = InternetChecksum::Load<uint16_t>(&buf[ofs]);
+    const uint16_t new_word = static_cast<uint16_t>(rand());
+    memcpy(&buf[ofs], &new_word, sizeof(new_word));
+    assert(before.Update(old_word, new_word)
+               .IsEqualTo(CalcReference(buf.data(), 300)));
+  }
+}
+
+static void BenchmarkChecksum() {
+  constexpr size_t kSizes[] = {64, 576, 1500, 9000};
+  constexpr size_t kBytesPerSize = 64 * 1024 * 1024;
+  std::vector<uint8_t> buf(9000);
+  for (size_t i = 0; i < buf.size(); i++)
+    buf[i] = static_cast<uint8_t>(i * 7);
+  for (size_t size : kSizes) {
+    const int num_of_iterations = static_cast<int>(kBytesPerSize / size);
+    auto measure = [&](auto calc) {
+      // Accumulated to keep the calls.
+      static volatile uint32_t sink;
+      uint32_t acc = 0;
+      auto t0 = std::chrono::steady_clock::now();
+      for (int i = 0; i < num_of_iterations; i++) {
+        buf[0] = static_cast<uint8_t>(i);
+        acc += calc(buf.data(), size).csum[0];
+      }
+      auto t1 = std::chrono::steady_clock::now();
+      sink = acc;
+      return std::chrono::duration<double, std::nano>(t1 - t0).count() /
+             num_of_iterations;
+    };
+    printf("checksum %5zu bytes: reference %7.1f ns", size,
+           measure(CalcReference));
+    printf(", 64-bit %7.1f ns", measure([](const uint8_t* p, size_t n) {
+             return InternetChecksum::FromSum(InternetChecksum::Sum(p, n));
+           }));
+    printf(", SSE2 %7.1f ns", measure([](const uint8_t* p, size_t n) {
+             return InternetChecksum::FromSum(
+                 InternetChecksum::SumWithSSE2(p, n));
+           }));
+    if (HasAVX2()) {
+      printf(", AVX2 %7.1f ns", measure([](const uint8_t* p, size_t n) {
+               return InternetChecksum::FromSum(
+                   InternetChecksum::SumWithAVX2(p, n));
+             }));
+    }
+    putchar('\n');
+  }
+}
 
 int main() {
   auto ip_addr_actual = Network::IPv4Addr::CreateFromString("12.34.56.78");
@@ -18,6 +124,44 @@ int main() {
   assert(!Network::IPv4Addr::CreateFromString("").has_value());
   assert(!Network::IPv4Addr::CreateFromString("123.56.78").has_value());
 
+  // Flows are spread over queue pairs.
+  int num_of_flows_per_pair[4] = {};
+  for (uint16_t port = 49152; port < 49152 + 64; port++) {
+    const uint32_t hash = Network::GetFlowHash(
+        ip_addr_expected, Network::IPv4Packet::Protocol::kUDP, port, 53);
+    assert(hash == Network::GetFlowHash(ip_addr_expected,
+                                        Network::IPv4Packet::Protocol::kUDP,
+                                        port, 53));
+    num_of_flows_per_pair[hash % 4]++;
+  }
+  for (int i = 0; i < 4; i++)
+    assert(num_of_flows_per_pair[i] > 0);
+
+  // A NIC offloading the UDP checksum sums the segment with the checksum of
+  // the pseudo-header in the field, which gives the same checksum.
+  {
+    using IPv4UDPPacket = Network::IPv4UDPPacket;
+    uint8_t buf[sizeof(IPv4UDPPacket) + 10] = {};
+    IPv4UDPPacket& udp = *reinterpret_cast<IPv4UDPPacket*>(buf);
+    for (size_t i = sizeof(IPv4UDPPacket); i < sizeof(buf); i++)
+      buf[i] = static_cast<uint8_t>(i * 7);
+    udp.SetSourcePort(49152);
+    udp.SetDestinationPort(53);
+    udp.SetDataSize(sizeof(buf) - sizeof(IPv4UDPPacket));
+    const Network::IPv4Addr src = {10, 0, 2, 15};
+    const Network::IPv4Addr dst = {10, 0, 2, 2};
+    const Network::InternetChecksum expected = Network::CalcUDPChecksum(
+        buf, offsetof(IPv4UDPPacket, src_port), sizeof(buf), src, dst,
+        udp.length);
+    udp.csum = Network::CalcUDPPseudoHeaderChecksum(src, dst, udp.length);
+    assert(Network::InternetChecksum::Calc(
+               buf, offsetof(IPv4UDPPacket, src_port), sizeof(buf))
+               .IsEqualTo(expected));
+  }
+
+  TestChecksum();
+  BenchmarkChecksum();
+
   puts("PASS");
   return 0;
 }
@@ -1,5 +1,6 @@
 #include <errno.h>
 #include <stddef.h>
+#include <string.h>
 #include <sys/types.h>
 
 #include "generic.h"
@@ -9,11 +10,62 @@
 
 extern "C" {
 
+// Memory allocation functions in newlib are replaced with the kernel slab
+// allocator. Reentrant versions are also defined to prevent the ones in
+// newlib from being linked.
+
+void* malloc(size_t size) {
+  return kmalloc(size);
+}
+
+void free(void* p) {
+  kfree(p);
+}
+
+void* calloc(size_t num_of_elements, size_t element_size) {
+  const size_t byte_size = num_of_elements * element_size;
+  if (element_size && byte_size / element_size != num_of_elements)
+    return nullptr;
+  return kzalloc(byte_size);
+}
+
+void* realloc(void* p, size_t size) {
+  if (!p)
+    return kmalloc(size);
+  const size_t old_size = GetKernelSlabAllocator().GetUsableSize(p);
+  if (size <= old_size)
+    return p;
+  void* new_p = kmalloc(size);
+  memcpy(new_p, p, old_size);
+  kfree(p);
+  return new_p;
+}
+
+void* _malloc_r(struct _reent*, size_t size) {
+  return malloc(size);
+}
+
+void _free_r(struct _reent*, void* p) {
+  free(p);
+}
+
+void* _calloc_r(struct _reent*, size_t num_of_elements, size_t element_size) {
+  return calloc(num_of_elements, element_size);
+}
+
+void* _realloc_r(struct _reent*, void* p, size_t size) {
+  return realloc(p, size);
+}
+
 caddr_t sbrk(int diff) {
-  Process& proc = liumos->scheduler->GetCurrentProcess();
-  ExecutionContext& ctx = proc.GetExecutionContext();
-  ctx.ExpandHeap(diff);
-  return (caddr_t)ctx.GetHeapEndVirtAddr();
+  // All kernel tasks share the heap of the root process.
+  ExecutionContext& ctx = liumos->root_process->GetExecutionContext();
+  const uint64_t prev_end = ctx.GetHeapEndVirtAddr();
+  if (!ctx.ExpandHeap(diff)) {
+    errno = ENOMEM;
+    return (caddr_t)-1;
+  }
+  return (caddr_t)prev_end;
 }
 
 void _exit(int) {
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "generic.h"
+#include "spinlock.h"
+
+class PacketBufferPool;
+
+class PacketBuffer {
+  // Page which a NIC writes a received frame into. The metadata lives in the
+  // headroom, and the rest of the page is given to the NIC. Buffers are
+  // refcounted, so a frame is passed to sockets without copying, and returned
+  // to the pool when the last reference is dropped.
+ public:
+  static constexpr size_t kHeadroom = 64;
+  static constexpr size_t kDataSize = kPageSize - kHeadroom;
+  static PacketBuffer& FromData(uint8_t* data) {
+    return *reinterpret_cast<PacketBuffer*>(data - kHeadroom);
+  }
+  uint8_t* GetData() { return reinterpret_cast<uint8_t*>(this) + kHeadroom; }
+  uint8_t* GetFrame() { return GetData() + frame_offset_; }
+  size_t GetFrameSize() const { return frame_size_; }
+  // Marks [offset, offset + size) of the data as the frame.
+  void SetFrame(size_t offset, size_t size) {
+    assert(offset + size <= kDataSize);
+    frame_offset_ = static_cast<uint32_t>(offset);
+    frame_size_ = static_cast<uint32_t>(size);
+  }
+  void Ref() { __atomic_fetch_add(&num_of_refs_, 1, __ATOMIC_RELAXED); }
+  inline void Unref();
+  friend class PacketBufferPool;
+
+ private:
+  PacketBufferPool* pool_;
+  PacketBuffer* next_free_;
+  int num_of_refs_;
+  uint32_t frame_offset_;
+  uint32_t frame_size_;
+};
+static_assert(sizeof(PacketBuffer) <= PacketBuffer::kHeadroom);
+
+class PacketBufferPool {
+  // Fixed number of PacketBuffers. Buffers are freed by receivers on any
+  // processor, so the free list is protected by a lock.
+ public:
+  PacketBufferPool() : free_list_(nullptr), num_of_free_(0) {}
+  // pages should be num_of_buffers pages, aligned to kPageSize.
+  void Init(void* pages, int num_of_buffers) {
+    assert((reinterpret_cast<uint64_t>(pages) & kPageAddrMask) == 0);
+    for (int i = num_of_buffers - 1; i >= 0; i--) {
+      PacketBuffer* buf = reinterpret_cast<PacketBuffer*>(
+          reinterpret_cast<uint8_t*>(pages) + kPageSize * i);
+      buf->pool_ = this;
+      buf->num_of_refs_ = 0;
+      Free(*buf);
+    }
+  }
+  // Returns a buffer with one reference, or nullptr if none is left.
+  PacketBuffer* Alloc() {
+    const bool was_enabled = lock_.LockIRQSave();
+    PacketBuffer* buf = free_list_;
+    if (buf) {
+      free_list_ = buf->next_free_;
+      num_of_free_--;
+    }
+    lock_.UnlockIRQRestore(was_enabled);
+    if (!buf)
+      return nullptr;
+    buf->num_of_refs_ = 1;
+    buf->SetFrame(0, 0);
+    return buf;
+  }
+  int GetNumOfFreeBuffers() const { return num_of_free_; }
+  friend class PacketBuffer;
+
+ private:
+  void Free(PacketBuffer& buf) {
+    const bool was_enabled = lock_.LockIRQSave();
+    buf.next_free_ = free_list_;
+    free_list_ = &buf;
+    num_of_free_++;
+    lock_.UnlockIRQRestore(was_enabled);
+  }
+
+  SpinLock lock_;
+  PacketBuffer* free_list_;
+  int num_of_free_;
+};
+
+inline void PacketBuffer::Unref() {
+  if (__atomic_sub_fetch(&num_of_refs_, 1, __ATOMIC_ACQ_REL) == 0)
+    pool_->Free(*this);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "generic.h"
+#include "phys_page_allocator.h"
+
+template <class TAllocator>
+class PageCache {
+  // Cache of single pages in front of a PhysicalPageAllocator.
+  // Pages are moved from / to the backing allocator kBatchSize at a time,
+  // so page table construction does not hit the global free lists for
+  // every 4KiB page. Requests for multiple pages go to the backing allocator.
+  // It has no lock, so each instance should be used by one processor.
+ public:
+  static constexpr int kCapacity = 64;
+  static constexpr int kBatchSize = 32;
+  static_assert(kBatchSize <= kCapacity);
+
+  void Init(TAllocator& backing_allocator) {
+    backing_allocator_ = &backing_allocator;
+    num_of_cached_pages_ = 0;
+  }
+  template <typename T>
+  T AllocPages(uint64_t num_of_pages) {
+    if (num_of_pages != 1)
+      return backing_allocator_->template AllocPages<T>(num_of_pages);
+    if (!num_of_cached_pages_)
+      Refill();
+    return reinterpret_cast<T>(pages_[--num_of_cached_pages_]);
+  }
+  void FreePages(uint64_t phys_addr, uint64_t num_of_pages) {
+    if (num_of_pages != 1) {
+      backing_allocator_->FreePages(phys_addr, num_of_pages);
+      return;
+    }
+    if (num_of_cached_pages_ == kCapacity)
+      Drain(kBatchSize);
+    pages_[num_of_cached_pages_++] = phys_addr;
+  }
+  void Flush() { Drain(num_of_cached_pages_); }
+  int GetNumOfCachedPages() const { return num_of_cached_pages_; }
+
+ private:
+  void Refill() {
+    num_of_cached_pages_ =
+        backing_allocator_->AllocPagesInBatch(pages_, kBatchSize);
+    if (!num_of_cached_pages_)
+      Panic("Cannot allocate pages");
+  }
+  void Drain(int num_of_pages) {
+    // Give back the coldest pages, which are at the bottom of the stack.
+    backing_allocator_->FreePagesInBatch(pages_, num_of_pages);
+    for (int i = num_of_pages; i < num_of_cached_pages_; i++) {
+      pages_[i - num_of_pages] = pages_[i];
+    }
+    num_of_cached_pages_ -= num_of_pages;
+  }
+
+  TAllocator* backing_allocator_;
+  int num_of_cached_pages_;
+  uint64_t pages_[kCapacity];
+};
+
+using KernelPageCache = PageCache<KernelPhysPageAllocator>;
+// The cache of the BSP, which is the only processor allocating pages.
+KernelPageCache& GetCPULocalPageCache();
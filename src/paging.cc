@@ -164,7 +164,8 @@ void InitPaging() {
                     direct_mapping_end, kPageAttrPresent | kPageAttrWritable);
   CreatePageMapping(GetSystemDRAMAllocator(), *kernel_pml4,
                     liumos->cpu_features->kernel_phys_page_map_begin, 0,
-                    direct_mapping_end, kPageAttrPresent | kPageAttrWritable);
+                    direct_mapping_end,
+                    kPageAttrPresent | kPageAttrWritable | kPageAttrGlobal);
   liumos->direct_mapping_end_phys = direct_mapping_end;
 
   PutString("kernel straight mapping:\n  phys[ 0x");
@@ -182,7 +183,8 @@ void InitPaging() {
                     kLAPICRegisterAreaVirtBase, kLAPICRegisterAreaPhysBase,
                     kLAPICRegisterAreaByteSize,
                     kPageAttrPresent | kPageAttrWritable |
-                        kPageAttrWriteThrough | kPageAttrCacheDisable);
+                        kPageAttrWriteThrough | kPageAttrCacheDisable |
+                        kPageAttrGlobal);
 
   WriteCR3(reinterpret_cast<uint64_t>(kernel_pml4));
   PutStringAndHex("Paging enabled. Kernel CR3", ReadCR3());
@@ -24,6 +24,16 @@ constexpr uint64_t kPageAttrUser = 0b00100;
 constexpr uint64_t kPageAttrWriteThrough = 0b01000;
 constexpr uint64_t kPageAttrCacheDisable = 0b10000;
 
+// Not in kPageAttrMask since it is valid only in leaf entries. Used for
+// the kernel mappings in the upper half, which are shared by all page tables
+// and kept in TLBs across CR3 writes.
+constexpr uint64_t kPageAttrGlobal = 1ULL << 8;
+
+// Low bits of CR3 hold the PCID when CR4.PCIDE is set. Writing CR3 with
+// kCR3NoFlush keeps the TLB entries tagged with the PCID.
+constexpr uint64_t kCR3PCIDMask = 0xFFF;
+constexpr uint64_t kCR3NoFlush = 1ULL << 63;
+
 constexpr uint64_t kPageAttrMemMappedIO =
     kPageAttrCacheDisable | kPageAttrPresent | kPageAttrWritable;
 
@@ -272,6 +282,99 @@ IA_PML4& AllocPageTable(TAllocator& allocator) {
   return *pml4;
 }
 
+template <class TAllocator>
+void FreeUserPageMapping(TAllocator& allocator, IA_PML4& pml4) {
+  // Returns all pages and page tables mapped in the lower half of pml4 to
+  // the allocator. The upper half is shared with the kernel (see
+  // SetKernelPageEntries) and is left untouched.
+  for (int pml4_idx = 0; pml4_idx < IA_PML4::kNumOfEntries / 2; pml4_idx++) {
+    auto& pml4e = pml4.entries[pml4_idx];
+    if (!pml4e.IsPresent())
+      continue;
+    IA_PDPT* pdpt = pml4e.GetTableAddr();
+    for (auto& pdpte : pdpt->entries) {
+      if (!pdpte.IsPresent())
+        continue;
+      if (pdpte.IsPage()) {
+        allocator.FreePages(pdpte.GetPageBaseAddr(),
+                            IA_PDPTE::kChunkSize >> kPageSizeExponent);
+        continue;
+      }
+      IA_PDT* pdt = pdpte.GetTableAddr();
+      for (auto& pdte : pdt->entries) {
+        if (!pdte.IsPresent())
+          continue;
+        if (pdte.IsPage()) {
+          allocator.FreePages(pdte.GetPageBaseAddr(),
+                              IA_PDE::kChunkSize >> kPageSizeExponent);
+          continue;
+        }
+        IA_PT* pt = pdte.GetTableAddr();
+        // Free physically contiguous pages at once to save allocator calls
+        uint64_t run_base = 0;
+        uint64_t run_pages = 0;
+        for (auto& pte : pt->entries) {
+          if (!pte.IsPresent())
+            continue;
+          const uint64_t paddr = pte.GetPageBaseAddr();
+          if (run_pages &&
+              paddr == run_base + (run_pages << kPageSizeExponent)) {
+            run_pages++;
+            continue;
+          }
+          if (run_pages)
+            allocator.FreePages(run_base, run_pages);
+          run_base = paddr;
+          run_pages = 1;
+        }
+        if (run_pages)
+          allocator.FreePages(run_base, run_pages);
+        allocator.FreePages(reinterpret_cast<uint64_t>(pt), 1);
+      }
+      allocator.FreePages(reinterpret_cast<uint64_t>(pdt), 1);
+    }
+    allocator.FreePages(reinterpret_cast<uint64_t>(pdpt), 1);
+    pml4e.data = 0;
+  }
+}
+
+template <class TAllocator>
+void FreePageTable(TAllocator& allocator, IA_PML4& pml4) {
+  // Counterpart of AllocPageTable.
+  FreeUserPageMapping(allocator, pml4);
+  allocator.FreePages(reinterpret_cast<uint64_t>(&pml4), 1);
+}
+
+static inline void RemovePageMapping(IA_PML4& pml4,
+                                     uint64_t vaddr,
+                                     uint64_t byte_size) {
+  // Clears the leaf entries for [vaddr, vaddr + byte_size). Page tables and
+  // mapped pages are kept, so callers should free the pages and flush TLBs.
+  // 2MB pages should be covered entirely by the range.
+  assert((vaddr & kPageAddrMask) == 0);
+  const uint64_t end = vaddr + byte_size;
+  while (vaddr < end) {
+    auto& pml4e = pml4.GetEntryForAddr(vaddr);
+    if (!pml4e.IsPresent())
+      Panic("RemovePageMapping: pml4e not present");
+    auto& pdpte = pml4e.GetTableAddr()->GetEntryForAddr(vaddr);
+    if (!pdpte.IsPresent() || pdpte.IsPage())
+      Panic("RemovePageMapping: unexpected pdpte");
+    auto& pdte = pdpte.GetTableAddr()->GetEntryForAddr(vaddr);
+    if (!pdte.IsPresent())
+      Panic("RemovePageMapping: pdte not present");
+    if (pdte.IsPage()) {
+      if ((vaddr & IA_PDE::kOffsetMask) || end - vaddr < IA_PDE::kChunkSize)
+        Panic("RemovePageMapping: partial 2MB page");
+      pdte.data = 0;
+      vaddr += IA_PDE::kChunkSize;
+      continue;
+    }
+    pdte.GetTableAddr()->GetEntryForAddr(vaddr).data = 0;
+    vaddr += kPageSize;
+  }
+}
+
 void SetKernelPageEntries(IA_PML4& pml4);
 void InitPaging(void);
 IA_PML4& GetKernelPML4(void);
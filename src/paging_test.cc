@@ -92,6 +92,82 @@ void TestRangeMapping(IA_PML4& pml4,
   assert(v2p(pml4, vaddr + size) == kAddrCannotTranslate);
 }
 
+void TestFreePageTable() {
+  // Pages and page tables should return to the allocator on teardown.
+  PhysicalPageAllocator<UsePhysicalAddressInternallyStrategy> allocator;
+  constexpr int kNumOfPages = 1024;
+  uint64_t buf = reinterpret_cast<uint64_t>(
+      aligned_alloc(kPageSize, kPageSize * kNumOfPages));
+  if (!buf) {
+    perror("aligned_alloc failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  allocator.FreePagesWithProximityDomain(buf, kNumOfPages, 0);
+  const uint64_t num_of_free_pages = allocator.GetNumOfFreePages();
+
+  IA_PML4& user_pml4 = AllocPageTable(allocator);
+  constexpr uint64_t kCodeVirtBase = 0x0000'0000'0040'0000ULL;
+  constexpr uint64_t kNumOfCodePages = 37;
+  CreatePageMapping(allocator, user_pml4, kCodeVirtBase,
+                    allocator.AllocPages<uint64_t>(kNumOfCodePages),
+                    kNumOfCodePages << kPageSizeExponent, kPageAttrPresent);
+  constexpr uint64_t kStackVirtBase = 0x0000'0000'BEEF'0000ULL;
+  CreatePageMapping(allocator, user_pml4, kStackVirtBase,
+                    allocator.AllocPages<uint64_t>(1), kPageSize,
+                    kPageAttrPresent);
+  assert(v2p(user_pml4, kStackVirtBase) != kAddrCannotTranslate);
+  assert(allocator.GetNumOfFreePages() < num_of_free_pages);
+
+  FreePageTable(allocator, user_pml4);
+  assert(allocator.GetNumOfFreePages() == num_of_free_pages);
+}
+
+void TestRemovePageMapping() {
+  // Mimics the growable heap: a partial chunk with 4KB pages followed by a
+  // 2MB chunk, removed again from the end.
+  PhysicalPageAllocator<UsePhysicalAddressInternallyStrategy> allocator;
+  constexpr int kNumOfPages = 2048;
+  uint64_t buf = reinterpret_cast<uint64_t>(
+      aligned_alloc(IA_PDE::kChunkSize, kPageSize * kNumOfPages));
+  if (!buf) {
+    perror("aligned_alloc failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  allocator.FreePagesWithProximityDomain(buf, kNumOfPages, 0);
+
+  IA_PML4& pml4 = AllocPageTable(allocator);
+  constexpr uint64_t kHeapEnd = 0x0000'0000'1000'0000ULL;
+  constexpr uint64_t kNumOfSmallPages = 4;
+  const uint64_t small_vaddr =
+      kHeapEnd - (kNumOfSmallPages << kPageSizeExponent);
+  const uint64_t small_paddr = allocator.AllocPages<uint64_t>(kNumOfSmallPages);
+  CreatePageMapping(allocator, pml4, small_vaddr, small_paddr,
+                    kNumOfSmallPages << kPageSizeExponent, kPageAttrPresent);
+  const uint64_t large_paddr =
+      allocator.AllocPages<uint64_t>(IA_PDE::kChunkSize >> kPageSizeExponent);
+  assert((large_paddr & IA_PDE::kOffsetMask) == 0);
+  CreatePageMapping(allocator, pml4, kHeapEnd, large_paddr,
+                    IA_PDE::kChunkSize, kPageAttrPresent);
+  assert(pml4.GetTableBaseForAddr(kHeapEnd)
+             ->GetTableBaseForAddr(kHeapEnd)
+             ->GetEntryForAddr(kHeapEnd)
+             .IsPage());
+  assert(v2p(pml4, kHeapEnd + 0x1234) == large_paddr + 0x1234);
+
+  RemovePageMapping(pml4, kHeapEnd, IA_PDE::kChunkSize);
+  assert(v2p(pml4, kHeapEnd) == kAddrCannotTranslate);
+  assert(v2p(pml4, small_vaddr) == small_paddr);
+  RemovePageMapping(pml4, small_vaddr + kPageSize,
+                    (kNumOfSmallPages - 1) << kPageSizeExponent);
+  assert(v2p(pml4, small_vaddr) == small_paddr);
+  assert(v2p(pml4, small_vaddr + kPageSize) == kAddrCannotTranslate);
+
+  // The range can be mapped again after the removal.
+  CreatePageMapping(allocator, pml4, kHeapEnd, large_paddr,
+                    IA_PDE::kChunkSize, kPageAttrPresent);
+  assert(v2p(pml4, kHeapEnd + 0x1234) == large_paddr + 0x1234);
+}
+
 int main() {
   Test1GBPageMapping(0, 1ULL << 30);
   Test1GBPageMapping(1ULL << 30, 1ULL << 31);
@@ -101,6 +177,8 @@ int main() {
                    4ULL * 1024 * 1024 * 1024);
   TestRangeMapping(pml4, 0xFFFF'FFFF'FFE0'0000ULL, 0x0000'0000'FFE0'0000ULL,
                    0x0000'0000'0020'0000ULL);
+  TestFreePageTable();
+  TestRemovePageMapping();
   puts("PASS");
   return 0;
 }
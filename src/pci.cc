@@ -3,7 +3,7 @@
 #include <cstdio>
 #include <string>
 
-#include "liumos.h"
+#include "kernel.h"
 
 constexpr uint16_t kIOAddrPCIConfigAddr = 0x0CF8;
 constexpr uint16_t kIOAddrPCIConfigData = 0x0CFC;
@@ -41,7 +41,7 @@ uint8_t PCI::ReadConfigRegister8(uint32_t bus,
                                  uint32_t func,
                                  uint32_t reg) {
   SelectRegister(bus, device, func, reg & 0b1111'1100);
-  return (ReadIOPort32(kIOAddrPCIConfigData) >> (reg & 3)) & 0xFF;
+  return (ReadIOPort32(kIOAddrPCIConfigData) >> ((reg & 3) * 8)) & 0xFF;
 }
 
 uint32_t PCI::ReadConfigRegister32(uint32_t bus,
@@ -120,6 +120,63 @@ void PCI::PrintDevices() {
   }
 }
 
+uint8_t PCI::FindCapability(const DeviceLocation& dev, uint8_t cap_id) {
+  // PCI: 6.7. Capabilities List
+  constexpr uint32_t kPCIStatusCapabilitiesList = 1 << 20;
+  if (!(ReadConfigRegister32(dev, 0x04) & kPCIStatusCapabilitiesList))
+    return 0;
+  uint8_t cap_ofs = ReadConfigRegister8(dev, 0x34) & ~0b11;
+  for (; cap_ofs; cap_ofs = ReadConfigRegister8(dev, cap_ofs + 1) & ~0b11) {
+    if (ReadConfigRegister8(dev, cap_ofs) == cap_id)
+      return cap_ofs;
+  }
+  return 0;
+}
+
+constexpr uint8_t kPCICapabilityIDMSIX = 0x11;
+constexpr uint32_t kMSIXEntrySize = 16;
+
+bool PCI::MSIX::Init(const DeviceLocation& dev) {
+  dev_ = dev;
+  cap_ofs_ = FindCapability(dev, kPCICapabilityIDMSIX);
+  if (!cap_ofs_)
+    return false;
+  const uint32_t msg_ctrl = ReadConfigRegister32(dev, cap_ofs_) >> 16;
+  num_of_entries_ = (msg_ctrl & 0x7FF) + 1;
+  const uint32_t table_ofs_and_bir = ReadConfigRegister32(dev, cap_ofs_ + 4);
+  const uint64_t table_paddr =
+      GetBARForMemory(dev, table_ofs_and_bir & 0b111) +
+      (table_ofs_and_bir & ~0b111U);
+  const uint64_t table_page = table_paddr & ~kPageAddrMask;
+  const uint64_t map_size =
+      (table_paddr - table_page) + kMSIXEntrySize * num_of_entries_;
+  table_ = reinterpret_cast<volatile uint32_t*>(
+      MapMemoryForIO<uint8_t*>(table_page, map_size) +
+      (table_paddr - table_page));
+  return true;
+}
+
+void PCI::MSIX::SetEntry(int index, uint32_t apic_id, uint8_t vector) {
+  // SDM Vol.3: 10.11 Message Signalled Interrupts
+  // Fixed delivery mode, edge triggered, physical destination mode
+  assert(0 <= index && index < num_of_entries_);
+  assert(apic_id <= 0xFF);
+  volatile uint32_t* entry = &table_[index * kMSIXEntrySize / 4];
+  entry[3] |= 1;  // Mask while updating the entry
+  entry[0] = 0xFEE0'0000 | (apic_id << 12);
+  entry[1] = 0;
+  entry[2] = vector;
+  entry[3] &= ~1U;
+}
+
+void PCI::MSIX::Enable() {
+  // Sets MSI-X Enable and clears Function Mask in Message Control.
+  uint32_t cap = ReadConfigRegister32(dev_, cap_ofs_);
+  cap |= 1U << 31;
+  cap &= ~(1U << 30);
+  WriteConfigRegister32(dev_, cap_ofs_, cap);
+}
+
 const char* PCI::GetDeviceName(DeviceIdent key) {
   const auto& it = device_infos.find(key);
   return it != device_infos.end() ? it->second : "(Unknown)";
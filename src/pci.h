@@ -111,6 +111,37 @@ class PCI {
     return {base_addr, base_addr_size};
   }
 
+  // Returns the physical address of a memory space BAR.
+  static uint64_t GetBARForMemory(const DeviceLocation& dev, int index) {
+    constexpr uint32_t kPCIRegOffsetBAR = 0x10;
+    constexpr uint32_t kPCIBARBitsType64bit = 0b100;
+    const uint32_t reg = kPCIRegOffsetBAR + 4 * index;
+    const uint32_t bar_raw_val = PCI::ReadConfigRegister32(dev, reg);
+    assert((bar_raw_val & 1) == 0);
+    if (bar_raw_val & kPCIBARBitsType64bit)
+      return PCI::ReadConfigRegister64(dev, reg) & ~0b1111ULL;
+    return bar_raw_val & ~0b1111U;
+  }
+  // Returns the offset of the first capability with cap_id, or 0.
+  static uint8_t FindCapability(const DeviceLocation& dev, uint8_t cap_id);
+
+  class MSIX {
+    // PCI: 6.8.2 MSI-X Capability and Table Structure
+   public:
+    // Returns false if the device does not have the capability.
+    bool Init(const DeviceLocation& dev);
+    int GetNumOfEntries() const { return num_of_entries_; }
+    // Routes the entry to the vector of the processor with apic_id.
+    void SetEntry(int index, uint32_t apic_id, uint8_t vector);
+    void Enable();
+
+   private:
+    DeviceLocation dev_;
+    uint8_t cap_ofs_;
+    int num_of_entries_;
+    volatile uint32_t* table_;
+  };
+
   static PCI& GetInstance() {
     if (!pci_)
       pci_ = new PCI();
@@ -7,22 +7,44 @@ void PhysicalPageAllocator<TStrategy>::FreeInfo::Print() {
   PutString("[ 0x");
   PutHex64ZeroFilled(physical_start);
   PutString(" - 0x");
-  PutHex64ZeroFilled(physical_start + (num_of_pages_ << 12));
+  PutHex64ZeroFilled(physical_start + (kPageSize << order_));
   PutString(" )@ProxDomain:0x");
   PutHex64(proximity_domain_);
-  PutString(" = 0x");
-  PutHex64(num_of_pages_);
-  PutString(" pages\n");
+  PutString(" order = ");
+  PutDecimal64(order_);
+  PutString("\n");
 }
 template void
 PhysicalPageAllocator<UsePhysicalAddressInternallyStrategy>::FreeInfo::Print();
 
 template <class TStrategy>
 void PhysicalPageAllocator<TStrategy>::Print() {
-  FreeInfo* info = TStrategy::GetFreeInfoFromPhysAddr(head_phys_addr_);
-  while (info) {
-    info->Print();
-    info = info->GetNext();
+  for (int i = 0; i < num_of_zones_; i++) {
+    PutString("Zone [ 0x");
+    PutHex64ZeroFilled(zones_[i].phys_start);
+    PutString(" - 0x");
+    PutHex64ZeroFilled(zones_[i].phys_end);
+    PutString(" )@ProxDomain:0x");
+    PutHex64(domains_[zones_[i].domain_idx].proximity_domain);
+    PutString("\n");
+  }
+  for (int i = 0; i < num_of_domains_; i++) {
+    DomainFreeLists& d = domains_[i];
+    PutString("ProxDomain:0x");
+    PutHex64(d.proximity_domain);
+    PutString(" free = 0x");
+    PutHex64(d.num_of_free_pages);
+    PutString(" pages\n  blocks for each order:");
+    for (int order = 0; order < kNumOfOrders; order++) {
+      int num_of_blocks = 0;
+      for (uint64_t p = d.free_list_head[order]; p;
+           p = GetFreeInfo(p)->next_phys_addr_) {
+        num_of_blocks++;
+      }
+      PutChar(' ');
+      PutDecimal64(num_of_blocks);
+    }
+    PutString("\n");
   }
 }
 template void
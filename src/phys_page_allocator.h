@@ -6,47 +6,102 @@ struct UseKernelStraightMappingInternallyStrategy;
 
 template <class TStrategy>
 class PhysicalPageAllocator {
+  // Binary buddy allocator.
+  // Free blocks are 2^order pages, aligned to their own size in the physical
+  // address space, and kept in per-proximity-domain free lists for each order.
+  // Headers of free blocks (FreeInfo) are placed on the free pages themselves,
+  // and all links are kept as physical addresses since this object is shared
+  // between the loader (identity mapped) and the kernel (straight mapping).
  public:
-  PhysicalPageAllocator() : head_phys_addr_(0) {}
+  static constexpr int kMaxOrder = 18;  // 2^18 pages = 1GB
+  static constexpr int kNumOfOrders = kMaxOrder + 1;
+  static constexpr int kMaxNumOfProximityDomains = 8;
+  static constexpr int kMaxNumOfZones = 128;
+
+  PhysicalPageAllocator() : num_of_domains_(0), num_of_zones_(0) {}
+  // The free lists live in the free pages, so a copy would corrupt them.
+  PhysicalPageAllocator(const PhysicalPageAllocator&) = delete;
+  PhysicalPageAllocator& operator=(const PhysicalPageAllocator&) = delete;
   void FreePagesWithProximityDomain(uint64_t phys_addr,
                                     uint64_t num_of_pages,
                                     uint32_t prox_domain) {
-    // TODO: Impl merge
     assert(num_of_pages > 0);
     assert((phys_addr & 0xfff) == 0);
-    FreeInfo* info = TStrategy::GetFreeInfoFromPhysAddr(phys_addr);
-    head_phys_addr_ = TStrategy::GetPhysAddrFromFreeInfo(new (info) FreeInfo(
-        num_of_pages, TStrategy::GetFreeInfoFromPhysAddr(head_phys_addr_),
-        prox_domain));
+    if (phys_addr == 0) {
+      // Physical address 0 is used as a terminator of the free lists.
+      // Never manage the page at 0 to avoid returning it as nullptr.
+      phys_addr += kPageSize;
+      num_of_pages--;
+      if (!num_of_pages)
+        return;
+    }
+    const uint64_t end = phys_addr + (num_of_pages << kPageSizeExponent);
+    int zone_idx = FindZone(phys_addr, end);
+    if (zone_idx < 0)
+      zone_idx = RegisterZone(phys_addr, end, prox_domain);
+    FreeRange(phys_addr, end, zones_[zone_idx]);
+  }
+  void FreePages(uint64_t phys_addr, uint64_t num_of_pages) {
+    // Returns pages allocated by AllocPages* to the proximity domain they
+    // came from.
+    assert(num_of_pages > 0);
+    assert((phys_addr & 0xfff) == 0);
+    const uint64_t end = phys_addr + (num_of_pages << kPageSizeExponent);
+    int zone_idx = FindZone(phys_addr, end);
+    if (zone_idx < 0)
+      Panic("Tried to free pages not managed by this allocator");
+    FreeRange(phys_addr, end, zones_[zone_idx]);
   }
 
   template <typename T>
   T AllocPages(uint64_t num_of_pages) {
-    FreeInfo* info = TStrategy::GetFreeInfoFromPhysAddr(head_phys_addr_);
-    void* addr = nullptr;
-    while (info) {
-      addr = info->ProvidePages(num_of_pages);
-      if (addr)
-        return reinterpret_cast<T>(addr);
-      info = info->GetNext();
+    const int order = GetOrderForNumOfPages(num_of_pages);
+    for (int i = 0; i < num_of_domains_; i++) {
+      if (!HasFreeBlockAtLeast(domains_[i], order))
+        continue;
+      return reinterpret_cast<T>(
+          AllocPagesFromDomain(domains_[i], order, num_of_pages));
     }
     Panic("Cannot allocate pages");
   }
   template <typename T>
   T AllocPagesInProximityDomain(uint64_t num_of_pages,
                                 uint32_t proximity_domain) {
-    FreeInfo* info = TStrategy::GetFreeInfoFromPhysAddr(head_phys_addr_);
-    void* addr = nullptr;
-    while (info) {
-      if (info->GetProximityDomain() == proximity_domain) {
-        addr = info->ProvidePages(num_of_pages);
-        if (addr)
-          return reinterpret_cast<T>(addr);
-      }
-      info = info->GetNext();
+    const int order = GetOrderForNumOfPages(num_of_pages);
+    for (int i = 0; i < num_of_domains_; i++) {
+      if (domains_[i].proximity_domain != proximity_domain)
+        continue;
+      if (!HasFreeBlockAtLeast(domains_[i], order))
+        break;
+      return reinterpret_cast<T>(
+          AllocPagesFromDomain(domains_[i], order, num_of_pages));
     }
     Panic("Cannot allocate pages");
   }
+  int AllocPagesInBatch(uint64_t* pages, int num_of_pages) {
+    // Allocates up to num_of_pages single pages and stores them into pages.
+    // Returns the number of pages actually allocated (does not panic).
+    int num_of_allocated = 0;
+    for (int i = 0; i < num_of_domains_; i++) {
+      while (num_of_allocated < num_of_pages &&
+             HasFreeBlockAtLeast(domains_[i], 0)) {
+        pages[num_of_allocated++] = AllocPagesFromDomain(domains_[i], 0, 1);
+      }
+    }
+    return num_of_allocated;
+  }
+  void FreePagesInBatch(const uint64_t* pages, int num_of_pages) {
+    for (int i = 0; i < num_of_pages; i++) {
+      FreePages(pages[i], 1);
+    }
+  }
+  uint64_t GetNumOfFreePages() {
+    uint64_t num_of_free_pages = 0;
+    for (int i = 0; i < num_of_domains_; i++) {
+      num_of_free_pages += domains_[i].num_of_free_pages;
+    }
+    return num_of_free_pages;
+  }
   void Print();
 
  private:
@@ -55,36 +110,231 @@ class PhysicalPageAllocator {
 
   class FreeInfo {
    public:
-    FreeInfo(uint64_t num_of_pages, FreeInfo* next, uint32_t proximity_domain)
-        : num_of_pages_(num_of_pages),
-          next_phys_addr_(TStrategy::GetPhysAddrFromFreeInfo(next)),
+    FreeInfo(uint64_t phys_addr,
+             int order,
+             uint64_t next_phys_addr,
+             uint32_t proximity_domain)
+        : signature_(GetSignatureFor(phys_addr)),
+          next_phys_addr_(next_phys_addr),
+          prev_phys_addr_(0),
+          order_(order),
           proximity_domain_(proximity_domain) {}
-    FreeInfo* GetNext() const {
-      return TStrategy::GetFreeInfoFromPhysAddr(next_phys_addr_);
-    }
-    void* ProvidePages(uint64_t num_of_req_pages) {
-      if (!CanProvidePages(num_of_req_pages))
-        return nullptr;
-      num_of_pages_ -= num_of_req_pages;
-      return reinterpret_cast<void*>(TStrategy::GetPhysAddrFromFreeInfo(this) +
-                                     (num_of_pages_ << 12));
+    bool IsFreeBlockOf(uint64_t phys_addr,
+                       int order,
+                       uint32_t proximity_domain) const {
+      return signature_ == GetSignatureFor(phys_addr) && order_ == order &&
+             proximity_domain_ == proximity_domain;
     }
+    void Invalidate() { signature_ = 0; }
 
     void Print();
-    uint32_t GetProximityDomain() { return proximity_domain_; };
 
-   private:
-    bool CanProvidePages(uint64_t num_of_req_pages) const {
-      return num_of_req_pages < num_of_pages_;
-    }
-
-    uint64_t num_of_pages_;
+    uint64_t signature_;
     uint64_t next_phys_addr_;
+    uint64_t prev_phys_addr_;
+    int order_;
     uint32_t proximity_domain_;
+
+   private:
+    static uint64_t GetSignatureFor(uint64_t phys_addr) {
+      return kSignature ^ phys_addr;
+    }
+    static constexpr uint64_t kSignature = 0x4B4C425944445542ULL;
   };
   static_assert(sizeof(FreeInfo) <= kPageSize);
 
-  uint64_t head_phys_addr_;
+  struct DomainFreeLists {
+    uint32_t proximity_domain;
+    uint32_t non_empty_orders;  // bit n is set if free_list_head[n] != 0
+    uint64_t num_of_free_pages;
+    uint64_t free_list_head[kNumOfOrders];
+  };
+  struct Zone {
+    // A physically contiguous range which has been given to this allocator.
+    // Buddies are merged only within a zone.
+    uint64_t phys_start;
+    uint64_t phys_end;
+    int domain_idx;
+  };
+
+  static FreeInfo* GetFreeInfo(uint64_t phys_addr) {
+    return TStrategy::GetFreeInfoFromPhysAddr(phys_addr);
+  }
+  static uint64_t GetBlockByteSize(int order) {
+    return kPageSize << order;
+  }
+  static int GetOrderForNumOfPages(uint64_t num_of_pages) {
+    assert(num_of_pages > 0);
+    if (num_of_pages > (1ULL << kMaxOrder))
+      Panic("Too large page allocation request");
+    if (num_of_pages == 1)
+      return 0;
+    return 64 - __builtin_clzll(num_of_pages - 1);
+  }
+  static bool HasFreeBlockAtLeast(const DomainFreeLists& d, int order) {
+    return d.non_empty_orders >> order;
+  }
+
+  void PushFreeBlock(DomainFreeLists& d, uint64_t phys_addr, int order) {
+    const uint64_t next_phys_addr = d.free_list_head[order];
+    new (GetFreeInfo(phys_addr))
+        FreeInfo(phys_addr, order, next_phys_addr, d.proximity_domain);
+    if (next_phys_addr)
+      GetFreeInfo(next_phys_addr)->prev_phys_addr_ = phys_addr;
+    d.free_list_head[order] = phys_addr;
+    d.non_empty_orders |= 1U << order;
+    d.num_of_free_pages += 1ULL << order;
+  }
+  void RemoveFreeBlock(DomainFreeLists& d, uint64_t phys_addr, int order) {
+    FreeInfo* info = GetFreeInfo(phys_addr);
+    if (info->prev_phys_addr_)
+      GetFreeInfo(info->prev_phys_addr_)->next_phys_addr_ =
+          info->next_phys_addr_;
+    else
+      d.free_list_head[order] = info->next_phys_addr_;
+    if (info->next_phys_addr_)
+      GetFreeInfo(info->next_phys_addr_)->prev_phys_addr_ =
+          info->prev_phys_addr_;
+    if (!d.free_list_head[order])
+      d.non_empty_orders &= ~(1U << order);
+    d.num_of_free_pages -= 1ULL << order;
+    info->Invalidate();
+  }
+  bool IsInFreeList(DomainFreeLists& d, uint64_t phys_addr, int order) {
+    FreeInfo* info = GetFreeInfo(phys_addr);
+    if (!info->IsFreeBlockOf(phys_addr, order, d.proximity_domain))
+      return false;
+    // Double-check with the links to reject stale data in allocated pages.
+    if (info->prev_phys_addr_)
+      return GetFreeInfo(info->prev_phys_addr_)->next_phys_addr_ == phys_addr;
+    return d.free_list_head[order] == phys_addr;
+  }
+
+  void FreeBlock(Zone& zone, uint64_t phys_addr, int order) {
+    DomainFreeLists& d = domains_[zone.domain_idx];
+    if (IsInFreeList(d, phys_addr, order))
+      Panic("Double free detected in PhysicalPageAllocator");
+    while (order < kMaxOrder) {
+      const uint64_t buddy = phys_addr ^ GetBlockByteSize(order);
+      if (buddy < zone.phys_start ||
+          zone.phys_end < buddy + GetBlockByteSize(order))
+        break;
+      if (!IsInFreeList(d, buddy, order))
+        break;
+      RemoveFreeBlock(d, buddy, order);
+      if (buddy < phys_addr)
+        phys_addr = buddy;
+      order++;
+    }
+    PushFreeBlock(d, phys_addr, order);
+  }
+  void FreeRange(uint64_t phys_addr, uint64_t end, Zone& zone) {
+    // Split [phys_addr, end) into naturally aligned blocks as large as
+    // possible and free each of them.
+    while (phys_addr < end) {
+      int order =
+          static_cast<int>(__builtin_ctzll(phys_addr) - kPageSizeExponent);
+      if (order > kMaxOrder)
+        order = kMaxOrder;
+      while (phys_addr + GetBlockByteSize(order) > end)
+        order--;
+      FreeBlock(zone, phys_addr, order);
+      phys_addr += GetBlockByteSize(order);
+    }
+  }
+  uint64_t AllocPagesFromDomain(DomainFreeLists& d,
+                                int order,
+                                uint64_t num_of_pages) {
+    int found_order = __builtin_ctz(d.non_empty_orders >> order) + order;
+    const uint64_t phys_addr = d.free_list_head[found_order];
+    RemoveFreeBlock(d, phys_addr, found_order);
+    while (found_order > order) {
+      // Split and return the upper half
+      found_order--;
+      PushFreeBlock(d, phys_addr + GetBlockByteSize(found_order), found_order);
+    }
+    const uint64_t end = phys_addr + GetBlockByteSize(order);
+    const uint64_t used_end = phys_addr + (num_of_pages << kPageSizeExponent);
+    if (used_end < end) {
+      // Give back the unused tail of the block
+      FreeRange(used_end, end, zones_[FindZone(phys_addr, end)]);
+    }
+    return phys_addr;
+  }
+
+  int FindZone(uint64_t phys_start, uint64_t phys_end) {
+    // Returns the index of the zone which contains [phys_start, phys_end)
+    // or -1 if not found. zones_ are sorted by phys_start.
+    int lo = 0, hi = num_of_zones_;
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      if (zones_[mid].phys_end <= phys_start)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo == num_of_zones_ || phys_end <= zones_[lo].phys_start)
+      return -1;
+    if (phys_start < zones_[lo].phys_start || zones_[lo].phys_end < phys_end)
+      Panic("Page range overlaps with the zone boundary");
+    return lo;
+  }
+  int FindOrRegisterDomain(uint32_t proximity_domain) {
+    for (int i = 0; i < num_of_domains_; i++) {
+      if (domains_[i].proximity_domain == proximity_domain)
+        return i;
+    }
+    if (num_of_domains_ >= kMaxNumOfProximityDomains)
+      Panic("Too many proximity domains");
+    DomainFreeLists& d = domains_[num_of_domains_];
+    d.proximity_domain = proximity_domain;
+    d.non_empty_orders = 0;
+    d.num_of_free_pages = 0;
+    for (int i = 0; i < kNumOfOrders; i++) {
+      d.free_list_head[i] = 0;
+    }
+    return num_of_domains_++;
+  }
+  int RegisterZone(uint64_t phys_start,
+                   uint64_t phys_end,
+                   uint32_t proximity_domain) {
+    const int domain_idx = FindOrRegisterDomain(proximity_domain);
+    int idx = 0;
+    while (idx < num_of_zones_ && zones_[idx].phys_start < phys_start)
+      idx++;
+    // Extend an adjacent zone in the same domain if possible
+    if (idx > 0 && zones_[idx - 1].phys_end == phys_start &&
+        zones_[idx - 1].domain_idx == domain_idx) {
+      zones_[idx - 1].phys_end = phys_end;
+      if (idx < num_of_zones_ && zones_[idx].phys_start == phys_end &&
+          zones_[idx].domain_idx == domain_idx) {
+        zones_[idx - 1].phys_end = zones_[idx].phys_end;
+        for (int i = idx; i + 1 < num_of_zones_; i++) {
+          zones_[i] = zones_[i + 1];
+        }
+        num_of_zones_--;
+      }
+      return idx - 1;
+    }
+    if (idx < num_of_zones_ && zones_[idx].phys_start == phys_end &&
+        zones_[idx].domain_idx == domain_idx) {
+      zones_[idx].phys_start = phys_start;
+      return idx;
+    }
+    if (num_of_zones_ >= kMaxNumOfZones)
+      Panic("Too many zones in PhysicalPageAllocator");
+    for (int i = num_of_zones_; i > idx; i--) {
+      zones_[i] = zones_[i - 1];
+    }
+    zones_[idx] = {phys_start, phys_end, domain_idx};
+    num_of_zones_++;
+    return idx;
+  }
+
+  DomainFreeLists domains_[kMaxNumOfProximityDomains];
+  int num_of_domains_;
+  Zone zones_[kMaxNumOfZones];
+  int num_of_zones_;
 };
 
 PhysicalPageAllocator<UsePhysicalAddressInternallyStrategy>&
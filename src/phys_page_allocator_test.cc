@@ -0,0 +1,222 @@
+#include "phys_page_allocator.h"
+#include "page_cache.h"
+
+#ifdef LIUMOS_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <random>
+#include <utility>
+#include <vector>
+
+[[noreturn]] void Panic(const char* s) {
+  puts(s);
+  exit(EXIT_FAILURE);
+}
+
+using Allocator = PhysicalPageAllocator<UsePhysicalAddressInternallyStrategy>;
+
+constexpr uint64_t kTestRegionAlign = 1ULL << 24;
+constexpr uint64_t kTestRegionPages = 4096;
+
+uint64_t AllocTestRegion(uint64_t num_of_pages) {
+  void* p = aligned_alloc(kTestRegionAlign, num_of_pages << kPageSizeExponent);
+  if (!p) {
+    perror("aligned_alloc failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  return reinterpret_cast<uint64_t>(p);
+}
+
+void ScrubTestRegion(uint64_t base) {
+  // Each test uses a fresh allocator, so remove headers left by the others.
+  memset(reinterpret_cast<void*>(base), 0xCC,
+         kTestRegionPages << kPageSizeExponent);
+}
+
+void TestAllocAndFreeCoalescing(uint64_t base) {
+  Allocator allocator;
+  ScrubTestRegion(base);
+  allocator.FreePagesWithProximityDomain(base, kTestRegionPages, 0);
+  assert(allocator.GetNumOfFreePages() == kTestRegionPages);
+
+  std::vector<uint64_t> pages;
+  for (uint64_t i = 0; i < kTestRegionPages; i++) {
+    uint64_t p = allocator.AllocPages<uint64_t>(1);
+    assert((p & kPageAddrMask) == 0);
+    assert(base <= p && p < base + (kTestRegionPages << kPageSizeExponent));
+    pages.push_back(p);
+  }
+  assert(allocator.GetNumOfFreePages() == 0);
+
+  std::mt19937 rand(1);
+  std::shuffle(pages.begin(), pages.end(), rand);
+  for (auto& p : pages) {
+    allocator.FreePages(p, 1);
+  }
+  assert(allocator.GetNumOfFreePages() == kTestRegionPages);
+
+  // All pages should be merged into one block again.
+  assert(allocator.AllocPages<uint64_t>(kTestRegionPages) == base);
+  assert(allocator.GetNumOfFreePages() == 0);
+  allocator.FreePages(base, kTestRegionPages);
+}
+
+void TestNonPowerOfTwoAlloc(uint64_t base) {
+  Allocator allocator;
+  ScrubTestRegion(base);
+  allocator.FreePagesWithProximityDomain(base, kTestRegionPages, 0);
+
+  uint64_t p = allocator.AllocPages<uint64_t>(5);
+  assert(allocator.GetNumOfFreePages() == kTestRegionPages - 5);
+  uint64_t q = allocator.AllocPages<uint64_t>(3);
+  // The tail of the block for the first request should be reused.
+  assert(q == p + (5 << kPageSizeExponent) ||
+         q + (3 << kPageSizeExponent) <= p ||
+         p + (5 << kPageSizeExponent) <= q);
+  allocator.FreePages(p, 5);
+  allocator.FreePages(q, 3);
+  assert(allocator.GetNumOfFreePages() == kTestRegionPages);
+  assert(allocator.AllocPages<uint64_t>(kTestRegionPages) == base);
+}
+
+void TestUnalignedRange(uint64_t base) {
+  Allocator allocator;
+  ScrubTestRegion(base);
+  // A range which does not start or end at a large alignment
+  const uint64_t start = base + (3 << kPageSizeExponent);
+  const uint64_t num_of_pages = kTestRegionPages - 3 - 7;
+  allocator.FreePagesWithProximityDomain(start, num_of_pages, 0);
+  assert(allocator.GetNumOfFreePages() == num_of_pages);
+  std::vector<std::pair<uint64_t, uint64_t>> allocated;
+  for (uint64_t n = 1; allocator.GetNumOfFreePages() > num_of_pages / 4;
+       n = n % 9 + 1) {
+    uint64_t p = allocator.AllocPages<uint64_t>(n);
+    assert(start <= p &&
+           p + (n << kPageSizeExponent) <=
+               start + (num_of_pages << kPageSizeExponent));
+    allocated.push_back({p, n});
+  }
+  for (auto& it : allocated) {
+    allocator.FreePages(it.first, it.second);
+  }
+  assert(allocator.GetNumOfFreePages() == num_of_pages);
+}
+
+void TestProximityDomain(uint64_t base0, uint64_t base1) {
+  Allocator allocator;
+  ScrubTestRegion(base0);
+  ScrubTestRegion(base1);
+  allocator.FreePagesWithProximityDomain(base0, kTestRegionPages, 0);
+  allocator.FreePagesWithProximityDomain(base1, kTestRegionPages, 1);
+  for (int i = 0; i < 16; i++) {
+    uint64_t p = allocator.AllocPagesInProximityDomain<uint64_t>(7, 1);
+    assert(base1 <= p && p < base1 + (kTestRegionPages << kPageSizeExponent));
+    uint64_t q = allocator.AllocPagesInProximityDomain<uint64_t>(7, 0);
+    assert(base0 <= q && q < base0 + (kTestRegionPages << kPageSizeExponent));
+  }
+  assert(allocator.GetNumOfFreePages() == 2 * kTestRegionPages - 2 * 16 * 7);
+}
+
+void TestPageCache(uint64_t base) {
+  using Cache = PageCache<Allocator>;
+  Allocator allocator;
+  ScrubTestRegion(base);
+  allocator.FreePagesWithProximityDomain(base, kTestRegionPages, 0);
+  Cache cache;
+  cache.Init(allocator);
+
+  // The first allocation refills the cache in a batch.
+  uint64_t p = cache.AllocPages<uint64_t>(1);
+  assert(cache.GetNumOfCachedPages() == Cache::kBatchSize - 1);
+  assert(allocator.GetNumOfFreePages() == kTestRegionPages - Cache::kBatchSize);
+  // Freed pages are reused first.
+  cache.FreePages(p, 1);
+  assert(cache.AllocPages<uint64_t>(1) == p);
+  cache.FreePages(p, 1);
+
+  std::vector<uint64_t> pages;
+  for (int i = 0; i < 4 * Cache::kCapacity; i++) {
+    pages.push_back(cache.AllocPages<uint64_t>(1));
+  }
+  std::sort(pages.begin(), pages.end());
+  assert(std::unique(pages.begin(), pages.end()) == pages.end());
+  for (auto& page : pages) {
+    cache.FreePages(page, 1);
+    assert(cache.GetNumOfCachedPages() <= Cache::kCapacity);
+  }
+  assert(allocator.GetNumOfFreePages() + cache.GetNumOfCachedPages() ==
+         kTestRegionPages);
+  cache.Flush();
+  assert(cache.GetNumOfCachedPages() == 0);
+  assert(allocator.AllocPages<uint64_t>(kTestRegionPages) == base);
+}
+
+void BenchmarkChurn(uint64_t base) {
+  Allocator allocator;
+  ScrubTestRegion(base);
+  allocator.FreePagesWithProximityDomain(base, kTestRegionPages, 0);
+  constexpr int kNumOfSlots = 256;
+  constexpr int kNumOfIterations = 1'000'000;
+  std::pair<uint64_t, uint64_t> slots[kNumOfSlots] = {};
+  std::mt19937 rand(2);
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < kNumOfIterations; i++) {
+    auto& s = slots[rand() % kNumOfSlots];
+    if (s.first) {
+      allocator.FreePages(s.first, s.second);
+      s.first = 0;
+      continue;
+    }
+    s.second = 1 + rand() % 8;
+    s.first = allocator.AllocPages<uint64_t>(s.second);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  for (auto& s : slots) {
+    if (s.first)
+      allocator.FreePages(s.first, s.second);
+  }
+  assert(allocator.GetNumOfFreePages() == kTestRegionPages);
+  printf("alloc/free churn: %.1f ns/op\n",
+         std::chrono::duration<double, std::nano>(t1 - t0).count() /
+             kNumOfIterations);
+
+  PageCache<Allocator> cache;
+  cache.Init(allocator);
+  uint64_t pages[kNumOfSlots];
+  t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < kNumOfIterations / kNumOfSlots; i++) {
+    for (auto& p : pages) {
+      p = cache.AllocPages<uint64_t>(1);
+    }
+    for (auto& p : pages) {
+      cache.FreePages(p, 1);
+    }
+  }
+  t1 = std::chrono::steady_clock::now();
+  cache.Flush();
+  assert(allocator.GetNumOfFreePages() == kTestRegionPages);
+  printf("single page alloc/free via PageCache: %.1f ns/op\n",
+         std::chrono::duration<double, std::nano>(t1 - t0).count() /
+             (kNumOfIterations / kNumOfSlots * kNumOfSlots * 2));
+}
+
+int main() {
+  const uint64_t base0 = AllocTestRegion(kTestRegionPages);
+  const uint64_t base1 = AllocTestRegion(kTestRegionPages);
+  TestAllocAndFreeCoalescing(base0);
+  TestNonPowerOfTwoAlloc(base0);
+  TestUnalignedRange(base0);
+  TestProximityDomain(base0, base1);
+  TestPageCache(base0);
+  BenchmarkChurn(base0);
+  puts("PASS");
+  return 0;
+}
+
+#endif
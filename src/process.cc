@@ -1,28 +1,11 @@
 #include "liumos.h"
 
 void Process::Kill() {
-  switch (status_) {
-    case Status::kNotInitialized:
-    case Status::kNotScheduled:
-      PutString("Tried to stop the process not running");
-      return;
-    case Status::kSleeping:
-      SetStatus(Status::kStopped);
-      return;
-    case Status::kRunning:
-      SetStatus(Status::kStopping);
-      return;
-    case Status::kStopping:
-    case Status::kStopped:
-      return;
-  }
-  assert(false);
+  liumos->scheduler->Kill(*this);
 }
 
 void Process::WaitUntilExit() {
-  while (status_ != Status::kStopped) {
-    Sleep();
-  }
+  exit_wait_queue_.WaitUntil([this] { return status_ == Status::kStopped; });
 }
 
 void Process::NotifyContextSaving() {
@@ -50,15 +33,63 @@ void Process::PrintStatistics() {
   PutString(", ");
   PutDecimal64WithPointPos(num_of_clflush_issued_in_ctx_sw_, 6);
   PutString("\n");
+  PutStringAndDecimal("  num of FPU state restores", num_of_fpu_restores_);
+  for (int i = 0; i < Processor::kMaxNumOfProcessors; i++) {
+    if (!proc_time_femto_sec_on_cpu_[i])
+      continue;
+    PutString("  proc time on cpu ");
+    PutDecimal64(i);
+    PutString(" [s]: ");
+    PutDecimal64WithPointPos(proc_time_femto_sec_on_cpu_[i], 15);
+    PutString("\n");
+  }
 }
 
 Process& ProcessController::Create() {
-  Process* proc = kernel_heap_allocator_.AllocPages<Process*>(
-      ByteSizeToPageSize(sizeof(Process)));
+  Process* proc = reinterpret_cast<Process*>(process_cache_.Alloc());
   new (proc) Process(++last_id_);
+  proc->fpu_state_ = fpu_state_cache_.Alloc();
+  OpenStandardFiles(proc->fd_table_);
   return *proc;
 }
 
+void ProcessController::FreeKernelStack(ExecutionContext& ctx) {
+  if (!ctx.GetKernelRSP())
+    return;
+  kernel_heap_allocator_.FreePages(
+      ctx.GetKernelRSP() -
+          (kKernelStackPagesForEachProcess << kPageSizeExponent),
+      kKernelStackPagesForEachProcess);
+  ctx.SetKernelRSP(0);
+}
+
+void ProcessController::Destroy(Process& proc) {
+  // Reclaims the memory owned by a stopped process, or one which has never
+  // been registered. Persistent segments are kept since they live in PMEM
+  // and can be restored later, but their kernel stacks are in DRAM and are
+  // allocated again on restore.
+  if (proc.GetStatus() != Process::Status::kNotScheduled)
+    liumos->scheduler->UnregisterProcess(proc);
+  proc.fd_table_.CloseAll();
+  if (proc.IsPersistent()) {
+    for (int i = 0; i < PersistentProcessInfo::kNumOfExecutionContext; i++)
+      FreeKernelStack(proc.pp_info_->GetContext(i));
+  } else {
+    ExecutionContext& ctx = proc.GetExecutionContext();
+    IA_PML4& pml4 = ctx.GetCR3();
+    if (GetKernelVirtAddrForPhysAddr(&pml4) != &GetKernelPML4()) {
+      // The shared page of Clock is not owned by the process.
+      if (pml4.GetEntryForAddr(Clock::kSharedPageUserAddr).IsPresent())
+        RemovePageMapping(pml4, Clock::kSharedPageUserAddr, kPageSize);
+      FreePageTable(GetCPULocalPageCache(), pml4);
+    }
+    FreeKernelStack(ctx);
+    kfree(&ctx);
+  }
+  fpu_state_cache_.Free(proc.fpu_state_);
+  process_cache_.Free(&proc);
+}
+
 static void PrepareContextForRestoringPersistentProcess(ExecutionContext& ctx) {
   SetKernelPageEntries(ctx.GetCR3());
   ctx.SetKernelRSP(liumos->kernel_heap_allocator->AllocPages<uint64_t>(
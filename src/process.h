@@ -1,8 +1,12 @@
 #pragma once
 
 #include "execution_context.h"
+#include "file.h"
+#include "fpu.h"
 #include "generic.h"
 #include "kernel_virtual_heap_allocator.h"
+#include "processor.h"
+#include "wait_queue.h"
 
 class Process {
  public:
@@ -11,9 +15,14 @@ class Process {
     kNotScheduled,
     kSleeping,
     kRunning,
-    kStopping,
+    kBlocked,
     kStopped,
   };
+  // Smaller value means higher priority.
+  static constexpr int kNumOfPriorities = 32;
+  static constexpr int kHighestPriority = 0;
+  static constexpr int kLowestPriority = kNumOfPriorities - 1;
+  static constexpr int kDefaultPriority = kNumOfPriorities / 2;
   bool IsPersistent() {
     if (ctx_) {
       assert(!pp_info_);
@@ -28,6 +37,7 @@ class Process {
     scheduler_index_ = scheduler_index;
   };
   Status GetStatus() const { return status_; };
+  int GetPriority() const { return priority_; }
   void SetStatus(Status status) { status_ = status; }
   void Kill();
   void WaitUntilExit();
@@ -53,23 +63,44 @@ class Process {
   uint64_t GetProcTimeFemtoSec() { return proc_time_femto_sec_; }
   void ResetProcTimeFemtoSec() { proc_time_femto_sec_ = 0; }
   void AddProcTimeFemtoSec(uint64_t fs) { proc_time_femto_sec_ += fs; }
+  uint64_t GetProcTimeFemtoSecOnCPU(int cpu_index) {
+    return proc_time_femto_sec_on_cpu_[cpu_index];
+  }
   uint64_t GetSysTimeFemtoSec() { return sys_time_femto_sec_; }
   void ResetSysTime() { sys_time_femto_sec_ = 0; }
   void AddSysTimeFemtoSec(uint64_t fs) { sys_time_femto_sec_ += fs; }
   void AddTimeConsumedInContextSavingFemtoSec(uint64_t fs) {
     time_consumed_in_ctx_save_femto_sec_ += fs;
   }
+  FileDescriptorTable& GetFileDescriptorTable() { return fd_table_; }
   void PrintStatistics();
+  friend class FPU;
   friend class ProcessController;
+  friend class Scheduler;
+  friend class TLB;
 
  private:
   Process(uint64_t id)
       : id_(id),
         status_(Status::kNotInitialized),
+        priority_(kDefaultPriority),
+        queue_prev_(nullptr),
+        queue_next_(nullptr),
+        wait_queue_(nullptr),
+        is_on_cpu_(false),
+        should_stop_(false),
+        last_cpu_(0),
+        run_queue_cpu_(0),
+        run_queue_priority_(0),
+        fpu_state_(nullptr),
+        has_fpu_state_(false),
+        num_of_fpu_restores_(0),
+        pcid_(0),
         ctx_(nullptr),
         pp_info_(nullptr),
         number_of_ctx_switch_(0),
         proc_time_femto_sec_(0),
+        proc_time_femto_sec_on_cpu_{},
         sys_time_femto_sec_(0),
         copied_bytes_in_ctx_sw_(0),
         num_of_clflush_issued_in_ctx_sw_(0),
@@ -77,10 +108,35 @@ class Process {
   uint64_t id_;
   volatile Status status_;
   int scheduler_index_;
+  int priority_;
+  // Links in a run queue while kSleeping, or in wait_queue_ while kBlocked
+  Process* queue_prev_;
+  Process* queue_next_;
+  WaitQueue* wait_queue_;
+  WaitQueue exit_wait_queue_;
+  // True from being picked by a processor until its context is saved after
+  // switching to another process. Other processors do not resume it then.
+  bool is_on_cpu_;
+  // Set by Kill() while running. Stopped on the next switch.
+  bool should_stop_;
+  // Index of the processor which ran this process last
+  int last_cpu_;
+  // Where this process is queued while kSleeping
+  int run_queue_cpu_;
+  int run_queue_priority_;
+  // Save area of FPU registers, managed by FPU
+  void* fpu_state_;
+  // False until fpu_state_ is initialized
+  bool has_fpu_state_;
+  uint64_t num_of_fpu_restores_;
+  // Assigned by TLB while registered to the scheduler
+  uint16_t pcid_;
   ExecutionContext* ctx_;
   PersistentProcessInfo* pp_info_;
+  FileDescriptorTable fd_table_;
   uint64_t number_of_ctx_switch_;
   uint64_t proc_time_femto_sec_;
+  uint64_t proc_time_femto_sec_on_cpu_[Processor::kMaxNumOfProcessors];
   uint64_t sys_time_femto_sec_;
   uint64_t copied_bytes_in_ctx_sw_;
   uint64_t num_of_clflush_issued_in_ctx_sw_;
@@ -89,12 +145,23 @@ class Process {
 
 class ProcessController {
  public:
-  ProcessController(KernelVirtualHeapAllocator& kernel_heap_allocator)
-      : last_id_(0), kernel_heap_allocator_(kernel_heap_allocator){};
+  ProcessController(KernelVirtualHeapAllocator& kernel_heap_allocator,
+                    uint32_t fpu_state_size)
+      : last_id_(0), kernel_heap_allocator_(kernel_heap_allocator) {
+    process_cache_.Init(kernel_heap_allocator, "Process", sizeof(Process),
+                        alignof(Process));
+    fpu_state_cache_.Init(kernel_heap_allocator, "FPUState", fpu_state_size,
+                          FPU::kStateAlign);
+  }
   Process& Create();
   Process& RestoreFromPersistentProcessInfo(PersistentProcessInfo& pp_info);
+  void Destroy(Process& proc);
 
  private:
+  void FreeKernelStack(ExecutionContext& ctx);
+
   uint64_t last_id_;
   KernelVirtualHeapAllocator& kernel_heap_allocator_;
+  SlabCache<KernelVirtualHeapAllocator> process_cache_;
+  SlabCache<KernelVirtualHeapAllocator> fpu_state_cache_;
 };
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "apic.h"
+#include "gdt.h"
+
+class Process;
+
+class Processor {
+  // Per-processor state. Each processor loads the GDT embedded in its
+  // Processor, so the current processor is found from GDTR without any
+  // special register.
+ public:
+  static constexpr int kMaxNumOfProcessors = 16;
+
+  void Init(int index,
+            uint64_t kernel_stack_pointer,
+            uint64_t exception_stack_pointer,
+            uint64_t interrupt_stack_pointer);
+  // Loads the GDT and TSS of this processor. Should be called on it.
+  void LoadGDT();
+  // Looks up SRAT with the ID of the local APIC, which should be
+  // initialized.
+  void InitProximityDomain();
+  int GetIndex() const { return index_; }
+  bool IsBSP() const { return index_ == 0; }
+  uint32_t GetProximityDomain() const { return proximity_domain_; }
+  GDT& GetGDT() { return gdt_; }
+  LocalAPIC& GetLocalAPIC() { return local_apic_; }
+  friend class FPU;
+  friend class Scheduler;
+
+ private:
+  GDT gdt_;
+  LocalAPIC local_apic_;
+  int index_;
+  uint32_t proximity_domain_;
+  uint64_t kernel_stack_pointer_;
+  uint64_t exception_stack_pointer_;
+  uint64_t interrupt_stack_pointer_;
+  // Managed by the Scheduler
+  Process* current_process_;
+  Process* idle_process_;
+  // Process running in the current time slice, which ends at
+  // slice_end_count_ in Clock count
+  Process* slice_process_;
+  uint64_t slice_end_count_;
+  // Clock count when current_process_ started to run
+  uint64_t running_since_count_;
+};
+
+// @smp.cc
+Processor& GetCurrentProcessor();
+Processor& GetProcessor(int index);
+int GetNumOfProcessors();
+void CalibrateLocalAPICTimer(LocalAPIC& local_apic);
+// The local APIC timer is one-shot. It uses the TSC-deadline mode if
+// available.
+void InitLocalTimer(LocalAPIC& local_apic);
+// Raises a timer interrupt on the current processor after ns.
+void ArmLocalTimer(LocalAPIC& local_apic, uint64_t ns);
+void DisarmLocalTimer(LocalAPIC& local_apic);
+// Raises a timer interrupt on cpu.
+void KickProcessor(Processor& cpu);
+void StartApplicationProcessors();
@@ -98,6 +98,7 @@ void PS2MouseController::IntHandler(uint64_t, InterruptInfo*) {
       me.dx = static_cast<int8_t>(data[1]);
       me.dy = -static_cast<int8_t>(data[2]);
       buffer.Push(me);
+      buffer_wait_queue.WakeUpAll();
       phase_ = kWaitingFirstByte;
     } break;
     default:
@@ -149,10 +150,8 @@ void MouseManager() {
   int mx = 50, my = 50;
   DrawMouseCursor(mx, my);
   for (;;) {
-    if (mctrl.buffer.IsEmpty()) {
-      Sleep();
-      continue;
-    }
+    mctrl.buffer_wait_queue.WaitUntil(
+        [&mctrl] { return !mctrl.buffer.IsEmpty(); });
     auto me = mctrl.buffer.Pop();
     MoveMouseCursor(mx, my, me.dx, me.dy);
   }
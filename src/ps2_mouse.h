@@ -23,6 +23,7 @@ class PS2MouseController {
 
   static constexpr int kBufferSize = 32;
   RingBuffer<MouseEvent, kBufferSize> buffer;
+  WaitQueue buffer_wait_queue;
 
  private:
   static PS2MouseController* mouse_ctrl_;
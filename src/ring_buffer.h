@@ -18,6 +18,7 @@ class RingBuffer {
     writep_ = nextp;
   }
   bool IsEmpty() { return readp_ == writep_; }
+  bool IsFull() { return (writep_ + 1) % n == static_cast<unsigned>(readp_); }
   int GetReaderIndex() { return readp_; }
   int GetWriterIndex() { return writep_; }
 
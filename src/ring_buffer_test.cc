@@ -13,7 +13,9 @@ int main() {
   rbuf.Push(3);
   assert(!rbuf.IsEmpty());
   rbuf.Push(5);
+  assert(!rbuf.IsFull());
   rbuf.Push(7);
+  assert(rbuf.IsFull());
   rbuf.Push(11);
   rbuf.Push(13);
   assert(rbuf.Pop() == 3);
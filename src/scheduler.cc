@@ -1,45 +1,614 @@
 #include "scheduler.h"
 
 #include "liumos.h"
+#include "tlb.h"
 
-void Scheduler::RegisterProcess(Process& proc) {
+void Scheduler::PushToQueue(Process*& head, Process*& tail, Process& proc) {
+  proc.queue_prev_ = tail;
+  proc.queue_next_ = nullptr;
+  if (tail)
+    tail->queue_next_ = &proc;
+  else
+    head = &proc;
+  tail = &proc;
+}
+
+void Scheduler::RemoveFromQueue(Process*& head,
+                                Process*& tail,
+                                Process& proc) {
+  if (proc.queue_prev_)
+    proc.queue_prev_->queue_next_ = proc.queue_next_;
+  else
+    head = proc.queue_next_;
+  if (proc.queue_next_)
+    proc.queue_next_->queue_prev_ = proc.queue_prev_;
+  else
+    tail = proc.queue_prev_;
+  proc.queue_prev_ = nullptr;
+  proc.queue_next_ = nullptr;
+}
+
+Scheduler::ProcessorRunQueues& Scheduler::LockRunQueues(int cpu_index) {
+  ProcessorRunQueues& rq = run_queues_[cpu_index];
+  if (!rq.lock.TryLock()) {
+    rq.lock.Lock();
+    rq.num_of_contended_locks++;
+  }
+  return rq;
+}
+
+void Scheduler::PushToRunQueue(int cpu_index, Process& proc) {
+  ProcessorRunQueues& rq = run_queues_[cpu_index];
+  assert(rq.lock.IsLocked());
+  // priority_ may be changed by SetPriority() while proc is not in a queue,
+  // so the priority used here is kept for RemoveFromRunQueue().
+  const int priority = proc.priority_;
+  RunQueue& q = rq.queues[priority];
+  PushToQueue(q.head, q.tail, proc);
+  rq.ready_bitmap |= 1U << priority;
+  proc.run_queue_priority_ = priority;
+  proc.run_queue_cpu_ = cpu_index;
+  proc.SetStatus(Process::Status::kSleeping);
+  if (cpu_index == GetCurrentProcessor().GetIndex())
+    return;
+  rq.num_of_remote_pushes++;
+  // An idle processor may have disarmed its timer, so it is kicked to pick
+  // proc. ArmTimer() covers the processors which become idle meanwhile.
+  Processor& cpu = GetProcessor(cpu_index);
+  if (__atomic_load_n(&cpu.current_process_, __ATOMIC_RELAXED) ==
+      cpu.idle_process_) {
+    rq.num_of_kicks++;
+    KickProcessor(cpu);
+  }
+}
+
+void Scheduler::RemoveFromRunQueue(Process& proc) {
+  ProcessorRunQueues& rq = run_queues_[proc.run_queue_cpu_];
+  assert(rq.lock.IsLocked());
+  RunQueue& q = rq.queues[proc.run_queue_priority_];
+  RemoveFromQueue(q.head, q.tail, proc);
+  if (!q.head)
+    rq.ready_bitmap &= ~(1U << proc.run_queue_priority_);
+}
+
+bool Scheduler::TakeFromRunQueue(Process& proc, Process::Status status) {
+  const int cpu_index = __atomic_load_n(&proc.run_queue_cpu_, __ATOMIC_ACQUIRE);
+  LockRunQueues(cpu_index);
+  // proc may be picked and pushed to another queue before taking the lock.
+  const bool is_taken = proc.GetStatus() == Process::Status::kSleeping &&
+                        proc.run_queue_cpu_ == cpu_index;
+  if (is_taken) {
+    RemoveFromRunQueue(proc);
+    proc.SetStatus(status);
+  }
+  UnlockRunQueues(cpu_index);
+  return is_taken;
+}
+
+void Scheduler::RemoveFromWaitQueue(Process& proc) {
+  RemoveFromQueue(proc.wait_queue_->head_, proc.wait_queue_->tail_, proc);
+  proc.wait_queue_ = nullptr;
+}
+
+bool Scheduler::CanRunOn(Process& proc, Processor& cpu) {
+  if (proc.is_on_cpu_)
+    return false;
+  if (cpu.IsBSP())
+    return true;
+  // Only processes in user mode can run on APs.
+  return proc.GetExecutionContext().GetCPUContext().int_ctx.cs & 3;
+}
+
+Process* Scheduler::PickNextProcess(Processor& cpu,
+                                    ProcessorRunQueues& rq,
+                                    int lowest_priority) {
+  // Picks the best process which can run on cpu. A process which ran on cpu
+  // last is preferred to reuse its caches, but only a few processes at the
+  // head are looked at to bound the cost of a switch.
+  constexpr int kMaxNumOfProcessesToScanForAffinity = 4;
+  uint32_t bitmap = rq.ready_bitmap & ((2U << lowest_priority) - 1);
+  while (bitmap) {
+    const int priority = __builtin_ctz(bitmap);
+    Process* found = nullptr;
+    int num_of_scanned = 0;
+    for (Process* proc = rq.queues[priority].head; proc;
+         proc = proc->queue_next_) {
+      if (!CanRunOn(*proc, cpu))
+        continue;
+      if (proc->last_cpu_ == cpu.GetIndex())
+        return proc;
+      if (!found)
+        found = proc;
+      if (++num_of_scanned >= kMaxNumOfProcessesToScanForAffinity)
+        break;
+    }
+    if (found)
+      return found;
+    bitmap &= bitmap - 1;
+  }
+  return nullptr;
+}
+
+Process* Scheduler::StealProcess(Processor& cpu) {
+  // Looks at the processors in the same proximity domain first. Victims
+  // whose queues are locked are skipped rather than waited for, so an idle
+  // processor does not slow down busy ones.
+  ProcessorRunQueues& own = run_queues_[cpu.GetIndex()];
+  const int num_of_processors = GetNumOfProcessors();
+  for (int pass = 0; pass < 2; pass++) {
+    const bool wants_same_domain = pass == 0;
+    for (int i = 1; i < num_of_processors; i++) {
+      Processor& victim =
+          GetProcessor((cpu.GetIndex() + i) % num_of_processors);
+      const bool is_same_domain =
+          victim.GetProximityDomain() == cpu.GetProximityDomain();
+      if (is_same_domain != wants_same_domain)
+        continue;
+      ProcessorRunQueues& rq = run_queues_[victim.GetIndex()];
+      if (!__atomic_load_n(&rq.ready_bitmap, __ATOMIC_RELAXED))
+        continue;
+      if (!rq.lock.TryLock()) {
+        own.num_of_failed_steals++;
+        continue;
+      }
+      Process* proc = PickNextProcess(cpu, rq, Process::kLowestPriority);
+      if (proc) {
+        RemoveFromRunQueue(*proc);
+        proc->SetStatus(Process::Status::kRunning);
+      }
+      rq.lock.Unlock();
+      if (proc) {
+        own.num_of_steals++;
+        return proc;
+      }
+    }
+  }
+  return nullptr;
+}
+
+void Scheduler::AccountRunningTime(Processor& cpu, Process& proc) {
+  const uint64_t now = Clock::ReadCount();
+  const uint64_t fs = Clock::CountToFemtoSecond(now - cpu.running_since_count_);
+  cpu.running_since_count_ = now;
+  proc.AddProcTimeFemtoSec(fs);
+  proc.proc_time_femto_sec_on_cpu_[cpu.GetIndex()] += fs;
+}
+
+void Scheduler::StopProcess(Process& proc) {
+  // Called with lock_ held, after proc is taken out of any queue.
+  proc.SetStatus(Process::Status::kStopped);
+  WakeUpAllLocked(proc.exit_wait_queue_);
+}
+
+void Scheduler::StopCurrentProcess(Process& current) {
+  // Called on the switch after Kill() is requested for the current process.
   using Status = Process::Status;
+  lock_.Lock();
+  switch (current.GetStatus()) {
+    case Status::kBlocked:
+      RemoveFromWaitQueue(current);
+      StopProcess(current);
+      break;
+    case Status::kSleeping:
+      // Woken up before switching out. It is not picked by others while it
+      // is on this processor, so only Kill() can take it.
+      if (TakeFromRunQueue(current, Status::kStopped))
+        WakeUpAllLocked(current.exit_wait_queue_);
+      break;
+    case Status::kRunning:
+      StopProcess(current);
+      break;
+    default:
+      break;
+  }
+  lock_.Unlock();
+}
+
+void Scheduler::AddToProcessTable(Process& proc) {
   assert(number_of_process_ < kNumberOfProcess);
-  assert(proc.GetStatus() == Process::Status::kNotScheduled);
   process_[number_of_process_] = &proc;
   proc.SetSchedulerIndex(number_of_process_);
   number_of_process_++;
+  TLB::AssignPCID(proc);
+}
 
-  proc.SetStatus(Status::kSleeping);
+void Scheduler::RegisterProcess(Process& proc) {
+  assert(proc.GetStatus() == Process::Status::kNotScheduled);
+  const bool was_enabled = DisableInterrupts();
+  lock_.Lock();
+  AddToProcessTable(proc);
+  // New processes start on the BSP, and idle APs steal the ones in user
+  // mode.
+  LockRunQueues(0);
+  PushToRunQueue(0, proc);
+  UnlockRunQueues(0);
+  lock_.Unlock();
+  RestoreInterrupts(was_enabled);
+}
+
+void Scheduler::RegisterIdleProcess(Process& proc) {
+  using Status = Process::Status;
+  assert(proc.GetStatus() == Process::Status::kNotScheduled);
+  const bool was_enabled = DisableInterrupts();
+  Processor& cpu = GetCurrentProcessor();
+  lock_.Lock();
+  AddToProcessTable(proc);
+  proc.priority_ = Process::kLowestPriority;
+  proc.last_cpu_ = cpu.GetIndex();
+  cpu.idle_process_ = &proc;
+  if (cpu.current_process_) {
+    proc.SetStatus(Status::kSleeping);
+  } else {
+    proc.SetStatus(Status::kRunning);
+    proc.is_on_cpu_ = true;
+    cpu.current_process_ = &proc;
+    cpu.running_since_count_ = Clock::ReadCount();
+  }
+  lock_.Unlock();
+  RestoreInterrupts(was_enabled);
+}
+
+void Scheduler::UnregisterProcess(Process& proc) {
+  assert(proc.GetStatus() == Process::Status::kStopped);
+  assert(&proc != &GetCurrentProcess());
+  // Wait until the processor which ran proc stops using its context.
+  while (__atomic_load_n(&proc.is_on_cpu_, __ATOMIC_ACQUIRE))
+    __builtin_ia32_pause();
+  const bool was_enabled = DisableInterrupts();
+  lock_.Lock();
+  const int idx = proc.GetSchedulerIndex();
+  assert(0 <= idx && idx < number_of_process_ && process_[idx] == &proc);
+  // A stopped process is not in the run queues, so only process_ is updated.
+  const int last_idx = number_of_process_ - 1;
+  process_[idx] = process_[last_idx];
+  process_[idx]->SetSchedulerIndex(idx);
+  process_[last_idx] = nullptr;
+  number_of_process_ = last_idx;
+  TLB::ReleasePCID(proc);
+  lock_.Unlock();
+  RestoreInterrupts(was_enabled);
 }
 
 uint64_t Scheduler::LaunchAndWaitUntilExit(Process& proc) {
   RegisterProcess(proc);
   proc.WaitUntilExit();
   proc.PrintStatistics();
+  liumos->proc_ctrl->Destroy(proc);
   return 0;
 }
 
-Process* Scheduler::SwitchProcess() {
+Process* Scheduler::SwitchProcess(bool should_yield) {
+  // Called from interrupt handlers with interrupts disabled.
   using Status = Process::Status;
-  const int base_index = current_->GetSchedulerIndex();
-  for (int i = 1; i < number_of_process_; i++) {
-    Process* proc = process_[(base_index + i) % number_of_process_];
-    if (!proc)
-      continue;
-    if (proc->GetStatus() == Status::kSleeping) {
-      if (current_->GetStatus() == Status::kRunning)
-        current_->SetStatus(Status::kSleeping);
-      else if (current_->GetStatus() == Status::kStopping)
-        current_->SetStatus(Status::kStopped);
-      proc->SetStatus(Status::kRunning);
-      current_ = proc;
-      return proc;
+  Processor& cpu = GetCurrentProcessor();
+  Process& current = *cpu.current_process_;
+  if (__atomic_load_n(&current.should_stop_, __ATOMIC_ACQUIRE))
+    StopCurrentProcess(current);
+  if (current.GetStatus() == Status::kSleeping) {
+    // Woken up by another processor before switching out
+    TakeFromRunQueue(current, Status::kRunning);
+  }
+  const bool is_running = current.GetStatus() == Status::kRunning;
+  const bool is_idle = &current == cpu.idle_process_;
+  // Processes in kernel mode yield on APs only to move to the BSP.
+  const bool can_keep_running =
+      is_running && (cpu.IsBSP() || !should_yield || is_idle);
+  const int lowest_priority = !should_yield && can_keep_running
+                                  ? current.GetPriority()
+                                  : Process::kLowestPriority;
+  ProcessorRunQueues& rq = LockRunQueues(cpu.GetIndex());
+  Process* proc = PickNextProcess(cpu, rq, lowest_priority);
+  if (proc) {
+    RemoveFromRunQueue(*proc);
+    proc->SetStatus(Status::kRunning);
+  }
+  UnlockRunQueues(cpu.GetIndex());
+  if (!proc && (!can_keep_running || is_idle))
+    proc = StealProcess(cpu);
+  if (!proc) {
+    if (can_keep_running)
+      return nullptr;
+    proc = cpu.idle_process_;
+    if (!proc || proc == &current)
+      Panic("No process to run");
+    proc->SetStatus(Status::kRunning);
+  }
+  if (is_running) {
+    if (is_idle) {
+      current.SetStatus(Status::kSleeping);
+    } else {
+      // A process yielding on an AP is in kernel mode, so it goes to the BSP.
+      const int cpu_index = cpu.IsBSP() || !should_yield ? cpu.GetIndex() : 0;
+      LockRunQueues(cpu_index);
+      PushToRunQueue(cpu_index, current);
+      UnlockRunQueues(cpu_index);
     }
   }
-  return nullptr;
+  AccountRunningTime(cpu, current);
+  rq.num_of_switches++;
+  proc->is_on_cpu_ = true;
+  proc->last_cpu_ = cpu.GetIndex();
+  cpu.current_process_ = proc;
+  return proc;
+}
+
+void Scheduler::FinishSwitch(Process& prev) {
+  __atomic_store_n(&prev.is_on_cpu_, false, __ATOMIC_RELEASE);
+}
+
+void Scheduler::SetPriority(Process& proc, int priority) {
+  assert(Process::kHighestPriority <= priority &&
+         priority <= Process::kLowestPriority);
+  const bool was_enabled = DisableInterrupts();
+  lock_.Lock();
+  proc.priority_ = priority;
+  if (proc.GetStatus() == Process::Status::kSleeping) {
+    // Moves proc to the queue for the new priority. proc may be picked by a
+    // processor meanwhile, which is fine since it is pushed with the new
+    // priority next time.
+    const int cpu_index =
+        __atomic_load_n(&proc.run_queue_cpu_, __ATOMIC_ACQUIRE);
+    LockRunQueues(cpu_index);
+    if (proc.GetStatus() == Process::Status::kSleeping &&
+        proc.run_queue_cpu_ == cpu_index) {
+      RemoveFromRunQueue(proc);
+      PushToRunQueue(cpu_index, proc);
+    }
+    UnlockRunQueues(cpu_index);
+  }
+  lock_.Unlock();
+  RestoreInterrupts(was_enabled);
+}
+
+void Scheduler::Kill(Process& proc) {
+  using Status = Process::Status;
+  const bool was_enabled = DisableInterrupts();
+  lock_.Lock();
+  for (;;) {
+    const Status status = proc.GetStatus();
+    if (status == Status::kNotInitialized ||
+        status == Status::kNotScheduled) {
+      PutString("Tried to stop the process not running");
+    } else if (status == Status::kBlocked) {
+      RemoveFromWaitQueue(proc);
+      StopProcess(proc);
+    } else if (status == Status::kRunning) {
+      // The processor running proc stops it on the next switch.
+      __atomic_store_n(&proc.should_stop_, true, __ATOMIC_RELEASE);
+    } else if (status == Status::kSleeping) {
+      // Retry if proc is picked by a processor meanwhile.
+      if (!TakeFromRunQueue(proc, Status::kStopped))
+        continue;
+      WakeUpAllLocked(proc.exit_wait_queue_);
+    }
+    break;
+  }
+  lock_.Unlock();
+  RestoreInterrupts(was_enabled);
 }
 
 void Scheduler::KillCurrentProcess() {
-  current_->Kill();
+  Kill(GetCurrentProcess());
+}
+
+void Scheduler::PrepareToWait(WaitQueue& wq) {
+  Process& current = GetCurrentProcess();
+  lock_.Lock();
+  assert(current.GetStatus() == Process::Status::kRunning);
+  current.SetStatus(Process::Status::kBlocked);
+  current.wait_queue_ = &wq;
+  PushToQueue(wq.head_, wq.tail_, current);
+  lock_.Unlock();
+}
+
+void Scheduler::CancelWait() {
+  using Status = Process::Status;
+  Process& current = GetCurrentProcess();
+  lock_.Lock();
+  if (current.GetStatus() == Status::kBlocked) {
+    RemoveFromWaitQueue(current);
+    current.SetStatus(Status::kRunning);
+  } else if (current.GetStatus() == Status::kSleeping) {
+    // Already woken up
+    TakeFromRunQueue(current, Status::kRunning);
+  }
+  lock_.Unlock();
+}
+
+void Scheduler::WakeUpAllLocked(WaitQueue& wq) {
+  // Blocked processes wait in kernel mode, so they are resumed on the BSP.
+  if (!wq.head_)
+    return;
+  LockRunQueues(0);
+  while (Process* proc = wq.head_) {
+    RemoveFromWaitQueue(*proc);
+    PushToRunQueue(0, *proc);
+  }
+  UnlockRunQueues(0);
+}
+
+void Scheduler::WakeUpAll(WaitQueue& wq) {
+  const bool was_enabled = DisableInterrupts();
+  lock_.Lock();
+  WakeUpAllLocked(wq);
+  lock_.Unlock();
+  RestoreInterrupts(was_enabled);
+}
+
+bool Scheduler::OnTimerInterrupt(Processor& cpu) {
+  run_queues_[cpu.GetIndex()].num_of_timer_interrupts++;
+  if (!cpu.IsBSP())
+    return false;
+  timers_lock_.Lock();
+  timers_.Advance(GetTimerWheelTick());
+  timers_lock_.Unlock();
+  const uint64_t now = Clock::ReadCount();
+  if (now < next_tick_count_)
+    return false;
+  next_tick_count_ = now + tick_interval_count_;
+  tick_count_++;
+  WakeUpAll(tick_wait_queue_);
+  return true;
+}
+
+uint64_t Scheduler::GetNextTimerCount() {
+  timers_lock_.Lock();
+  const uint64_t tick = timers_.GetNextEvent();
+  timers_lock_.Unlock();
+  if (tick == TimerWheel::kNoEvent)
+    return kNoDeadline;
+  // Rounded up, so the wheel has reached tick on the interrupt.
+  return Clock::NanoSecondToCount(tick * 1000) + 1;
+}
+
+void Scheduler::ArmTimer(bool needs_tick) {
+  Processor& cpu = GetCurrentProcessor();
+  const uint64_t now = Clock::ReadCount();
+  uint64_t deadline = kNoDeadline;
+  Process* current = cpu.current_process_;
+  if (current == cpu.idle_process_) {
+    cpu.slice_process_ = nullptr;
+    // Processes pushed by others before current_process_ was updated were
+    // not kicked. The lock orders this check against PushToRunQueue().
+    ProcessorRunQueues& rq = LockRunQueues(cpu.GetIndex());
+    const bool has_ready =
+        PickNextProcess(cpu, rq, Process::kLowestPriority) != nullptr;
+    UnlockRunQueues(cpu.GetIndex());
+    if (has_ready)
+      deadline = now;
+  } else {
+    // A new slice starts when the process changes or the slice ends.
+    if (cpu.slice_process_ != current || cpu.slice_end_count_ <= now) {
+      cpu.slice_process_ = current;
+      cpu.slice_end_count_ = now + liumos->time_slice_count;
+    }
+    deadline = cpu.slice_end_count_;
+  }
+  if (cpu.IsBSP()) {
+    if ((needs_tick || !tick_wait_queue_.IsEmpty()) &&
+        next_tick_count_ < deadline)
+      deadline = next_tick_count_;
+    const uint64_t timer_count = GetNextTimerCount();
+    if (timer_count < deadline)
+      deadline = timer_count;
+  }
+  KickIdleProcessor(cpu);
+  if (deadline == kNoDeadline) {
+    DisarmLocalTimer(cpu.GetLocalAPIC());
+    return;
+  }
+  const uint64_t count = deadline > now ? deadline - now : 0;
+  ArmLocalTimer(cpu.GetLocalAPIC(), Clock::CountToNanoSecond(count));
+}
+
+void Scheduler::KickIdleProcessor(Processor& cpu) {
+  ProcessorRunQueues& rq = run_queues_[cpu.GetIndex()];
+  if (!__atomic_load_n(&rq.ready_bitmap, __ATOMIC_RELAXED))
+    return;
+  const int num_of_processors = GetNumOfProcessors();
+  for (int i = 1; i < num_of_processors; i++) {
+    Processor& idle =
+        GetProcessor((cpu.GetIndex() + i) % num_of_processors);
+    if (__atomic_load_n(&idle.current_process_, __ATOMIC_RELAXED) !=
+        idle.idle_process_)
+      continue;
+    if (!rq.lock.TryLock())
+      return;
+    const bool can_steal =
+        PickNextProcess(idle, rq, Process::kLowestPriority) != nullptr;
+    rq.lock.Unlock();
+    if (!can_steal)
+      continue;
+    rq.num_of_kicks++;
+    KickProcessor(idle);
+    return;
+  }
+}
+
+void Scheduler::WaitForNextTick() {
+  const uint64_t tick_count = tick_count_;
+  tick_wait_queue_.WaitUntil([&] { return tick_count_ != tick_count; });
+}
+
+void Scheduler::AddTimer(TimerWheel::Timer& timer, uint64_t ns) {
+  const bool was_enabled = timers_lock_.LockIRQSave();
+  const uint64_t expires = GetTimerWheelTick() + (ns + 999) / 1000;
+  timers_.Add(timer, expires);
+  const bool is_earliest = timers_.GetNextEvent() >= timer.GetExpiry();
+  timers_lock_.UnlockIRQRestore(was_enabled);
+  // The timer of the BSP is armed only on switches.
+  if (is_earliest)
+    KickProcessor(GetProcessor(0));
+}
+
+bool Scheduler::CancelTimer(TimerWheel::Timer& timer) {
+  // Waits for the callback, which runs with timers_lock_ held.
+  const bool was_enabled = timers_lock_.LockIRQSave();
+  const bool was_pending = timers_.Cancel(timer);
+  timers_lock_.UnlockIRQRestore(was_enabled);
+  return was_pending;
+}
+
+void Scheduler::SleepFor(uint64_t ns) {
+  struct Sleeper {
+    WaitQueue wait_queue;
+    bool has_expired;
+  } sleeper{WaitQueue(), false};
+  TimerWheel::Timer timer(
+      [](void* arg) {
+        Sleeper& sleeper = *reinterpret_cast<Sleeper*>(arg);
+        __atomic_store_n(&sleeper.has_expired, true, __ATOMIC_RELEASE);
+        sleeper.wait_queue.WakeUpAll();
+      },
+      &sleeper);
+  AddTimer(timer, ns);
+  sleeper.wait_queue.WaitUntil([&sleeper] {
+    return __atomic_load_n(&sleeper.has_expired, __ATOMIC_ACQUIRE);
+  });
+  // sleeper is on the stack, so the callback should have returned.
+  CancelTimer(timer);
+}
+
+void Scheduler::MigrateCurrentProcessToBSP() {
+  // A yield on an AP puts the process back to the run queue with its
+  // context in kernel mode, which only the BSP resumes.
+  while (!GetCurrentProcessor().IsBSP())
+    Sleep();
+}
+
+void Scheduler::PrintStatistics() {
+  PutString(
+      "cpu, switches, steals, failed steals, remote pushes, contended "
+      "locks, timer interrupts, kicks\n");
+  for (int i = 0; i < GetNumOfProcessors(); i++) {
+    ProcessorRunQueues& rq = run_queues_[i];
+    PutDecimal64(i);
+    PutString(", ");
+    PutDecimal64(rq.num_of_switches);
+    PutString(", ");
+    PutDecimal64(rq.num_of_steals);
+    PutString(", ");
+    PutDecimal64(rq.num_of_failed_steals);
+    PutString(", ");
+    PutDecimal64(rq.num_of_remote_pushes);
+    PutString(", ");
+    PutDecimal64(rq.num_of_contended_locks);
+    PutString(", ");
+    PutDecimal64(rq.num_of_timer_interrupts);
+    PutString(", ");
+    PutDecimal64(rq.num_of_kicks);
+    PutString("\n");
+  }
+}
+
+void WaitQueue::PrepareToWait() {
+  liumos->scheduler->PrepareToWait(*this);
+}
+
+void WaitQueue::CancelWait() {
+  liumos->scheduler->CancelWait();
+}
+
+void WaitQueue::WakeUpAll() {
+  liumos->scheduler->WakeUpAll(*this);
 }
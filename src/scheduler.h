@@ -1,25 +1,183 @@
 #pragma once
+#include "clock.h"
 #include "process.h"
+#include "processor.h"
+#include "spinlock.h"
+#include "timer_wheel.h"
+#include "wait_queue.h"
 
 class Scheduler {
+  // Processes ready to run (kSleeping) are kept in per-processor run queues,
+  // with a FIFO for each priority. A bit in ready_bitmap is set when the
+  // queue for the priority is not empty, so the next process is picked in
+  // O(1). Processes in other states are not in any run queue. Blocked
+  // processes are in the WaitQueue they wait on.
+  // Each processor picks processes from its own queues, and steals from the
+  // queues of others only when it has nothing to run. Stealing prefers
+  // processors in the same proximity domain and processes which ran on the
+  // stealing processor last.
+  // lock_ protects the process table and the wait queues, and the lock of
+  // each run queue protects the processes in it. lock_ is taken before a
+  // run queue lock, and at most one run queue lock is held at a time.
+  // The kernel is not SMP safe yet, so processes in kernel mode are resumed
+  // only on the BSP. APs run processes preempted in user mode, and syscalls
+  // from them are served on the BSP.
  public:
   Scheduler(Process& root_process)
-      : number_of_process_(0), current_(&root_process) {
-    RegisterProcess(root_process);
+      : number_of_process_(0),
+        tick_count_(0),
+        next_tick_count_(0),
+        timers_(GetTimerWheelTick()) {
+    lock_.SetStats(lock_stats_);
+    timers_lock_.SetStats(timers_lock_stats_);
+    tick_interval_count_ = Clock::NanoSecondToCount(kTickIntervalMs *
+                                                    1'000'000);
+    for (auto& rq : run_queues_) {
+      rq.lock.SetStats(run_queue_lock_stats_);
+      rq.ready_bitmap = 0;
+      for (auto& q : rq.queues) {
+        q.head = nullptr;
+        q.tail = nullptr;
+      }
+      rq.num_of_switches = 0;
+      rq.num_of_steals = 0;
+      rq.num_of_failed_steals = 0;
+      rq.num_of_remote_pushes = 0;
+      rq.num_of_contended_locks = 0;
+      rq.num_of_timer_interrupts = 0;
+      rq.num_of_kicks = 0;
+    }
+    Processor& cpu = GetCurrentProcessor();
+    AddToProcessTable(root_process);
     root_process.SetStatus(Process::Status::kRunning);
+    root_process.is_on_cpu_ = true;
+    root_process.last_cpu_ = cpu.GetIndex();
+    cpu.current_process_ = &root_process;
+    cpu.running_since_count_ = Clock::ReadCount();
   }
   void RegisterProcess(Process& proc);
+  // Makes proc the idle process of the current processor. proc becomes the
+  // current process if the processor has not run any process yet.
+  void RegisterIdleProcess(Process& proc);
+  void UnregisterProcess(Process& proc);
   uint64_t LaunchAndWaitUntilExit(Process& proc);
-  Process* SwitchProcess();
+  // Returns the process to switch to, or nullptr to keep running the current
+  // one. A timer tick switches to a ready process with the same or higher
+  // priority, while a yield switches to the best ready process, if any.
+  Process* SwitchProcess(bool should_yield);
+  // Called after the context of prev is saved and the processor does not
+  // use its page table anymore. Other processors can resume prev after this.
+  void FinishSwitch(Process& prev);
   Process& GetCurrentProcess() {
-    assert(current_);
-    return *current_;
+    // Processes in kernel mode do not move to another processor, so the
+    // result is stable without disabling interrupts.
+    Process* proc = GetCurrentProcessor().current_process_;
+    assert(proc);
+    return *proc;
   }
+  void SetPriority(Process& proc, int priority);
+  void Kill(Process& proc);
   void KillCurrentProcess();
+  // Puts the current process into wq. Called with interrupts disabled,
+  // followed by Sleep() to switch to another process, or CancelWait() to
+  // keep running.
+  void PrepareToWait(WaitQueue& wq);
+  void CancelWait();
+  void WakeUpAll(WaitQueue& wq);
+  // Called on timer interrupts. Returns true on the BSP when a tick has
+  // passed.
+  bool OnTimerInterrupt(Processor& cpu);
+  // Arms the timer of the current processor for the end of the time slice,
+  // and on the BSP for the next tick if needs_tick or a process waits for
+  // it. Nothing is armed on idle processors, so they sleep until other
+  // interrupts. Called after switching with interrupts disabled.
+  void ArmTimer(bool needs_tick);
+  // For polling devices which do not raise interrupts. Ticks happen only
+  // while processes wait for them.
+  void WaitForNextTick();
+  // The callback of timer is called on the BSP with interrupts disabled
+  // after ns. It should not block.
+  void AddTimer(TimerWheel::Timer& timer, uint64_t ns);
+  // Returns false if timer has expired or was not added. The callback is
+  // not running on return.
+  bool CancelTimer(TimerWheel::Timer& timer);
+  // Blocks the current process for ns.
+  void SleepFor(uint64_t ns);
+  // Moves the current process to the BSP if it runs on an AP.
+  void MigrateCurrentProcessToBSP();
+  void PrintStatistics();
 
  private:
+  struct RunQueue {
+    Process* head;
+    Process* tail;
+  };
+  struct ProcessorRunQueues {
+    SpinLock lock;
+    RunQueue queues[Process::kNumOfPriorities];
+    uint32_t ready_bitmap;
+    // Statistics. The first three are updated only by the owner processor,
+    // and the others with lock held.
+    uint64_t num_of_switches;
+    uint64_t num_of_steals;
+    // Steals skipped since the queues of the victim were locked
+    uint64_t num_of_failed_steals;
+    // Processes pushed by other processors
+    uint64_t num_of_remote_pushes;
+    // Times lock was already held when taking it
+    uint64_t num_of_contended_locks;
+    uint64_t num_of_timer_interrupts;
+    // Idle processors woken to steal processes in the queues
+    uint64_t num_of_kicks;
+  };
+  static_assert(Process::kNumOfPriorities <= 32);
+
+  static void PushToQueue(Process*& head, Process*& tail, Process& proc);
+  static void RemoveFromQueue(Process*& head, Process*& tail, Process& proc);
+  static bool CanRunOn(Process& proc, Processor& cpu);
+  void AddToProcessTable(Process& proc);
+  ProcessorRunQueues& LockRunQueues(int cpu_index);
+  void UnlockRunQueues(int cpu_index) { run_queues_[cpu_index].lock.Unlock(); }
+  // Called with the lock of the run queues of cpu_index held.
+  void PushToRunQueue(int cpu_index, Process& proc);
+  void RemoveFromRunQueue(Process& proc);
+  // Removes proc in kSleeping from its run queue and sets status to it.
+  // Returns false if proc is not in the run queue anymore.
+  bool TakeFromRunQueue(Process& proc, Process::Status status);
+  // Called with lock_ held.
+  void RemoveFromWaitQueue(Process& proc);
+  Process* PickNextProcess(Processor& cpu,
+                           ProcessorRunQueues& rq,
+                           int lowest_priority);
+  Process* StealProcess(Processor& cpu);
+  void AccountRunningTime(Processor& cpu, Process& proc);
+  void StopProcess(Process& proc);
+  void StopCurrentProcess(Process& current);
+  // Wakes an idle processor which can steal a process from the queues of
+  // cpu.
+  void KickIdleProcessor(Processor& cpu);
+  void WakeUpAllLocked(WaitQueue& wq);
+  // The timer wheel ticks every microsecond.
+  static uint64_t GetTimerWheelTick() { return Clock::ReadNanoSecond() / 1000; }
+  // Returns the Clock count at which timers_ should advance.
+  uint64_t GetNextTimerCount();
+
   const static int kNumberOfProcess = 256;
+  static constexpr uint64_t kTickIntervalMs = 1;
+  static constexpr uint64_t kNoDeadline = ~0ULL;
+  TicketLock lock_;
+  inline static LockStats lock_stats_{"Scheduler"};
+  inline static LockStats run_queue_lock_stats_{"Scheduler run queue"};
   Process* process_[kNumberOfProcess];
   int number_of_process_;
-  Process* current_;
+  ProcessorRunQueues run_queues_[Processor::kMaxNumOfProcessors];
+  uint64_t tick_count_;
+  // In Clock count
+  uint64_t next_tick_count_;
+  uint64_t tick_interval_count_;
+  WaitQueue tick_wait_queue_;
+  // Advanced only on the BSP. Callbacks run with timers_lock_ held.
+  SpinLock timers_lock_;
+  inline static LockStats timers_lock_stats_{"Scheduler timers"};
+  TimerWheel timers_;
 };
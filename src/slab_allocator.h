@@ -0,0 +1,289 @@
+#pragma once
+
+#include "generic.h"
+
+template <class TPageAllocator>
+class SlabCache {
+  // Allocates objects of a fixed size out of single pages (slabs).
+  // Free objects of a slab are linked by indices kept in the slab header,
+  // so the contents of free objects are never overwritten. Thanks to this,
+  // a cache with a constructor constructs each object only once, when its
+  // slab is created, and hands out constructed objects after that.
+  // TPageAllocator should provide AllocPages<T>(n) and FreePages(T, n).
+ public:
+  using Constructor = void (*)(void* obj);
+  static constexpr uint64_t kMinAlign = 16;
+
+  void Init(TPageAllocator& page_allocator,
+            const char* name,
+            uint64_t object_size,
+            uint64_t align = kMinAlign,
+            Constructor ctor = nullptr) {
+    assert(object_size > 0);
+    assert(align && (align & (align - 1)) == 0 && align <= kPageSize);
+    if (align < kMinAlign)
+      align = kMinAlign;
+    page_allocator_ = &page_allocator;
+    name_ = name;
+    ctor_ = ctor;
+    object_size_ = RoundUp(object_size, align);
+    uint64_t n = (kPageSize - sizeof(Slab)) / (object_size_ + 1);
+    if (n > kMaxNumOfObjectsPerSlab)
+      n = kMaxNumOfObjectsPerSlab;
+    while (n &&
+           RoundUp(sizeof(Slab) + n, align) + n * object_size_ > kPageSize) {
+      n--;
+    }
+    if (!n)
+      Panic("Too large object for SlabCache");
+    num_of_objects_per_slab_ = static_cast<int>(n);
+    objects_offset_ = RoundUp(sizeof(Slab) + n, align);
+    partial_slabs_ = nullptr;
+    full_slabs_ = nullptr;
+    num_of_slabs_ = 0;
+    num_of_empty_slabs_ = 0;
+    num_of_used_objects_ = 0;
+  }
+  void* Alloc() {
+    Slab* slab = partial_slabs_;
+    if (!slab) {
+      slab = CreateSlab();
+      PushSlab(partial_slabs_, slab);
+    }
+    if (!slab->num_of_used)
+      num_of_empty_slabs_--;
+    const int idx = slab->free_head;
+    slab->free_head = GetNextFreeIndices(slab)[idx];
+    slab->num_of_used++;
+    if (slab->free_head == kEndOfFreeList) {
+      RemoveSlab(partial_slabs_, slab);
+      PushSlab(full_slabs_, slab);
+    }
+    num_of_used_objects_++;
+    return GetObject(slab, idx);
+  }
+  void Free(void* obj) {
+    Slab* slab = GetSlabOf(obj);
+    if (!slab || slab->cache != this)
+      Panic("SlabCache::Free: the object is not from this cache");
+    const uint64_t offset =
+        reinterpret_cast<uint64_t>(obj) - reinterpret_cast<uint64_t>(slab);
+    if (offset < objects_offset_ ||
+        (offset - objects_offset_) % object_size_ != 0)
+      Panic("SlabCache::Free: invalid object address");
+    const int idx = static_cast<int>((offset - objects_offset_) / object_size_);
+    assert(idx < num_of_objects_per_slab_);
+    assert(slab->num_of_used > 0);
+    if (slab->free_head == kEndOfFreeList) {
+      RemoveSlab(full_slabs_, slab);
+      PushSlab(partial_slabs_, slab);
+    }
+    GetNextFreeIndices(slab)[idx] = slab->free_head;
+    slab->free_head = static_cast<uint8_t>(idx);
+    slab->num_of_used--;
+    num_of_used_objects_--;
+    if (slab->num_of_used)
+      return;
+    if (num_of_empty_slabs_ < kMaxNumOfEmptySlabs) {
+      // Keep a few empty slabs to avoid bouncing pages
+      num_of_empty_slabs_++;
+      return;
+    }
+    RemoveSlab(partial_slabs_, slab);
+    DestroySlab(slab);
+  }
+  static SlabCache* GetCacheOf(void* obj) {
+    // Returns the cache which obj belongs to, or nullptr if obj is not in a
+    // slab.
+    Slab* slab = GetSlabOf(obj);
+    return slab ? slab->cache : nullptr;
+  }
+  const char* GetName() const { return name_; }
+  uint64_t GetObjectSize() const { return object_size_; }
+  int GetNumOfObjectsPerSlab() const { return num_of_objects_per_slab_; }
+  uint64_t GetNumOfSlabs() const { return num_of_slabs_; }
+  uint64_t GetNumOfUsedObjects() const { return num_of_used_objects_; }
+
+ private:
+  static constexpr uint64_t kSlabSignature = 0x42414C53534F4D55ULL;
+  static constexpr int kMaxNumOfObjectsPerSlab = 255;
+  static constexpr uint8_t kEndOfFreeList = 0xFF;
+  static constexpr int kMaxNumOfEmptySlabs = 1;
+
+  struct Slab {
+    // Placed at the beginning of each slab page, followed by the array of
+    // next free indices and then the objects.
+    uint64_t signature;
+    SlabCache* cache;
+    Slab* prev;
+    Slab* next;
+    int num_of_used;
+    uint8_t free_head;
+  };
+
+  static uint64_t RoundUp(uint64_t v, uint64_t align) {
+    return (v + align - 1) & ~(align - 1);
+  }
+  static Slab* GetSlabOf(void* obj) {
+    Slab* slab = reinterpret_cast<Slab*>(reinterpret_cast<uint64_t>(obj) &
+                                         ~kPageAddrMask);
+    return slab->signature == kSlabSignature ? slab : nullptr;
+  }
+  static uint8_t* GetNextFreeIndices(Slab* slab) {
+    return reinterpret_cast<uint8_t*>(slab + 1);
+  }
+  void* GetObject(Slab* slab, int idx) {
+    return reinterpret_cast<uint8_t*>(slab) + objects_offset_ +
+           object_size_ * idx;
+  }
+  static void PushSlab(Slab*& head, Slab* slab) {
+    slab->prev = nullptr;
+    slab->next = head;
+    if (head)
+      head->prev = slab;
+    head = slab;
+  }
+  static void RemoveSlab(Slab*& head, Slab* slab) {
+    if (slab->prev)
+      slab->prev->next = slab->next;
+    else
+      head = slab->next;
+    if (slab->next)
+      slab->next->prev = slab->prev;
+  }
+  Slab* CreateSlab() {
+    Slab* slab = page_allocator_->template AllocPages<Slab*>(1);
+    slab->signature = kSlabSignature;
+    slab->cache = this;
+    slab->num_of_used = 0;
+    slab->free_head = 0;
+    uint8_t* next_free_indices = GetNextFreeIndices(slab);
+    for (int i = 0; i < num_of_objects_per_slab_; i++) {
+      next_free_indices[i] = i + 1 < num_of_objects_per_slab_
+                                 ? static_cast<uint8_t>(i + 1)
+                                 : kEndOfFreeList;
+      if (ctor_)
+        ctor_(GetObject(slab, i));
+    }
+    num_of_slabs_++;
+    num_of_empty_slabs_++;
+    return slab;
+  }
+  void DestroySlab(Slab* slab) {
+    slab->signature = 0;
+    page_allocator_->FreePages(slab, 1);
+    num_of_slabs_--;
+  }
+
+  TPageAllocator* page_allocator_;
+  const char* name_;
+  Constructor ctor_;
+  uint64_t object_size_;
+  uint64_t objects_offset_;
+  int num_of_objects_per_slab_;
+  Slab* partial_slabs_;
+  Slab* full_slabs_;
+  uint64_t num_of_slabs_;
+  int num_of_empty_slabs_;
+  uint64_t num_of_used_objects_;
+};
+
+template <class TPageAllocator>
+class SlabAllocator {
+  // General purpose allocator (kmalloc) for the kernel.
+  // Requests up to kMaxSizeOfSlabObject are served from power-of-two size
+  // classes, and each object is aligned to its size class. Larger requests
+  // get whole pages with a small header in front of the object.
+ public:
+  using Cache = SlabCache<TPageAllocator>;
+  static constexpr int kMinSizeClassExponent = 4;
+  static constexpr int kMaxSizeClassExponent = 10;
+  static constexpr int kNumOfSizeClasses =
+      kMaxSizeClassExponent - kMinSizeClassExponent + 1;
+  static constexpr uint64_t kMaxSizeOfSlabObject =
+      1ULL << kMaxSizeClassExponent;
+  static constexpr uint64_t kLargeObjectAlign = 64;
+
+  void Init(TPageAllocator& page_allocator) {
+    static const char* const kSizeClassNames[kNumOfSizeClasses] = {
+        "kmalloc-16",  "kmalloc-32",  "kmalloc-64",  "kmalloc-128",
+        "kmalloc-256", "kmalloc-512", "kmalloc-1024"};
+    page_allocator_ = &page_allocator;
+    num_of_large_object_pages_ = 0;
+    for (int i = 0; i < kNumOfSizeClasses; i++) {
+      const uint64_t size = 1ULL << (i + kMinSizeClassExponent);
+      caches_[i].Init(page_allocator, kSizeClassNames[i], size, size);
+    }
+  }
+  void* Alloc(uint64_t size, uint64_t align = Cache::kMinAlign) {
+    assert(align && (align & (align - 1)) == 0);
+    if (size < align)
+      size = align;
+    if (size <= kMaxSizeOfSlabObject)
+      return caches_[GetSizeClassIndex(size)].Alloc();
+    if (align > kLargeObjectAlign)
+      Panic("SlabAllocator: unsupported alignment for a large object");
+    const uint64_t num_of_pages =
+        ByteSizeToPageSize(size + sizeof(LargeObjectHeader));
+    LargeObjectHeader* header =
+        page_allocator_->template AllocPages<LargeObjectHeader*>(num_of_pages);
+    header->signature = kLargeObjectSignature;
+    header->num_of_pages = num_of_pages;
+    num_of_large_object_pages_ += num_of_pages;
+    return header + 1;
+  }
+  void Free(void* p) {
+    if (!p)
+      return;
+    if (Cache* cache = Cache::GetCacheOf(p)) {
+      cache->Free(p);
+      return;
+    }
+    LargeObjectHeader* header = GetLargeObjectHeader(p);
+    const uint64_t num_of_pages = header->num_of_pages;
+    header->signature = 0;
+    num_of_large_object_pages_ -= num_of_pages;
+    page_allocator_->FreePages(header, num_of_pages);
+  }
+  uint64_t GetUsableSize(void* p) {
+    if (Cache* cache = Cache::GetCacheOf(p))
+      return cache->GetObjectSize();
+    return (GetLargeObjectHeader(p)->num_of_pages << kPageSizeExponent) -
+           sizeof(LargeObjectHeader);
+  }
+  template <class TFunc>
+  void ForEachCache(TFunc func) {
+    for (auto& cache : caches_) {
+      func(cache);
+    }
+  }
+  uint64_t GetNumOfLargeObjectPages() const {
+    return num_of_large_object_pages_;
+  }
+
+ private:
+  static constexpr uint64_t kLargeObjectSignature = 0x4A424F4547524C55ULL;
+  struct LargeObjectHeader {
+    uint64_t signature;
+    uint64_t num_of_pages;
+    uint8_t padding[kLargeObjectAlign - 16];
+  };
+  static_assert(sizeof(LargeObjectHeader) == kLargeObjectAlign);
+
+  static int GetSizeClassIndex(uint64_t size) {
+    if (size <= (1ULL << kMinSizeClassExponent))
+      return 0;
+    return 64 - __builtin_clzll(size - 1) - kMinSizeClassExponent;
+  }
+  static LargeObjectHeader* GetLargeObjectHeader(void* p) {
+    LargeObjectHeader* header = reinterpret_cast<LargeObjectHeader*>(
+        reinterpret_cast<uint64_t>(p) & ~kPageAddrMask);
+    if (header + 1 != p || header->signature != kLargeObjectSignature)
+      Panic("SlabAllocator: invalid pointer");
+    return header;
+  }
+
+  TPageAllocator* page_allocator_;
+  Cache caches_[kNumOfSizeClasses];
+  uint64_t num_of_large_object_pages_;
+};
@@ -0,0 +1,155 @@
+#include "slab_allocator.h"
+
+#ifdef LIUMOS_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cassert>
+#include <random>
+#include <vector>
+
+[[noreturn]] void Panic(const char* s) {
+  puts(s);
+  exit(EXIT_FAILURE);
+}
+
+class TestPageAllocator {
+ public:
+  template <typename T>
+  T AllocPages(uint64_t num_of_pages) {
+    void* p = aligned_alloc(kPageSize, num_of_pages << kPageSizeExponent);
+    if (!p) {
+      perror("aligned_alloc failed.\n");
+      exit(EXIT_FAILURE);
+    }
+    // Fill with garbage to make sure no one depends on zero-cleared pages
+    memset(p, 0xCC, num_of_pages << kPageSizeExponent);
+    num_of_used_pages_ += num_of_pages;
+    return reinterpret_cast<T>(p);
+  }
+  template <typename T>
+  void FreePages(T addr, uint64_t num_of_pages) {
+    assert(num_of_used_pages_ >= num_of_pages);
+    num_of_used_pages_ -= num_of_pages;
+    free(reinterpret_cast<void*>(addr));
+  }
+  uint64_t GetNumOfUsedPages() { return num_of_used_pages_; }
+
+ private:
+  uint64_t num_of_used_pages_ = 0;
+};
+
+using Allocator = SlabAllocator<TestPageAllocator>;
+
+void TestSizeClasses() {
+  TestPageAllocator page_allocator;
+  Allocator allocator;
+  allocator.Init(page_allocator);
+  for (uint64_t size = 1; size <= 8192; size = size * 3 / 2 + 1) {
+    uint8_t* p = reinterpret_cast<uint8_t*>(allocator.Alloc(size));
+    assert((reinterpret_cast<uint64_t>(p) & 0xF) == 0);
+    assert(allocator.GetUsableSize(p) >= size);
+    memset(p, 0xAB, size);
+    allocator.Free(p);
+  }
+  for (uint64_t align = 16; align <= Allocator::kMaxSizeOfSlabObject;
+       align <<= 1) {
+    void* p = allocator.Alloc(8, align);
+    assert((reinterpret_cast<uint64_t>(p) & (align - 1)) == 0);
+    allocator.Free(p);
+  }
+  allocator.Free(nullptr);
+}
+
+void TestSmallObjectOverhead() {
+  // 128-byte objects should be packed into pages, not one page per object.
+  constexpr int kNumOfObjects = 1000;
+  constexpr uint64_t kObjectSize = 120;
+  TestPageAllocator page_allocator;
+  Allocator allocator;
+  allocator.Init(page_allocator);
+  std::vector<void*> objs;
+  for (int i = 0; i < kNumOfObjects; i++) {
+    objs.push_back(allocator.Alloc(kObjectSize));
+  }
+  std::sort(objs.begin(), objs.end());
+  assert(std::unique(objs.begin(), objs.end()) == objs.end());
+  for (int i = 1; i < kNumOfObjects; i++) {
+    assert(reinterpret_cast<uint64_t>(objs[i - 1]) + kObjectSize <=
+           reinterpret_cast<uint64_t>(objs[i]));
+  }
+  const uint64_t used_bytes = page_allocator.GetNumOfUsedPages() * kPageSize;
+  printf("%d objects of %lu bytes: %lu pages used\n", kNumOfObjects,
+         kObjectSize, page_allocator.GetNumOfUsedPages());
+  assert(used_bytes < kNumOfObjects * kObjectSize * 3 / 2);
+
+  std::mt19937 rand(1);
+  std::shuffle(objs.begin(), objs.end(), rand);
+  for (auto& p : objs) {
+    allocator.Free(p);
+  }
+  // At most one empty slab is kept for each size class.
+  assert(page_allocator.GetNumOfUsedPages() <= 1);
+}
+
+void TestLargeObject() {
+  TestPageAllocator page_allocator;
+  Allocator allocator;
+  allocator.Init(page_allocator);
+  void* p = allocator.Alloc(kPageSize * 3);
+  assert((reinterpret_cast<uint64_t>(p) & 0xF) == 0);
+  assert(allocator.GetUsableSize(p) >= kPageSize * 3);
+  assert(page_allocator.GetNumOfUsedPages() == 4);
+  assert(allocator.GetNumOfLargeObjectPages() == 4);
+  allocator.Free(p);
+  assert(page_allocator.GetNumOfUsedPages() == 0);
+  assert(allocator.GetNumOfLargeObjectPages() == 0);
+}
+
+int num_of_ctor_calls;
+struct TestObject {
+  uint64_t value;
+  static void Construct(void* p) {
+    reinterpret_cast<TestObject*>(p)->value = 0x1234;
+    num_of_ctor_calls++;
+  }
+};
+
+void TestConstructorReuse() {
+  TestPageAllocator page_allocator;
+  SlabCache<TestPageAllocator> cache;
+  cache.Init(page_allocator, "test", sizeof(TestObject),
+             alignof(TestObject), TestObject::Construct);
+  const int num_of_objects_per_slab = cache.GetNumOfObjectsPerSlab();
+  assert(num_of_objects_per_slab > 1);
+
+  TestObject* obj = reinterpret_cast<TestObject*>(cache.Alloc());
+  assert(obj->value == 0x1234);
+  assert(num_of_ctor_calls == num_of_objects_per_slab);
+  obj->value = 0x5678;
+  cache.Free(obj);
+  // The freed object is handed out again without being constructed again,
+  // and its contents are kept.
+  TestObject* obj2 = reinterpret_cast<TestObject*>(cache.Alloc());
+  assert(obj2 == obj);
+  assert(obj2->value == 0x5678);
+  assert(num_of_ctor_calls == num_of_objects_per_slab);
+  assert(cache.GetNumOfUsedObjects() == 1);
+  assert(SlabCache<TestPageAllocator>::GetCacheOf(obj2) == &cache);
+  cache.Free(obj2);
+  assert(cache.GetNumOfUsedObjects() == 0);
+}
+
+int main() {
+  TestSizeClasses();
+  TestSmallObjectOverhead();
+  TestLargeObject();
+  TestConstructorReuse();
+  puts("PASS");
+  return 0;
+}
+
+#endif
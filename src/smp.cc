@@ -0,0 +1,328 @@
+#include "kernel.h"
+#include "liumos.h"
+#include "util.h"
+
+extern "C" uint8_t APBootTrampoline[];
+extern "C" uint8_t APBootTrampolineEnd[];
+extern "C" uint8_t APBootLongMode[];
+extern "C" uint8_t APBootGDT[];
+extern "C" uint8_t APBootGDTR[];
+extern "C" uint8_t APBootFarPointer[];
+extern "C" uint8_t APBootCR0[];
+extern "C" uint8_t APBootCR4[];
+extern "C" uint8_t APBootEFER[];
+extern "C" uint8_t APBootTempCR3[];
+extern "C" uint8_t APBootKernelCR3[];
+extern "C" uint8_t APBootStackPointer[];
+extern "C" uint8_t APBootArgument[];
+extern "C" uint8_t APBootEntryPoint[];
+
+constexpr uint8_t kLocalAPICTimerVector = 0x20;
+
+Processor processors_[Processor::kMaxNumOfProcessors];
+int num_of_processors_ = 1;
+uint32_t local_apic_timer_count_per_ms_;
+bool uses_tsc_deadline_;
+
+struct APBootInfo {
+  // state moves from kWaiting to kClaimed by the AP, or to kAbandoned by the
+  // BSP when it gives up on the AP, whichever comes first. The AP sets
+  // kStarted after initializing itself.
+  enum State {
+    kWaiting,
+    kClaimed,
+    kStarted,
+    kAbandoned,
+  };
+  Processor* cpu;
+  Process* idle_process;
+  int state;
+};
+APBootInfo ap_boot_info_;
+
+void Processor::Init(int index,
+                     uint64_t kernel_stack_pointer,
+                     uint64_t exception_stack_pointer,
+                     uint64_t interrupt_stack_pointer) {
+  index_ = index;
+  proximity_domain_ = 0;
+  kernel_stack_pointer_ = kernel_stack_pointer;
+  exception_stack_pointer_ = exception_stack_pointer;
+  interrupt_stack_pointer_ = interrupt_stack_pointer;
+  current_process_ = nullptr;
+  idle_process_ = nullptr;
+  slice_process_ = nullptr;
+  slice_end_count_ = 0;
+}
+
+void Processor::LoadGDT() {
+  gdt_.Init(kernel_stack_pointer_, exception_stack_pointer_);
+  gdt_.SetIST(IDT::kISTForInterrupts, interrupt_stack_pointer_);
+}
+
+void Processor::InitProximityDomain() {
+  // Processors are treated as in the same domain without SRAT.
+  if (!liumos->acpi.srat)
+    return;
+  proximity_domain_ =
+      liumos->acpi.srat->GetProximityDomainForLocalAPIC(local_apic_);
+}
+
+Processor& GetCurrentProcessor() {
+  GDTR gdtr;
+  ReadGDTR(&gdtr);
+  const uint64_t offset = reinterpret_cast<uint64_t>(gdtr.base) -
+                          reinterpret_cast<uint64_t>(&processors_[0]);
+  const uint64_t index = offset / sizeof(Processor);
+  if (index >= Processor::kMaxNumOfProcessors)
+    Panic("GDTR does not point to any Processor");
+  return processors_[index];
+}
+
+Processor& GetProcessor(int index) {
+  assert(0 <= index && index < Processor::kMaxNumOfProcessors);
+  return processors_[index];
+}
+
+int GetNumOfProcessors() {
+  return num_of_processors_;
+}
+
+void CalibrateLocalAPICTimer(LocalAPIC& local_apic) {
+  // Counts the timer down for a while measured with HPET. Sleep() is not
+  // used since the scheduler may not be ready.
+  constexpr uint64_t kCalibrationMs = 10;
+  HPET& hpet = HPET::GetInstance();
+  const uint64_t hpet_count = 1'000'000'000'000ULL * kCalibrationMs /
+                              hpet.GetFemtosecondPerCount();
+  constexpr uint32_t kInitialCount = 0xFFFF'FFFF;
+  const uint64_t end = hpet.ReadMainCounterValue() + hpet_count;
+  local_apic.StartTimer(kInitialCount, kLocalAPICTimerVector, false);
+  while (hpet.ReadMainCounterValue() < end) {
+  }
+  const uint32_t elapsed = kInitialCount - local_apic.GetTimerCurrentCount();
+  local_apic.StopTimer();
+  local_apic_timer_count_per_ms_ = elapsed / kCalibrationMs;
+  PutStringAndDecimal("LocalAPIC timer count per ms",
+                      local_apic_timer_count_per_ms_);
+}
+
+void InitLocalTimer(LocalAPIC& local_apic) {
+  assert(local_apic_timer_count_per_ms_);
+  uses_tsc_deadline_ =
+      GetBit<CPUFeatureIndex::kTSCDeadline>(liumos->cpu_features->features);
+  if (uses_tsc_deadline_)
+    local_apic.EnableTSCDeadlineTimer(kLocalAPICTimerVector);
+}
+
+void ArmLocalTimer(LocalAPIC& local_apic, uint64_t ns) {
+  // Longer waits are split, since the timer is armed again on each
+  // interrupt.
+  constexpr uint64_t kMaxNs = 1'000'000'000;
+  if (ns > kMaxNs)
+    ns = kMaxNs;
+  if (uses_tsc_deadline_) {
+    WriteMSR(MSRIndex::kTSCDeadline,
+             __builtin_ia32_rdtsc() + Clock::NanoSecondToTSCCount(ns) + 1);
+    return;
+  }
+  uint64_t count = ns * local_apic_timer_count_per_ms_ / 1'000'000;
+  if (!count)
+    count = 1;
+  if (count > 0xFFFF'FFFF)
+    count = 0xFFFF'FFFF;
+  local_apic.StartTimer(static_cast<uint32_t>(count), kLocalAPICTimerVector,
+                        false);
+}
+
+void DisarmLocalTimer(LocalAPIC& local_apic) {
+  if (uses_tsc_deadline_) {
+    WriteMSR(MSRIndex::kTSCDeadline, 0);
+    return;
+  }
+  local_apic.StopTimer();
+}
+
+void KickProcessor(Processor& cpu) {
+  // Same as a timer interrupt, which makes the scheduler run on cpu.
+  GetCurrentProcessor().GetLocalAPIC().SendFixedIPI(
+      cpu.GetLocalAPIC().GetID(), kLocalAPICTimerVector);
+}
+
+__attribute__((ms_abi)) extern "C" void APEntry(APBootInfo* info) {
+  // Runs on the stack of the idle process for the AP, with the kernel page
+  // table and the temporary GDT of the trampoline.
+  int expected = APBootInfo::kWaiting;
+  if (!__atomic_compare_exchange_n(&info->state, &expected,
+                                   APBootInfo::kClaimed, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    // Too late. The BSP is sending INIT to this AP.
+    Die();
+  }
+  Processor& cpu = *info->cpu;
+  cpu.LoadGDT();
+  IDT::GetInstance().Load();
+  cpu.GetLocalAPIC().InitForAP(GetProcessor(0).GetLocalAPIC());
+  cpu.InitProximityDomain();
+  FPU::InitForCurrentProcessor();
+  TLB::InitForCurrentProcessor();
+  EnableSyscall();
+  liumos->scheduler->RegisterIdleProcess(*info->idle_process);
+  // The timer is armed by the scheduler when this processor gets a process
+  // to run.
+  InitLocalTimer(cpu.GetLocalAPIC());
+  __atomic_store_n(&info->state, APBootInfo::kStarted, __ATOMIC_RELEASE);
+  IdleTask();
+}
+
+template <typename T>
+static void WriteTrampolineField(uint8_t* page, uint8_t* field, T value) {
+  memcpy(page + (field - APBootTrampoline), &value, sizeof(value));
+}
+
+static void PrepareTrampoline(uint64_t ap_boot_pages) {
+  // The pages are below 1MiB and identity mapped in the kernel page table.
+  // The first page holds the trampoline, and the second one is a copy of the
+  // kernel PML4 which is used until the AP loads the full 64-bit CR3.
+  uint8_t* page = reinterpret_cast<uint8_t*>(ap_boot_pages);
+  const uint64_t trampoline_size = APBootTrampolineEnd - APBootTrampoline;
+  assert(trampoline_size <= kPageSize);
+  memcpy(page, APBootTrampoline, trampoline_size);
+  memcpy(page + kPageSize, &GetKernelPML4(), kPageSize);
+
+  constexpr uint64_t kCR4BitPCIDE = 1ULL << 17;
+  constexpr uint64_t kEFERBitLMA = 1ULL << 10;
+  const uint32_t base = static_cast<uint32_t>(ap_boot_pages);
+  WriteTrampolineField(
+      page, APBootGDTR + 2,
+      base + static_cast<uint32_t>(APBootGDT - APBootTrampoline));
+  WriteTrampolineField(
+      page, APBootFarPointer,
+      base + static_cast<uint32_t>(APBootLongMode - APBootTrampoline));
+  WriteTrampolineField(page, APBootCR0, static_cast<uint32_t>(ReadCR0()));
+  WriteTrampolineField(page, APBootCR4,
+                       static_cast<uint32_t>(ReadCR4() & ~kCR4BitPCIDE));
+  WriteTrampolineField(
+      page, APBootEFER,
+      static_cast<uint32_t>(ReadMSR(MSRIndex::kEFER) & ~kEFERBitLMA));
+  WriteTrampolineField(page, APBootTempCR3,
+                       base + static_cast<uint32_t>(kPageSize));
+  WriteTrampolineField(page, APBootKernelCR3, ReadCR3() & ~kCR3PCIDMask);
+}
+
+// Returns false if the AP is still in state after ms.
+static bool WaitWhileAPIsIn(int state, uint64_t ms) {
+  const uint64_t end =
+      Clock::ReadCount() + Clock::NanoSecondToCount(ms * 1'000'000);
+  while (Clock::ReadCount() < end) {
+    if (__atomic_load_n(&ap_boot_info_.state, __ATOMIC_ACQUIRE) != state)
+      return true;
+    Sleep();
+  }
+  return __atomic_load_n(&ap_boot_info_.state, __ATOMIC_ACQUIRE) != state;
+}
+
+static uint64_t AllocStack() {
+  return liumos->kernel_heap_allocator->AllocPages<uint64_t>(
+             kKernelStackPagesForEachProcess) +
+         (kKernelStackPagesForEachProcess << kPageSizeExponent);
+}
+
+static void FreeStack(uint64_t stack_pointer) {
+  liumos->kernel_heap_allocator->FreePages(
+      stack_pointer - (kKernelStackPagesForEachProcess << kPageSizeExponent),
+      kKernelStackPagesForEachProcess);
+}
+
+static bool StartProcessor(uint64_t ap_boot_pages,
+                           Processor& cpu,
+                           uint32_t apic_id) {
+  // INIT-SIPI-SIPI sequence. c.f. Intel SDM Vol.3 8.4.4.1
+  uint64_t stack_pointers[3];
+  for (auto& sp : stack_pointers)
+    sp = AllocStack();
+  cpu.Init(GetNumOfProcessors(), stack_pointers[0], stack_pointers[1],
+           stack_pointers[2]);
+  Process& idle = CreateKernelTask(IdleTask, Process::kLowestPriority);
+
+  ap_boot_info_.cpu = &cpu;
+  ap_boot_info_.idle_process = &idle;
+  ap_boot_info_.state = APBootInfo::kWaiting;
+  uint8_t* page = reinterpret_cast<uint8_t*>(ap_boot_pages);
+  WriteTrampolineField(
+      page, APBootStackPointer,
+      idle.GetExecutionContext().GetCPUContext().int_ctx.rsp);
+  WriteTrampolineField(page, APBootArgument,
+                       reinterpret_cast<uint64_t>(&ap_boot_info_));
+  WriteTrampolineField(page, APBootEntryPoint,
+                       reinterpret_cast<uint64_t>(APEntry));
+
+  LocalAPIC& bsp_local_apic = GetProcessor(0).GetLocalAPIC();
+  const uint8_t vector = static_cast<uint8_t>(ap_boot_pages >> 12);
+  bsp_local_apic.SendINIT(apic_id);
+  HPET::GetInstance().BusyWait(10);
+  bsp_local_apic.SendStartupIPI(apic_id, vector);
+  if (!WaitWhileAPIsIn(APBootInfo::kWaiting, 1)) {
+    bsp_local_apic.SendStartupIPI(apic_id, vector);
+    WaitWhileAPIsIn(APBootInfo::kWaiting, 100);
+  }
+  int expected = APBootInfo::kWaiting;
+  if (__atomic_compare_exchange_n(&ap_boot_info_.state, &expected,
+                                  APBootInfo::kAbandoned, false,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    // The AP may still run the trampoline later, on the stack freed below
+    // and with the boot info for the next AP. INIT stops it until the next
+    // SIPI.
+    bsp_local_apic.SendINIT(apic_id);
+    DestroyUnstartedKernelTask(idle);
+    for (auto& sp : stack_pointers)
+      FreeStack(sp);
+    return false;
+  }
+  // The AP has claimed the boot info, so it is initializing itself.
+  if (!WaitWhileAPIsIn(APBootInfo::kClaimed, 1000))
+    Panic("AP stopped during initialization");
+  return true;
+}
+
+void StartApplicationProcessors() {
+  using namespace ACPI;
+  if (!liumos->acpi.madt) {
+    PutString("MADT not found. APs are not started.\n");
+    return;
+  }
+  const uint64_t ap_boot_pages = GetLoaderInfo().ap_boot_pages;
+  assert(ap_boot_pages + kNumOfAPBootPages * kPageSize <= kAPBootPagesLimit);
+  PrepareTrampoline(ap_boot_pages);
+
+  MADT& madt = *liumos->acpi.madt;
+  const uint32_t bsp_apic_id = GetProcessor(0).GetLocalAPIC().GetID();
+  for (int i = 0; i < (int)(madt.length - offsetof(MADT, entries));
+       i += madt.entries[i + 1]) {
+    uint8_t type = madt.entries[i];
+    uint32_t apic_id;
+    bool is_enabled;
+    if (type == kProcessorLocalAPICInfo) {
+      apic_id = madt.entries[i + 3];
+      is_enabled = madt.entries[i + 4] & 1;
+    } else if (type == kProcessorLocalx2APICStruct) {
+      apic_id = *reinterpret_cast<uint32_t*>(&madt.entries[i + 4]);
+      is_enabled = madt.entries[i + 8] & 1;
+    } else {
+      continue;
+    }
+    if (!is_enabled || apic_id == bsp_apic_id)
+      continue;
+    if (num_of_processors_ >= Processor::kMaxNumOfProcessors) {
+      PutString("Too many processors. Some APs are not started.\n");
+      break;
+    }
+    Processor& cpu = processors_[num_of_processors_];
+    if (!StartProcessor(ap_boot_pages, cpu, apic_id)) {
+      PutStringAndHex("Failed to start AP. APIC ID", apic_id);
+      continue;
+    }
+    num_of_processors_++;
+  }
+  PutStringAndDecimal("Num of processors", num_of_processors_);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "asm.h"
+#include "generic.h"
+#include "lock_stats.h"
+
+class SpinLock {
+  // Busy-waits until the lock is released, backing off exponentially to
+  // reduce the traffic on the cache line. Holders should disable interrupts
+  // while holding it, since the holder should not be switched out and the
+  // lock may be taken by interrupt handlers. LockIRQSave() does both.
+ public:
+  constexpr SpinLock() : is_locked_(false) {}
+  void SetStats(LockStats& stats) { stats_.SetStats(stats); }
+  void Lock() {
+    if (TryAcquire()) {
+      stats_.OnAcquired(0);
+      return;
+    }
+    const uint64_t wait_start =
+        stats_.IsRecording() ? LockStats::ReadTimestamp() : 0;
+    uint32_t backoff = 1;
+    do {
+      for (uint32_t i = 0; i < backoff; i++)
+        __builtin_ia32_pause();
+      if (backoff < kMaxBackoff)
+        backoff <<= 1;
+    } while (!TryAcquire());
+    stats_.OnAcquired(wait_start);
+  }
+  bool TryLock() {
+    if (!TryAcquire())
+      return false;
+    stats_.OnAcquired(0);
+    return true;
+  }
+  void Unlock() {
+    stats_.OnReleasing();
+    __atomic_store_n(&is_locked_, false, __ATOMIC_RELEASE);
+  }
+  // Returns whether interrupts were enabled, to be passed to
+  // UnlockIRQRestore.
+  bool LockIRQSave() {
+    const bool was_enabled = DisableInterrupts();
+    Lock();
+    return was_enabled;
+  }
+  void UnlockIRQRestore(bool was_enabled) {
+    Unlock();
+    RestoreInterrupts(was_enabled);
+  }
+  bool IsLocked() const {
+    return __atomic_load_n(&is_locked_, __ATOMIC_RELAXED);
+  }
+
+ private:
+  static constexpr uint32_t kMaxBackoff = 1024;
+  bool TryAcquire() {
+    return !__atomic_load_n(&is_locked_, __ATOMIC_RELAXED) &&
+           !__atomic_exchange_n(&is_locked_, true, __ATOMIC_ACQUIRE);
+  }
+
+  bool is_locked_;
+  LockStatsRecorder stats_;
+};
+
+class TicketLock {
+  // Fair spinlock for hot shared structures. Waiters take tickets and get
+  // the lock in FIFO order, so no processor starves under contention.
+  // Interrupts should be disabled while holding it, as for SpinLock.
+ public:
+  constexpr TicketLock() : next_ticket_(0), now_serving_(0) {}
+  void SetStats(LockStats& stats) { stats_.SetStats(stats); }
+  void Lock() {
+    const uint32_t ticket =
+        __atomic_fetch_add(&next_ticket_, 1, __ATOMIC_RELAXED);
+    uint32_t serving = __atomic_load_n(&now_serving_, __ATOMIC_ACQUIRE);
+    if (serving == ticket) {
+      stats_.OnAcquired(0);
+      return;
+    }
+    const uint64_t wait_start =
+        stats_.IsRecording() ? LockStats::ReadTimestamp() : 0;
+    do {
+      // Waits longer when more waiters are ahead.
+      for (uint32_t i = 0; i < ticket - serving; i++)
+        __builtin_ia32_pause();
+      serving = __atomic_load_n(&now_serving_, __ATOMIC_ACQUIRE);
+    } while (serving != ticket);
+    stats_.OnAcquired(wait_start);
+  }
+  bool TryLock() {
+    // Takes a ticket only if it is served immediately.
+    uint32_t serving = __atomic_load_n(&now_serving_, __ATOMIC_ACQUIRE);
+    if (!__atomic_compare_exchange_n(&next_ticket_, &serving, serving + 1,
+                                     false, __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED))
+      return false;
+    stats_.OnAcquired(0);
+    return true;
+  }
+  void Unlock() {
+    stats_.OnReleasing();
+    // Only the holder updates now_serving_.
+    __atomic_store_n(&now_serving_, now_serving_ + 1, __ATOMIC_RELEASE);
+  }
+  bool IsLocked() const {
+    return __atomic_load_n(&next_ticket_, __ATOMIC_RELAXED) !=
+           __atomic_load_n(&now_serving_, __ATOMIC_RELAXED);
+  }
+
+ private:
+  uint32_t next_ticket_;
+  uint32_t now_serving_;
+  LockStatsRecorder stats_;
+};
@@ -0,0 +1,66 @@
+#include "spinlock.h"
+
+#ifdef LIUMOS_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <cassert>
+
+[[noreturn]] void Panic(const char* s) {
+  puts(s);
+  exit(EXIT_FAILURE);
+}
+
+template <class TLock>
+void TestLock() {
+  TLock lock;
+  assert(!lock.IsLocked());
+  lock.Lock();
+  assert(lock.IsLocked());
+  assert(!lock.TryLock());
+  lock.Unlock();
+  assert(!lock.IsLocked());
+  assert(lock.TryLock());
+  assert(lock.IsLocked());
+  lock.Unlock();
+  assert(!lock.IsLocked());
+}
+
+void TestLockStats() {
+  LockStats stats("test");
+  SpinLock lock;
+  lock.SetStats(stats);
+
+  lock.Lock();
+  lock.Unlock();
+  assert(stats.GetNumOfAcquisitions() == 0);
+  assert(!LockStats::GetFirst());
+
+  LockStats::SetEnabled(true);
+  lock.Lock();
+  assert(!lock.TryLock());
+  lock.Unlock();
+  assert(lock.TryLock());
+  lock.Unlock();
+  LockStats::SetEnabled(false);
+
+  assert(stats.GetNumOfAcquisitions() == 2);
+  assert(stats.GetNumOfContentions() == 0);
+  assert(LockStats::GetFirst() == &stats);
+  assert(!stats.GetNext());
+
+  stats.Reset();
+  assert(stats.GetNumOfAcquisitions() == 0);
+  assert(stats.GetHoldTSC() == 0);
+}
+
+int main() {
+  TestLock<SpinLock>();
+  TestLock<TicketLock>();
+  TestLockStats();
+  puts("PASS");
+  return 0;
+}
+
+#endif
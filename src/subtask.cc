@@ -198,7 +198,7 @@ void CellularAutomaton() {
     }
     liumos->screen_sheet->Flush(liumos->screen_sheet->GetXSize() - canvas_xsize,
                                 0, canvas_xsize, canvas_ysize);
-    HPET::GetInstance().BusyWait(200);
+    liumos->scheduler->SleepFor(200'000'000);
   }
 }
 
@@ -207,6 +207,6 @@ void SubTask() {
   kprintf("pcube size: 0x%X\n", sizeof(pcube));
   for (;;) {
     pcube.Draw();
-    HPET::GetInstance().BusyWait(10);
+    liumos->scheduler->SleepFor(10'000'000);
   }
 }
@@ -15,17 +15,14 @@ constexpr uint64_t kSyscallIndex_sys_recvfrom = 45;
 constexpr uint64_t kSyscallIndex_sys_bind = 49;
 constexpr uint64_t kSyscallIndex_sys_exit = 60;
 constexpr uint64_t kSyscallIndex_arch_prctl = 158;
+constexpr uint64_t kSyscallIndex_sys_clock_gettime = 228;
+constexpr uint64_t kNumOfSyscalls = 256;
+constexpr int kNumOfSyscallHistogramBuckets = 32;
 // constexpr uint64_t kArchSetGS = 0x1001;
 constexpr uint64_t kArchSetFS = 0x1002;
 // constexpr uint64_t kArchGetFS = 0x1003;
 // constexpr uint64_t kArchGetGS = 0x1004;
 
-// https://elixir.bootlin.com/linux/v4.15/source/include/uapi/asm-generic/errno-base.h#L6
-enum ErrorNumber {
-  kBadFileDescriptor = -9,
-  kInvalid = -22,
-};
-
 // c.f.
 // https://elixir.bootlin.com/linux/v4.15/source/include/uapi/linux/in.h#L232
 // sockaddr_in means sockaddr for InterNet protocol(IP)
@@ -47,45 +44,15 @@ extern "C" uint64_t GetCurrentKernelStack(void) {
   return ctx.GetKernelRSP();
 }
 
-static bool IsICMPPacket(void* frame_data, size_t frame_size) {
-  using EtherFrame = Network::EtherFrame;
-  using IPv4Packet = Network::IPv4Packet;
-  if (frame_size < sizeof(IPv4Packet)) {
-    return false;
-  }
-  EtherFrame& eth = *reinterpret_cast<EtherFrame*>(frame_data);
-  if (!eth.HasEthType(EtherFrame::kTypeIPv4)) {
-    return false;
-  }
-  IPv4Packet& p = *reinterpret_cast<IPv4Packet*>(frame_data);
-  if (p.protocol != IPv4Packet::Protocol::kICMP) {
-    return false;
-  }
-  return true;
+static FileDescriptorTable& GetCurrentFileDescriptorTable() {
+  return liumos->scheduler->GetCurrentProcess().GetFileDescriptorTable();
 }
 
-static bool IsUDPPacketToPort(void* frame_data,
-                              size_t frame_size,
-                              uint16_t port) {
-  using EtherFrame = Network::EtherFrame;
-  using IPv4Packet = Network::IPv4Packet;
-  using IPv4UDPPacket = Network::IPv4UDPPacket;
-  if (frame_size < sizeof(IPv4UDPPacket)) {
-    return false;
-  }
-  EtherFrame& eth = *reinterpret_cast<EtherFrame*>(frame_data);
-  if (!eth.HasEthType(EtherFrame::kTypeIPv4)) {
-    return false;
-  }
-  IPv4Packet& p = *reinterpret_cast<IPv4Packet*>(frame_data);
-  if (p.protocol != IPv4Packet::Protocol::kUDP) {
-    return false;
-  }
-  IPv4UDPPacket& udp = *reinterpret_cast<IPv4UDPPacket*>(frame_data);
-  if (udp.GetDestinationPort() != port) {
-    return false;
-  }
-  return true;
+static Network::Socket* GetSocket(int fd) {
+  File* file = GetCurrentFileDescriptorTable().Get(fd);
+  if (!file || file->GetType() != File::Type::kSocket)
+    return nullptr;
+  return static_cast<Network::Socket*>(file);
 }
 
 static ssize_t sys_recvfrom(int sockfd,
@@ -100,73 +67,44 @@ static ssize_t sys_recvfrom(int sockfd,
   using ICMPPacket = Network::ICMPPacket;
   using EtherFrame = Network::EtherFrame;
   using Socket = Network::Socket;
-  Network& network = Network::GetInstance();
-  auto pid = liumos->scheduler->GetCurrentProcess().GetID();
-  auto sock_holder = network.FindSocket(pid, sockfd);
-  if (!sock_holder.has_value()) {
+  Socket* sock = GetSocket(sockfd);
+  if (!sock) {
     kprintf("%s: fd %d is not a socket\n", __func__, sockfd);
     return -1;
   }
-  Socket::Type socket_type = (*sock_holder).type;
-  if (socket_type == Socket::Type::kICMPDatagram) {
-    for (;;) {
-      while (network.HasPacketInRXBuffer()) {
-        auto packet = network.PopFromRXBuffer();
-        if (!IsICMPPacket(packet.data, packet.size)) {
-          continue;
-        }
-        ICMPPacket& icmp = *reinterpret_cast<ICMPPacket*>(packet.data);
-        size_t icmp_data_size = packet.size - sizeof(IPv4Packet);
-        size_t copy_size = std::min(icmp_data_size, buf_size);
-        memcpy(buf, &icmp.type, copy_size);
-        recv_addr->sin_addr = icmp.ip.src_ip;
-        return icmp_data_size;
-      }
-      Sleep();
-    }
-    return -1;
-  }
-  if (socket_type == Socket::Type::kICMPRaw) {
-    for (;;) {
-      while (network.HasPacketInRXBuffer()) {
-        auto packet = network.PopFromRXBuffer();
-        if (!IsICMPPacket(packet.data, packet.size)) {
-          continue;
-        }
-        size_t ip_data_size = packet.size - sizeof(EtherFrame);
-        size_t copy_size = std::min(ip_data_size, buf_size);
-        memcpy(buf, &packet.data[sizeof(EtherFrame)], copy_size);
-        return ip_data_size;
-      }
-      Sleep();
-    }
-    return -1;
-  }
-  if (socket_type == Socket::Type::kUDP) {
-    uint16_t port = (*sock_holder).listen_port;
-    for (;;) {
-      while (network.HasPacketInRXBuffer()) {
-        auto packet = network.PopFromRXBuffer();
-        if (!IsUDPPacketToPort(packet.data, packet.size, port)) {
-          continue;
-        }
-        size_t udp_data_size = packet.size - sizeof(IPv4UDPPacket);
-        size_t copy_size = std::min(udp_data_size, buf_size);
-        memcpy(buf, &packet.data[sizeof(IPv4UDPPacket)], copy_size);
-        IPv4UDPPacket* udp_packet =
-            reinterpret_cast<IPv4UDPPacket*>(packet.data);
-        recv_addr->sin_addr = udp_packet->ip.src_ip;
-        recv_addr->sin_port =
-            *reinterpret_cast<uint16_t*>(&udp_packet->src_port);
-        return udp_data_size;
-      }
-      Sleep();
-    }
-    return -1;
+  // Frames in the queue are already checked by Network::DeliverToSockets.
+  // This is the only copy of received frames.
+  sock->rx_wait_queue.WaitUntil([sock] { return !sock->rx_queue.IsEmpty(); });
+  PacketBuffer* packet = sock->rx_queue.Pop();
+  uint8_t* frame = packet->GetFrame();
+  const size_t frame_size = packet->GetFrameSize();
+  ssize_t result = -1;
+  if (sock->type == Socket::Type::kICMPDatagram) {
+    ICMPPacket& icmp = *reinterpret_cast<ICMPPacket*>(frame);
+    size_t icmp_data_size = frame_size - sizeof(IPv4Packet);
+    size_t copy_size = std::min(icmp_data_size, buf_size);
+    memcpy(buf, &icmp.type, copy_size);
+    recv_addr->sin_addr = icmp.ip.src_ip;
+    result = icmp_data_size;
+  } else if (sock->type == Socket::Type::kICMPRaw) {
+    size_t ip_data_size = frame_size - sizeof(EtherFrame);
+    size_t copy_size = std::min(ip_data_size, buf_size);
+    memcpy(buf, &frame[sizeof(EtherFrame)], copy_size);
+    result = ip_data_size;
+  } else if (sock->type == Socket::Type::kUDP) {
+    size_t udp_data_size = frame_size - sizeof(IPv4UDPPacket);
+    size_t copy_size = std::min(udp_data_size, buf_size);
+    memcpy(buf, &frame[sizeof(IPv4UDPPacket)], copy_size);
+    IPv4UDPPacket* udp_packet = reinterpret_cast<IPv4UDPPacket*>(frame);
+    recv_addr->sin_addr = udp_packet->ip.src_ip;
+    recv_addr->sin_port = *reinterpret_cast<uint16_t*>(&udp_packet->src_port);
+    result = udp_data_size;
+  } else {
+    kprintf("%s: socket_type = %d is not a supported yet\n", __func__,
+            sock->type);
   }
-  kprintf("%s: socket_type = %d is not a supported yet\n", __func__,
-          socket_type);
-  return -1;
+  packet->Unref();
+  return result;
 }
 
 static int sys_socket(int domain, int type, int protocol) {
@@ -175,59 +113,55 @@ static int sys_socket(int domain, int type, int protocol) {
   constexpr int kTypeDatagram = 2; /* UDP under kDomainIPv4 */
   constexpr int kTypeRawSocket = 3;
   constexpr int kProtocolICMP = 1;
-  Network& network = Network::GetInstance();
-  auto pid = liumos->scheduler->GetCurrentProcess().GetID();
-  const int sockfd = 3; /* Always assign 3 for now */
-  if (domain == kDomainIPv4) {
-    if (type == kTypeDatagram && protocol == kProtocolICMP) {
-      if (network.RegisterSocket(pid, sockfd,
-                                 Network::Socket::Type::kICMPDatagram)) {
-        kprintf("kernel: %s: failed to register socket.\n", __func__);
-        return -1 /* Return -1 on error */;
-      }
-      kprintf("kernel: %s: socket (fd=%d) created (IPv4, DGRAM, ICMP)\n",
-              __func__, sockfd);
-      return sockfd /* Always returns 3 for now */;
-    }
-    if (type == kTypeRawSocket && protocol == kProtocolICMP) {
-      if (network.RegisterSocket(pid, sockfd,
-                                 Network::Socket::Type::kICMPRaw)) {
-        kprintf("kernel: %s: failed to register socket.\n", __func__);
-        return -1 /* Return -1 on error */;
-      }
-      kprintf("kernel: %s: socket (fd=%d) created (IPv4, Raw, ICMPRaw)\n",
-              __func__, sockfd);
-      return sockfd /* Always returns 3 for now */;
-    }
-    if (type == kTypeDatagram && (protocol == 0 || protocol == 17)) {
-      /* UDP */
-      if (network.RegisterSocket(pid, sockfd, Network::Socket::Type::kUDP)) {
-        kprintf("kernel: %s: failed to register socket.\n", __func__);
-        return -1 /* Return -1 on error */;
-      }
-      kprintf("kernel: %s: socket (fd=%d) created (IPv4, DGRAM, %d)(UDP)\n",
-              __func__, sockfd, protocol);
-      return sockfd;
-    }
-  }
-  kprintf("kernel: %s: socket(%d, %d, %d) is not supported yet\n", __func__,
-          domain, type, protocol);
-  return -1 /* Return -1 on error */;
+  using Socket = Network::Socket;
+  if (domain != kDomainIPv4) {
+    kprintf("kernel: %s: socket(%d, %d, %d) is not supported yet\n",
+            __func__, domain, type, protocol);
+    return -1 /* Return -1 on error */;
+  }
+  Socket* sock = nullptr;
+  const char* desc = nullptr;
+  if (type == kTypeDatagram && protocol == kProtocolICMP) {
+    sock = new Socket(Socket::Type::kICMPDatagram);
+    desc = "IPv4, DGRAM, ICMP";
+  } else if (type == kTypeRawSocket && protocol == kProtocolICMP) {
+    sock = new Socket(Socket::Type::kICMPRaw);
+    desc = "IPv4, Raw, ICMPRaw";
+  } else if (type == kTypeDatagram && (protocol == 0 || protocol == 17)) {
+    sock = new Socket(Socket::Type::kUDP);
+    desc = "IPv4, DGRAM, UDP";
+  } else {
+    kprintf("kernel: %s: socket(%d, %d, %d) is not supported yet\n",
+            __func__, domain, type, protocol);
+    return -1 /* Return -1 on error */;
+  }
+  if (Network::GetInstance().RegisterSocket(*sock)) {
+    kprintf("kernel: %s: failed to register socket.\n", __func__);
+    sock->Unref();
+    return -1 /* Return -1 on error */;
+  }
+  const int sockfd = GetCurrentFileDescriptorTable().Open(*sock);
+  sock->Unref();
+  if (sockfd < 0) {
+    kprintf("kernel: %s: failed to open socket.\n", __func__);
+    return sockfd;
+  }
+  kprintf("kernel: %s: socket (fd=%d) created (%s)\n", __func__, sockfd,
+          desc);
+  return sockfd;
 }
 
 static int sys_bind(int sockfd, sockaddr_in* addr, socklen_t addrlen) {
   /* returns -1 on failure */
-  Network& network = Network::GetInstance();
-  auto pid = liumos->scheduler->GetCurrentProcess().GetID();
-  auto sock_holder = network.FindSocket(pid, sockfd);
-  if (!sock_holder.has_value()) {
+  Network::Socket* sock = GetSocket(sockfd);
+  if (!sock) {
     kprintf("%s: fd %d is not a socket\n", __func__, sockfd);
     return -1;
   }
-  if (network.BindToPort(
-          pid, sockfd,
-          ((addr->sin_port >> 8) & 0xFF) | (addr->sin_port << 8))) {
-    kprintf("%s: BindToPort failed\n", __func__, sockfd);
+  if (Network::GetInstance().BindToPort(
+          *sock, static_cast<uint16_t>(((addr->sin_port >> 8) & 0xFF) |
+                                       (addr->sin_port << 8)))) {
+    kprintf("%s: BindToPort failed\n", __func__);
     return -1;
   }
   kprintf("%s: bind(%d, %p, %d)\n", __func__, sockfd, addr, addrlen);
@@ -235,21 +169,28 @@ static int sys_bind(int sockfd, sockaddr_in* addr, socklen_t addrlen) {
 }
 
 static ssize_t sys_read(int fd, void* buf, size_t count) {
-  if (fd != 0) {
-    kprintf("%s: fd %d is not supported yet: only stdin is supported now.\n",
-            __func__, fd);
-    return ErrorNumber::kInvalid;
-  }
-  if (count < 1)
+  File* file = GetCurrentFileDescriptorTable().Get(fd);
+  if (!file)
+    return ErrorNumber::kBadFileDescriptor;
+  return file->Read(buf, count);
+}
+
+static ssize_t sys_write(int fd, const void* buf, size_t count) {
+  File* file = GetCurrentFileDescriptorTable().Get(fd);
+  if (!file)
+    return ErrorNumber::kBadFileDescriptor;
+  if ((count >> 63)) {
+    kprintf("%s: count = %llu is too big. May be negative?\n", __func__,
+            count);
     return ErrorNumber::kInvalid;
-  uint16_t keyid;
-  while ((keyid = liumos->main_console->GetCharWithoutBlocking()) ==
-             KeyID::kNoInput ||
-         (keyid & KeyID::kMaskBreak)) {
-    StoreIntFlagAndHalt();
   }
-  reinterpret_cast<uint8_t*>(buf)[0] = keyid;
-  return 1;
+  return file->Write(buf, count);
+}
+
+static int sys_close(int fd) {
+  if (!GetCurrentFileDescriptorTable().Close(fd))
+    return ErrorNumber::kBadFileDescriptor;
+  return 0;
 }
 
 static std::optional<Network::EtherAddr> ResolveIPv4WithTimeout(
@@ -277,8 +218,7 @@ static std::optional<Network::EtherAddr> ResolveIPv4WithTimeout(
     kprintf("kernel: ARP request sent to %d.%d.%d.%d...\n",
             nexthop_ip_addr.addr[0], nexthop_ip_addr.addr[1],
             nexthop_ip_addr.addr[2], nexthop_ip_addr.addr[3]);
-    Sleep();
-    HPET::GetInstance().BusyWait(kWaitTimePerTryMs);
+    liumos->scheduler->SleepFor(kWaitTimePerTryMs * 1'000'000);
     time_passed_ms += kWaitTimePerTryMs;
   }
   kprintf("kernel: ARP resolution failed. (timeout)\n");
@@ -295,17 +235,14 @@ static ssize_t sys_sendto(int sockfd,
   using IPv4Packet = Virtio::Net::IPv4Packet;
   using IPv4Addr = Network::IPv4Addr;
   using EtherAddr = Network::EtherAddr;
-  using Socket = Network::Socket;
 
   Net& virtio_net = Net::GetInstance();
-  Network& network = Network::GetInstance();
-  auto pid = liumos->scheduler->GetCurrentProcess().GetID();
-  auto sock_holder = network.FindSocket(pid, sockfd);
-  if (!sock_holder.has_value()) {
+  Network::Socket* sock = GetSocket(sockfd);
+  if (!sock) {
     kprintf("%s: fd %d is not a socket\n", __func__, sockfd);
     return -1;
   }
-  Socket::Type socket_type = (*sock_holder).type;
+  Network::Socket::Type socket_type = sock->type;
 
   IPv4Addr target_ip_addr = dest_addr->sin_addr;
   std::optional<EtherAddr> target_eth_addr_holder =
@@ -317,8 +254,10 @@ static ssize_t sys_sendto(int sockfd,
   if (socket_type == Network::Socket::Type::kICMPRaw ||
       socket_type == Network::Socket::Type::kICMPDatagram) {
     using ICMPPacket = Virtio::Net::ICMPPacket;
-    ICMPPacket& icmp =
-        *virtio_net.GetNextTXPacketBuf<ICMPPacket*>(sizeof(IPv4Packet) + len);
+    const uint32_t flow_hash = Network::GetFlowHash(
+        target_ip_addr, IPv4Packet::Protocol::kICMP, 0, 0);
+    ICMPPacket& icmp = *virtio_net.GetNextTXPacketBufForFlow<ICMPPacket*>(
+        sizeof(IPv4Packet) + len, flow_hash);
     // ip.eth
     icmp.ip.eth.dst = *target_eth_addr_holder;
     icmp.ip.eth.src = virtio_net.GetSelfEtherAddr();
@@ -344,8 +283,12 @@ static ssize_t sys_sendto(int sockfd,
   if (socket_type == Network::Socket::Type::kUDP) {
     len = (len + 1) & ~1;  // make size even
     using IPv4UDPPacket = Virtio::Net::IPv4UDPPacket;
-    IPv4UDPPacket& udp = *virtio_net.GetNextTXPacketBuf<IPv4UDPPacket*>(
-        sizeof(IPv4UDPPacket) + len);
+    const uint32_t flow_hash =
+        Network::GetFlowHash(target_ip_addr, IPv4Packet::Protocol::kUDP,
+                             sock->listen_port, dest_addr->sin_port);
+    IPv4UDPPacket& udp =
+        *virtio_net.GetNextTXPacketBufForFlow<IPv4UDPPacket*>(
+            sizeof(IPv4UDPPacket) + len, flow_hash);
     // ip.eth
     udp.ip.eth.dst = *target_eth_addr_holder;
     udp.ip.eth.src = virtio_net.GetSelfEtherAddr();
@@ -366,12 +309,22 @@ static ssize_t sys_sendto(int sockfd,
     memcpy(reinterpret_cast<uint8_t*>(&udp) +
                sizeof(IPv4UDPPacket) /*right after the UDP header*/,
            buf, len);
-    udp.SetSourcePort((*sock_holder).listen_port);
+    udp.SetSourcePort(sock->listen_port);
     *reinterpret_cast<uint16_t*>(&udp.dst_port) = dest_addr->sin_port;
     udp.SetDataSize(len);
-    udp.csum = Network::CalcUDPChecksum(
-        &udp, offsetof(IPv4UDPPacket, src_port), sizeof(IPv4UDPPacket) + len,
-        udp.ip.src_ip, udp.ip.dst_ip, udp.length);
+    udp.csum.Clear();
+    if (virtio_net.OffloadsTXChecksum()) {
+      udp.csum = Network::CalcUDPPseudoHeaderChecksum(
+          udp.ip.src_ip, udp.ip.dst_ip, udp.length);
+      virtio_net.SetTXChecksumOffload(
+          offsetof(IPv4UDPPacket, src_port),
+          offsetof(IPv4UDPPacket, csum) - offsetof(IPv4UDPPacket, src_port));
+    } else {
+      udp.csum = Network::CalcUDPChecksum(
+          &udp, offsetof(IPv4UDPPacket, src_port),
+          sizeof(IPv4UDPPacket) + len, udp.ip.src_ip, udp.ip.dst_ip,
+          udp.length);
+    }
     // send
     virtio_net.SendPacket();
     return len;
@@ -380,93 +333,158 @@ static ssize_t sys_sendto(int sockfd,
   return -1;
 }
 
+static void SyscallRead(uint64_t* args) {
+  args[0] = sys_read(static_cast<int>(args[1]),
+                     reinterpret_cast<void*>(args[2]), args[3]);
+}
+
+static void SyscallWrite(uint64_t* args) {
+  args[0] = sys_write(static_cast<int>(args[1]),
+                      reinterpret_cast<const void*>(args[2]), args[3]);
+}
+
+static void SyscallClose(uint64_t* args) {
+  args[0] = sys_close(static_cast<int>(args[1]));
+}
+
+static void SyscallExit(uint64_t* args) {
+  if (liumos->debug_mode_enabled) {
+    const uint64_t exit_code = args[1];
+    PutStringAndHex("exit: exit_code", exit_code);
+  }
+  liumos->scheduler->KillCurrentProcess();
+  Sleep();
+  for (;;) {
+    StoreIntFlagAndHalt();
+  };
+}
+
+static void SyscallArchPrctl(uint64_t* args) {
+  Panic("arch_prctl!");
+  if (args[1] == kArchSetFS) {
+    WriteMSR(MSRIndex::kFSBase, args[2]);
+    return;
+  }
+  PutStringAndHex("arg1", args[1]);
+  PutStringAndHex("arg2", args[2]);
+  PutStringAndHex("arg3", args[3]);
+}
+
+static void SyscallClockGetTime(uint64_t* args) {
+  // Used by user processes when the shared page of Clock has no TSC
+  // parameters. All clocks count from boot.
+  uint64_t* tp = reinterpret_cast<uint64_t*>(args[2]);
+  const uint64_t ns = Clock::ReadNanoSecond();
+  tp[0] = ns / 1'000'000'000;
+  tp[1] = ns % 1'000'000'000;
+  args[0] = 0;
+}
+
+static void SyscallSocket(uint64_t* args) {
+  args[0] = sys_socket(static_cast<int>(args[1]), static_cast<int>(args[2]),
+                       static_cast<int>(args[3]));
+}
+
+static void SyscallSendTo(uint64_t* args) {
+  args[0] =
+      sys_sendto(static_cast<int>(args[1]), reinterpret_cast<void*>(args[2]),
+                 static_cast<size_t>(args[3]), static_cast<int>(args[4]),
+                 reinterpret_cast<const sockaddr_in*>(args[5]),
+                 static_cast<socklen_t>(args[6]));
+}
+
+static void SyscallRecvFrom(uint64_t* args) {
+  args[0] = sys_recvfrom(
+      static_cast<int>(args[1]), reinterpret_cast<void*>(args[2]), args[3],
+      static_cast<int>(args[4]), reinterpret_cast<sockaddr_in*>(args[5]),
+      reinterpret_cast<socklen_t*>(args[6]));
+}
+
+static void SyscallBind(uint64_t* args) {
+  args[0] = sys_bind(static_cast<int>(args[1]),
+                     reinterpret_cast<struct sockaddr_in*>(args[2]),
+                     static_cast<socklen_t>(args[3]));
+}
+
+struct SyscallEntry {
+  const char* name;
+  void (*handler)(uint64_t* args);
+  // Statistics, updated on the BSP
+  uint64_t num_of_calls;
+  uint64_t sum_of_cycles;
+  // Calls which took [2^i, 2^(i+1)) cycles. Calls which do not return, such
+  // as exit, are not counted.
+  uint64_t cycle_histogram[kNumOfSyscallHistogramBuckets];
+};
+
+static SyscallEntry syscall_table_[kNumOfSyscalls];
+static uint64_t num_of_unknown_syscalls_;
+
+static void RegisterSyscall(uint64_t idx,
+                            const char* name,
+                            void (*handler)(uint64_t* args)) {
+  assert(idx < kNumOfSyscalls);
+  assert(!syscall_table_[idx].handler);
+  syscall_table_[idx].name = name;
+  syscall_table_[idx].handler = handler;
+}
+
+void InitSyscallTable() {
+  RegisterSyscall(kSyscallIndex_sys_read, "read", SyscallRead);
+  RegisterSyscall(kSyscallIndex_sys_write, "write", SyscallWrite);
+  RegisterSyscall(kSyscallIndex_sys_close, "close", SyscallClose);
+  RegisterSyscall(kSyscallIndex_sys_socket, "socket", SyscallSocket);
+  RegisterSyscall(kSyscallIndex_sys_sendto, "sendto", SyscallSendTo);
+  RegisterSyscall(kSyscallIndex_sys_recvfrom, "recvfrom", SyscallRecvFrom);
+  RegisterSyscall(kSyscallIndex_sys_bind, "bind", SyscallBind);
+  RegisterSyscall(kSyscallIndex_sys_exit, "exit", SyscallExit);
+  RegisterSyscall(kSyscallIndex_arch_prctl, "arch_prctl", SyscallArchPrctl);
+  RegisterSyscall(kSyscallIndex_sys_clock_gettime, "clock_gettime",
+                  SyscallClockGetTime);
+}
+
 __attribute__((ms_abi)) extern "C" void SyscallHandler(uint64_t* args) {
   // This function will be called under exceptions are masked
   // with Kernel Stack
+  // The kernel is not SMP safe yet, so syscalls are served on the BSP.
+  liumos->scheduler->MigrateCurrentProcessToBSP();
   uint64_t idx = args[0];
-  if (idx == kSyscallIndex_sys_read) {
-    args[0] = sys_read(static_cast<int>(args[1]),
-                       reinterpret_cast<void*>(args[2]), args[3]);
+  if (idx >= kNumOfSyscalls || !syscall_table_[idx].handler) {
+    num_of_unknown_syscalls_++;
+    kprintf("Unhandled syscall. rax = %llu\n", idx);
+    args[0] = ErrorNumber::kNoSystemCall;
     return;
   }
-  if (idx == kSyscallIndex_sys_write) {
-    const uint64_t fildes = args[1];
-    const uint8_t* buf = reinterpret_cast<uint8_t*>(args[2]);
-    uint64_t nbyte = args[3];
-    if (fildes != 1) {
-      kprintf("%s: fd = %d is not supported yet\n", __func__, fildes);
-      args[0] = ErrorNumber::kBadFileDescriptor;
-      return;
-    }
-    if ((nbyte >> 63)) {
-      kprintf("%s: fd = %llu is too big. May be negative?\n", __func__, nbyte);
-      args[0] = ErrorNumber::kInvalid;
-      return;
-    }
-    while (nbyte--) {
-      PutChar(*(buf++));
-    }
-    return;
-  }
-  if (idx == kSyscallIndex_sys_close) {
-    args[0] = 0;
-    return;
-  }
-  if (idx == kSyscallIndex_sys_exit) {
-    if (liumos->debug_mode_enabled) {
-      const uint64_t exit_code = args[1];
-      PutStringAndHex("exit: exit_code", exit_code);
-    }
-    liumos->scheduler->KillCurrentProcess();
-    Sleep();
-    for (;;) {
-      StoreIntFlagAndHalt();
-    };
-    return;
-  }
-  if (idx == kSyscallIndex_arch_prctl) {
-    Panic("arch_prctl!");
-    if (args[1] == kArchSetFS) {
-      WriteMSR(MSRIndex::kFSBase, args[2]);
-      return;
+  SyscallEntry& entry = syscall_table_[idx];
+  entry.num_of_calls++;
+  const uint64_t t0 = __builtin_ia32_rdtsc();
+  entry.handler(args);
+  const uint64_t cycles = __builtin_ia32_rdtsc() - t0;
+  entry.sum_of_cycles += cycles;
+  int bucket = 63 - __builtin_clzll(cycles | 1);
+  if (bucket >= kNumOfSyscallHistogramBuckets)
+    bucket = kNumOfSyscallHistogramBuckets - 1;
+  entry.cycle_histogram[bucket]++;
+}
+
+void PrintSyscallStatistics() {
+  PutString("syscall, calls, avg cycles, histogram (log2 cycles: calls)\n");
+  for (uint64_t i = 0; i < kNumOfSyscalls; i++) {
+    const SyscallEntry& entry = syscall_table_[i];
+    if (!entry.num_of_calls)
+      continue;
+    uint64_t num_of_returns = 0;
+    for (auto n : entry.cycle_histogram)
+      num_of_returns += n;
+    kprintf("%s(%llu), %llu, %llu,", entry.name, i, entry.num_of_calls,
+            num_of_returns ? entry.sum_of_cycles / num_of_returns : 0);
+    for (int b = 0; b < kNumOfSyscallHistogramBuckets; b++) {
+      if (entry.cycle_histogram[b])
+        kprintf(" %d: %llu", b, entry.cycle_histogram[b]);
     }
-    PutStringAndHex("arg1", args[1]);
-    PutStringAndHex("arg2", args[2]);
-    PutStringAndHex("arg3", args[3]);
+    PutString("\n");
   }
-  if (idx == kSyscallIndex_sys_socket) {
-    args[0] = sys_socket(static_cast<int>(args[1]), static_cast<int>(args[2]),
-                         static_cast<int>(args[3]));
-    return;
-  }
-  if (idx == kSyscallIndex_sys_sendto) {
-    args[0] =
-        sys_sendto(static_cast<int>(args[1]), reinterpret_cast<void*>(args[2]),
-                   static_cast<size_t>(args[3]), static_cast<int>(args[4]),
-                   reinterpret_cast<const sockaddr_in*>(args[5]),
-                   static_cast<socklen_t>(args[6]));
-    return;
-  }
-  if (idx == kSyscallIndex_sys_recvfrom) {
-    args[0] = sys_recvfrom(
-        static_cast<int>(args[1]), reinterpret_cast<void*>(args[2]), args[3],
-        static_cast<int>(args[4]), reinterpret_cast<sockaddr_in*>(args[5]),
-        reinterpret_cast<socklen_t*>(args[6]));
-    return;
-  }
-  if (idx == kSyscallIndex_sys_bind) {
-    args[0] = sys_bind(static_cast<int>(args[1]),
-                       reinterpret_cast<struct sockaddr_in*>(args[2]),
-                       static_cast<socklen_t>(args[3]));
-    return;
-  }
-  char s[64];
-  snprintf(s, sizeof(s), "Unhandled syscall. rax = %lu\n", idx);
-  PutString(s);
-  liumos->scheduler->KillCurrentProcess();
-  for (;;) {
-    StoreIntFlagAndHalt();
-  };
+  PutStringAndDecimal("Unknown syscalls", num_of_unknown_syscalls_);
 }
 
 void EnableSyscall() {
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "generic.h"
+
+class TimerWheel {
+  // Hierarchical timing wheel. Level l has kNumOfSlots slots, each of which
+  // covers kNumOfSlots^l ticks. A timer goes to the lowest level whose range
+  // covers its expiry, so adding and cancelling are O(1). When the wheel
+  // reaches a slot of a higher level, its timers are moved to lower levels.
+  // Advance() jumps over empty slots with the bitmap of each level, so
+  // advancing over a long idle period costs nothing per tick.
+  // Ticks are abstract. Callers should serialize the calls.
+ public:
+  class Timer {
+   public:
+    using Callback = void (*)(void* arg);
+    Timer(Callback callback, void* arg)
+        : callback_(callback),
+          arg_(arg),
+          prev_(nullptr),
+          next_(nullptr),
+          expires_(0),
+          level_(0),
+          slot_(0),
+          is_pending_(false) {}
+    bool IsPending() const { return is_pending_; }
+    uint64_t GetExpiry() const { return expires_; }
+    friend class TimerWheel;
+
+   private:
+    Callback callback_;
+    void* arg_;
+    Timer* prev_;
+    Timer* next_;
+    uint64_t expires_;
+    uint8_t level_;
+    uint8_t slot_;
+    bool is_pending_;
+  };
+
+  static constexpr int kSlotBits = 6;
+  static constexpr int kNumOfSlots = 1 << kSlotBits;
+  static constexpr int kNumOfLevels = 6;
+  static constexpr uint64_t kNoEvent = ~0ULL;
+
+  TimerWheel(uint64_t now) : now_(now), num_of_timers_(0) {
+    for (auto& level : levels_) {
+      level.bitmap = 0;
+      for (auto& slot : level.slots)
+        slot = nullptr;
+    }
+  }
+  uint64_t GetNow() const { return now_; }
+  int GetNumOfTimers() const { return num_of_timers_; }
+  // The callback is called by the first Advance() to expires or later.
+  // Expiries in the past are treated as the next tick.
+  void Add(Timer& timer, uint64_t expires) {
+    assert(!timer.is_pending_);
+    timer.expires_ = expires <= now_ ? now_ + 1 : expires;
+    Place(timer);
+    num_of_timers_++;
+  }
+  // Returns false if timer is not pending.
+  bool Cancel(Timer& timer) {
+    if (!timer.is_pending_)
+      return false;
+    Unlink(timer);
+    num_of_timers_--;
+    return true;
+  }
+  // Moves the wheel to now and calls the callbacks of the expired timers in
+  // order of expiry. GetNow() returns the expiry during the callbacks, which
+  // may add or cancel timers.
+  void Advance(uint64_t now) {
+    while (now_ < now) {
+      const uint64_t next = GetNextEvent();
+      if (next > now) {
+        now_ = now;
+        return;
+      }
+      now_ = next;
+      for (int level = kNumOfLevels - 1; level > 0; level--) {
+        const int shift = level * kSlotBits;
+        if (now_ & ((1ULL << shift) - 1))
+          continue;
+        Cascade(level, (now_ >> shift) & kSlotMask);
+      }
+      Expire(now_ & kSlotMask);
+    }
+  }
+  // Returns the tick at which Advance() has something to do, or kNoEvent.
+  // It is the earliest expiry, or earlier if timers are moved between
+  // levels before it.
+  uint64_t GetNextEvent() const {
+    uint64_t next = kNoEvent;
+    for (int level = 0; level < kNumOfLevels; level++) {
+      const uint64_t bitmap = levels_[level].bitmap;
+      if (!bitmap)
+        continue;
+      const int shift = level * kSlotBits;
+      // Slots are reached in order from the one after the current slot,
+      // wrapping around to the current slot.
+      const int start = static_cast<int>(((now_ >> shift) + 1) & kSlotMask);
+      const uint64_t rotated =
+          (bitmap >> start) | (bitmap << ((kNumOfSlots - start) & kSlotMask));
+      const uint64_t distance = __builtin_ctzll(rotated) + 1;
+      const uint64_t event = ((now_ >> shift) + distance) << shift;
+      if (event < next)
+        next = event;
+    }
+    return next;
+  }
+
+ private:
+  static constexpr uint64_t kSlotMask = kNumOfSlots - 1;
+  static constexpr uint64_t kMaxDelta =
+      (1ULL << (kNumOfLevels * kSlotBits)) - 1;
+  static_assert(kNumOfSlots == 64, "bitmap is uint64_t");
+  struct Level {
+    uint64_t bitmap;
+    Timer* slots[kNumOfSlots];
+  };
+
+  void Place(Timer& timer) {
+    // Timers beyond the top level are put at its end, and placed again
+    // when the wheel reaches there.
+    uint64_t delta = timer.expires_ - now_;
+    if (delta > kMaxDelta)
+      delta = kMaxDelta;
+    const uint64_t expires = now_ + delta;
+    int level = 0;
+    while (delta >> ((level + 1) * kSlotBits))
+      level++;
+    const int slot = static_cast<int>((expires >> (level * kSlotBits)) &
+                                      kSlotMask);
+    Level& l = levels_[level];
+    timer.level_ = static_cast<uint8_t>(level);
+    timer.slot_ = static_cast<uint8_t>(slot);
+    timer.prev_ = nullptr;
+    timer.next_ = l.slots[slot];
+    if (timer.next_)
+      timer.next_->prev_ = &timer;
+    l.slots[slot] = &timer;
+    l.bitmap |= 1ULL << slot;
+    timer.is_pending_ = true;
+  }
+  void Unlink(Timer& timer) {
+    Level& l = levels_[timer.level_];
+    if (timer.prev_)
+      timer.prev_->next_ = timer.next_;
+    else
+      l.slots[timer.slot_] = timer.next_;
+    if (timer.next_)
+      timer.next_->prev_ = timer.prev_;
+    if (!l.slots[timer.slot_])
+      l.bitmap &= ~(1ULL << timer.slot_);
+    timer.prev_ = nullptr;
+    timer.next_ = nullptr;
+    timer.is_pending_ = false;
+  }
+  void Cascade(int level, uint64_t slot) {
+    Level& l = levels_[level];
+    Timer* timer = l.slots[slot];
+    l.slots[slot] = nullptr;
+    l.bitmap &= ~(1ULL << slot);
+    while (timer) {
+      Timer* next = timer->next_;
+      Place(*timer);
+      timer = next;
+    }
+  }
+  void Expire(uint64_t slot) {
+    while (Timer* timer = levels_[0].slots[slot]) {
+      Unlink(*timer);
+      num_of_timers_--;
+      timer->callback_(timer->arg_);
+    }
+  }
+
+  uint64_t now_;
+  int num_of_timers_;
+  Level levels_[kNumOfLevels];
+};
@@ -0,0 +1,118 @@
+#include "timer_wheel.h"
+
+#ifdef LIUMOS_TEST
+
+#include <stdio.h>
+
+#include <cassert>
+#include <vector>
+
+using Timer = TimerWheel::Timer;
+
+struct Record {
+  TimerWheel* wheel;
+  uint64_t expires;
+  uint64_t fired_at;
+  int num_of_fires;
+};
+
+void OnExpire(void* arg) {
+  Record& r = *reinterpret_cast<Record*>(arg);
+  r.fired_at = r.wheel->GetNow();
+  r.num_of_fires++;
+}
+
+uint64_t NextRandom(uint64_t& state) {
+  state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return state >> 16;
+}
+
+void TestBasic() {
+  TimerWheel wheel(100);
+  Record r1{&wheel, 105, 0, 0};
+  Record r2{&wheel, 100 + 64 * 64 + 3, 0, 0};
+  Timer t1(OnExpire, &r1);
+  Timer t2(OnExpire, &r2);
+  assert(wheel.GetNextEvent() == TimerWheel::kNoEvent);
+  wheel.Add(t1, r1.expires);
+  wheel.Add(t2, r2.expires);
+  assert(wheel.GetNumOfTimers() == 2);
+  assert(wheel.GetNextEvent() == 105);
+  wheel.Advance(104);
+  assert(r1.num_of_fires == 0);
+  wheel.Advance(200);
+  assert(r1.num_of_fires == 1 && r1.fired_at == 105);
+  assert(!t1.IsPending() && t2.IsPending());
+  wheel.Advance(r2.expires - 1);
+  assert(r2.num_of_fires == 0);
+  wheel.Advance(r2.expires);
+  assert(r2.num_of_fires == 1 && r2.fired_at == r2.expires);
+  assert(wheel.GetNumOfTimers() == 0);
+
+  // Cancelled timers do not fire, and expiries in the past fire next.
+  Record r3{&wheel, 0, 0, 0};
+  Timer t3(OnExpire, &r3);
+  wheel.Add(t3, wheel.GetNow() + 10);
+  assert(wheel.Cancel(t3));
+  assert(!wheel.Cancel(t3));
+  wheel.Advance(wheel.GetNow() + 100);
+  assert(r3.num_of_fires == 0);
+  wheel.Add(t3, 0);
+  wheel.Advance(wheel.GetNow() + 1);
+  assert(r3.num_of_fires == 1);
+}
+
+void TestRandom() {
+  // Compares the wheel with expiries of random timers, including ones
+  // beyond the range of the top level.
+  constexpr int kNumOfTimers = 2000;
+  uint64_t seed = 1;
+  TimerWheel wheel(12345);
+  std::vector<Record> records(kNumOfTimers);
+  std::vector<Timer> timers;
+  timers.reserve(kNumOfTimers);
+  for (int i = 0; i < kNumOfTimers; i++) {
+    Record& r = records[i];
+    r = {&wheel, 0, 0, 0};
+    timers.emplace_back(OnExpire, &r);
+    const int shift = static_cast<int>(NextRandom(seed) % 40);
+    r.expires = wheel.GetNow() + 1 + NextRandom(seed) % (1ULL << shift);
+    wheel.Add(timers[i], r.expires);
+  }
+  std::vector<bool> cancelled(kNumOfTimers);
+  for (int i = 0; i < kNumOfTimers; i += 7) {
+    assert(wheel.Cancel(timers[i]));
+    cancelled[i] = true;
+  }
+  while (wheel.GetNumOfTimers()) {
+    const uint64_t next = wheel.GetNextEvent();
+    assert(next != TimerWheel::kNoEvent && next > wheel.GetNow());
+    for (int i = 0; i < kNumOfTimers; i++) {
+      if (timers[i].IsPending())
+        assert(next <= records[i].expires);
+    }
+    const int shift = static_cast<int>(NextRandom(seed) % 36);
+    wheel.Advance(wheel.GetNow() + 1 + NextRandom(seed) % (1ULL << shift));
+    for (int i = 0; i < kNumOfTimers; i++) {
+      Record& r = records[i];
+      if (cancelled[i]) {
+        assert(r.num_of_fires == 0);
+        continue;
+      }
+      if (r.expires <= wheel.GetNow()) {
+        assert(r.num_of_fires == 1 && r.fired_at == r.expires);
+      } else {
+        assert(r.num_of_fires == 0 && timers[i].IsPending());
+      }
+    }
+  }
+}
+
+int main() {
+  TestBasic();
+  TestRandom();
+  puts("PASS");
+  return 0;
+}
+
+#endif
@@ -0,0 +1,164 @@
+#include "tlb.h"
+
+#include "liumos.h"
+#include "util.h"
+
+constexpr uint64_t kCR4BitPGE = 1ULL << 7;
+constexpr uint64_t kCR4BitPCIDE = 1ULL << 17;
+
+// c.f. Intel SDM Vol.2 INVPCID
+constexpr uint64_t kINVPCIDIndividualAddress = 0;
+constexpr uint64_t kINVPCIDSingleContext = 1;
+constexpr uint64_t kINVPCIDAllContextsWithGlobal = 2;
+
+void TLB::InitForCurrentProcessor() {
+  const uint64_t features = liumos->cpu_features->features;
+  uint64_t cr4 = ReadCR4();
+  if (GetBit<CPUFeatureIndex::kPGE>(features)) {
+    cr4 |= kCR4BitPGE;
+    uses_pge_ = true;
+  }
+  if (GetBit<CPUFeatureIndex::kPCID>(features)) {
+    // PCIDE can be set only when CR3 has PCID 0.
+    assert((ReadCR3() & kCR3PCIDMask) == 0);
+    cr4 |= kCR4BitPCIDE;
+    uses_pcid_ = true;
+    uses_invpcid_ = GetBit<CPUFeatureIndex::kINVPCID>(features);
+  }
+  WriteCR4(cr4);
+}
+
+void TLB::AssignPCID(Process& proc) {
+  proc.pcid_ = kKernelPCID;
+  if (!uses_pcid_)
+    return;
+  IA_PML4& pml4 = proc.GetExecutionContext().GetCR3();
+  if (GetKernelVirtAddrForPhysAddr(&pml4) == &GetKernelPML4())
+    return;
+  uint16_t pcid = kUntrackedPCID;
+  lock_.Lock();
+  for (int i = 0; i < kNumOfPCIDs / 64; i++) {
+    uint64_t used = pcid_bitmap_[i];
+    if (i == kKernelPCID / 64)
+      used |= 1ULL << (kKernelPCID % 64);
+    if (i == kUntrackedPCID / 64)
+      used |= 1ULL << (kUntrackedPCID % 64);
+    if (used == ~0ULL)
+      continue;
+    const int bit = __builtin_ctzll(~used);
+    pcid_bitmap_[i] |= 1ULL << bit;
+    pcid = static_cast<uint16_t>(i * 64 + bit);
+    break;
+  }
+  lock_.Unlock();
+  // Entries of the previous owner may be left on any processor.
+  BumpGeneration(pcid);
+  proc.pcid_ = pcid;
+}
+
+void TLB::ReleasePCID(Process& proc) {
+  const uint16_t pcid = proc.pcid_;
+  proc.pcid_ = kKernelPCID;
+  if (pcid == kKernelPCID || pcid == kUntrackedPCID)
+    return;
+  lock_.Lock();
+  pcid_bitmap_[pcid / 64] &= ~(1ULL << (pcid % 64));
+  lock_.Unlock();
+}
+
+uint64_t TLB::BumpGeneration(uint16_t pcid) {
+  const uint64_t generation =
+      __atomic_add_fetch(&last_generation_, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&generations_[pcid], generation, __ATOMIC_RELEASE);
+  return generation;
+}
+
+void TLB::OnSwitch(Processor& cpu, Process& to) {
+  const uint64_t cr3 = to.GetExecutionContext().GetCPUContext().cr3;
+  Stats& stats = stats_[cpu.GetIndex()];
+  if (!uses_pcid_) {
+    if (ReadCR3() == cr3)
+      return;
+    WriteCR3(cr3);
+    stats.num_of_flushing_switches++;
+    return;
+  }
+  const uint16_t pcid = to.pcid_;
+  const uint64_t new_cr3 = cr3 | pcid;
+  Tag& tag = tags_[cpu.GetIndex()][pcid];
+  const uint64_t generation =
+      __atomic_load_n(&generations_[pcid], __ATOMIC_ACQUIRE);
+  if (pcid != kUntrackedPCID && tag.cr3 == cr3 &&
+      tag.generation == generation) {
+    if (ReadCR3() == new_cr3)
+      return;
+    WriteCR3(new_cr3 | kCR3NoFlush);
+    stats.num_of_tagged_switches++;
+    return;
+  }
+  // The entries of pcid on this processor may be of another page table or
+  // older than the changes made by others.
+  tag.cr3 = cr3;
+  tag.generation = generation;
+  WriteCR3(new_cr3);
+  stats.num_of_flushing_switches++;
+}
+
+void TLB::InvalidateRange(uint64_t vaddr, uint64_t byte_size) {
+  const uint64_t cr3 = ReadCR3();
+  const uint16_t pcid =
+      uses_pcid_ ? static_cast<uint16_t>(cr3 & kCR3PCIDMask) : kKernelPCID;
+  const uint64_t num_of_pages = ByteSizeToPageSize(byte_size);
+  if (num_of_pages <= kMaxPagesToInvalidateOneByOne) {
+    for (uint64_t i = 0; i < num_of_pages; i++) {
+      const uint64_t addr = vaddr + (i << kPageSizeExponent);
+      if (uses_invpcid_)
+        InvalidatePCID(kINVPCIDIndividualAddress, pcid, addr);
+      else
+        InvalidatePage(addr);
+    }
+  } else if (uses_invpcid_) {
+    InvalidatePCID(kINVPCIDSingleContext, pcid, 0);
+  } else {
+    // Flushes the non-global entries of the current PCID.
+    WriteCR3(cr3);
+  }
+  Processor& cpu = GetCurrentProcessor();
+  stats_[cpu.GetIndex()].num_of_invalidated_pages += num_of_pages;
+  if (!uses_pcid_ || pcid == kUntrackedPCID)
+    return;
+  const uint64_t generation = BumpGeneration(pcid);
+  // The entries on this processor are up to date.
+  Tag& tag = tags_[cpu.GetIndex()][pcid];
+  if (tag.cr3 == (cr3 & ~kCR3PCIDMask))
+    tag.generation = generation;
+}
+
+void TLB::FlushAll() {
+  if (uses_invpcid_) {
+    InvalidatePCID(kINVPCIDAllContextsWithGlobal, 0, 0);
+    return;
+  }
+  // Toggling PGE flushes the entries of all PCIDs. c.f. Intel SDM Vol.3
+  // 4.10.4.1
+  const uint64_t cr4 = ReadCR4();
+  if (cr4 & kCR4BitPGE) {
+    WriteCR4(cr4 & ~kCR4BitPGE);
+    WriteCR4(cr4);
+    return;
+  }
+  WriteCR3(ReadCR3());
+}
+
+void TLB::PrintStatistics() {
+  PutStringAndBool("PGE", uses_pge_);
+  PutStringAndBool("PCID", uses_pcid_);
+  PutStringAndBool("INVPCID", uses_invpcid_);
+  for (int i = 0; i < GetNumOfProcessors(); i++) {
+    const Stats& stats = stats_[i];
+    PutStringAndDecimal("CPU", i);
+    PutStringAndDecimal("  tagged switches", stats.num_of_tagged_switches);
+    PutStringAndDecimal("  flushing switches", stats.num_of_flushing_switches);
+    PutStringAndDecimal("  invalidated pages", stats.num_of_invalidated_pages);
+  }
+}
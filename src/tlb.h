@@ -0,0 +1,71 @@
+#pragma once
+
+#include "generic.h"
+#include "processor.h"
+#include "spinlock.h"
+
+class Process;
+
+class TLB {
+  // Keeps TLB entries across context switches. Kernel mappings in the upper
+  // half are global, so they survive CR3 writes. With PCID, each process
+  // gets its own tag while it is registered to the scheduler, and switching
+  // to a process reuses the entries left by its last run. Kernel tasks share
+  // kKernelPCID with the kernel page table.
+  // Changes of page tables are invalidated on the current processor at
+  // once. Other processors are not interrupted. Instead, each PCID has a
+  // generation which is bumped on changes, and a processor flushes the
+  // entries of a PCID when it loads the PCID with an old generation or with
+  // another page table.
+ public:
+  static constexpr int kNumOfPCIDs = 256;
+  static constexpr uint16_t kKernelPCID = 0;
+  // Given when the others are used up. Its entries are flushed on every
+  // switch.
+  static constexpr uint16_t kUntrackedPCID = kNumOfPCIDs - 1;
+
+  // Enables PGE and PCID if available. CR3 should have kKernelPCID.
+  static void InitForCurrentProcessor();
+  static bool IsPCIDEnabled() { return uses_pcid_; }
+  // Called with the page table of proc set.
+  static void AssignPCID(Process& proc);
+  static void ReleasePCID(Process& proc);
+  // Loads the page table of to. Called on context switches with interrupts
+  // disabled.
+  static void OnSwitch(Processor& cpu, Process& to);
+  // Invalidates [vaddr, vaddr + byte_size) of the page table loaded on the
+  // current processor.
+  static void InvalidateRange(uint64_t vaddr, uint64_t byte_size);
+  // Flushes all the entries on the current processor, including global ones.
+  static void FlushAll();
+  static void PrintStatistics();
+
+ private:
+  struct Tag {
+    uint64_t cr3;
+    uint64_t generation;
+  };
+  struct Stats {
+    // CR3 writes which kept the entries of the PCID
+    uint64_t num_of_tagged_switches;
+    // CR3 writes which flushed them
+    uint64_t num_of_flushing_switches;
+    uint64_t num_of_invalidated_pages;
+  };
+  // Makes processors flush the entries of pcid at the next switch. Returns
+  // the new generation.
+  static uint64_t BumpGeneration(uint16_t pcid);
+
+  static constexpr int kMaxPagesToInvalidateOneByOne = 32;
+  inline static bool uses_pge_ = false;
+  inline static bool uses_pcid_ = false;
+  inline static bool uses_invpcid_ = false;
+  // Protects pcid_bitmap_
+  inline static SpinLock lock_;
+  inline static uint64_t pcid_bitmap_[kNumOfPCIDs / 64];
+  inline static uint64_t generations_[kNumOfPCIDs];
+  inline static uint64_t last_generation_;
+  // Updated only by the owner processor
+  inline static Tag tags_[Processor::kMaxNumOfProcessors][kNumOfPCIDs];
+  inline static Stats stats_[Processor::kMaxNumOfProcessors];
+};
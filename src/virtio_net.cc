@@ -61,15 +61,23 @@ constexpr static uint8_t kDeviceStatusFeaturesOK = 8;
 // constexpr static uint8_t kDeviceStatusDeviceNeedsReset = 64;
 // constexpr static uint8_t kDeviceStatusFailed = 128;
 
+constexpr static uint32_t kFeaturesChecksum = (1 << 0);
+constexpr static uint32_t kFeaturesGuestChecksum = (1 << 1);
 constexpr static uint32_t kFeaturesMAC = (1 << 5);
 constexpr static uint32_t kFeaturesStatus = (1 << 16);
+constexpr static uint32_t kFeaturesControlVirtqueue = (1 << 17);
+constexpr static uint32_t kFeaturesMultiQueue = (1 << 22);
+constexpr static uint32_t kFeaturesEventIndex = (1 << 29);
+
+// 4.1.5.1.2.1 Device Requirements: MSI-X Vector Configuration
+constexpr static uint16_t kMSIXNoVector = 0xFFFF;
 
 static uint64_t CalcSizeOfVirtqueue(int queue_size) {
-  // First part: Descriptor Table + Available Ring
-  // Second part: Used Ring
+  // First part: Descriptor Table + Available Ring (with used_event)
+  // Second part: Used Ring (with avail_event)
   return CeilToPageAlignment(sizeof(Net::Virtqueue::Descriptor) * queue_size +
-                             sizeof(uint16_t) * (2 + queue_size)) +
-         CeilToPageAlignment(sizeof(uint16_t) * 2 +
+                             sizeof(uint16_t) * (3 + queue_size)) +
+         CeilToPageAlignment(sizeof(uint16_t) * 3 +
                              sizeof(uint32_t) * 2 * queue_size);
 }
 
@@ -77,6 +85,7 @@ void Net::Virtqueue::Alloc(int queue_size) {
   // 2.6.2 Legacy Interfaces: A Note on Virtqueue Layout
   assert(0 <= queue_size && queue_size <= kMaxQueueSize);
   queue_size_ = queue_size;
+  uses_event_idx_ = false;
   const uint64_t buf_size = CalcSizeOfVirtqueue(queue_size);
   base_ = AllocMemoryForMappedIO<uint8_t*>(buf_size);
   bzero(base_, buf_size);
@@ -101,27 +110,67 @@ void Net::Virtqueue::SetDescriptor(int idx,
   desc.next = next;
 }
 
+volatile uint16_t* Net::Virtqueue::GetAvailableRing() {
+  // flags, idx, ring[queue_size_], used_event
+  return reinterpret_cast<volatile uint16_t*>(base_ + sizeof(Descriptor) *
+                                                          queue_size_);
+}
+
+uint8_t* Net::Virtqueue::GetUsedRing() {
+  // flags, idx, ring[queue_size_], avail_event
+  return base_ +
+         CeilToPageAlignment(sizeof(Descriptor) * queue_size_ +
+                             sizeof(uint16_t) * (3 + queue_size_));
+}
+
 uint16_t Net::Virtqueue::GetUsedRingIndex() {
   // This function returns the index of used ring
   // which will be written by device on the next data arriving.
-  volatile uint16_t& pidx = *reinterpret_cast<volatile uint16_t*>(
-      base_ +
-      CeilToPageAlignment(sizeof(Descriptor) * queue_size_ +
-                          sizeof(uint16_t) * (2 * queue_size_)) +
-      sizeof(uint16_t));
+  volatile uint16_t& pidx =
+      *reinterpret_cast<volatile uint16_t*>(GetUsedRing() + sizeof(uint16_t));
   return pidx;
 }
 
 Net::Virtqueue::UsedRingEntry& Net::Virtqueue::GetUsedRingEntry(int idx) {
   assert(0 <= idx && idx < queue_size_);
-  UsedRingEntry* used_ring = reinterpret_cast<UsedRingEntry*>(
-      base_ +
-      CeilToPageAlignment(sizeof(Descriptor) * queue_size_ +
-                          sizeof(uint16_t) * (2 * queue_size_)) +
-      2 * sizeof(uint16_t));
+  UsedRingEntry* used_ring =
+      reinterpret_cast<UsedRingEntry*>(GetUsedRing() + 2 * sizeof(uint16_t));
   return used_ring[idx];
 }
 
+void Net::Virtqueue::SuppressInterrupts() {
+  // VIRTQ_AVAIL_F_NO_INTERRUPT. With VIRTIO_F_EVENT_IDX, the flag is ignored
+  // and the device interrupts only when the used index passes used_event,
+  // which stays 0 unless it is set.
+  GetAvailableRing()[0] = 1;
+}
+
+void Net::Virtqueue::EnableInterrupts(uint16_t used_idx) {
+  GetAvailableRing()[0] = 0;
+  SetUsedEvent(used_idx);
+  // The caller checks the used index after this, so an entry used before
+  // the device sees used_event is not missed.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void Net::Virtqueue::SetUsedEvent(uint16_t idx) {
+  GetAvailableRing()[2 + queue_size_] = idx;
+}
+
+bool Net::Virtqueue::NeedsNotification(uint16_t old_idx, uint16_t new_idx) {
+  // 2.6.10.2 Driver Requirements: Virtqueue Notification Suppression
+  // The available index should be visible to the device before its
+  // suppression state is read.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  volatile uint16_t* used = reinterpret_cast<volatile uint16_t*>(GetUsedRing());
+  if (!uses_event_idx_)
+    return !(used[0] & 1 /* VIRTQ_USED_F_NO_NOTIFY */);
+  // Notifies if avail_event is in [old_idx, new_idx).
+  const uint16_t avail_event = used[2 + queue_size_ * 2];
+  return static_cast<uint16_t>(new_idx - avail_event - 1) <
+         static_cast<uint16_t>(new_idx - old_idx);
+}
+
 void PrintARPPacket(Net::ARPPacket& arp) {
   switch (arp.GetOperation()) {
     case Net::ARPPacket::Operation::kRequest:
@@ -178,7 +227,7 @@ static bool ARPPacketHandler(uint8_t* frame_data, size_t frame_size) {
   ARPPacket& reply = *net.GetNextTXPacketBuf<ARPPacket*>(sizeof(ARPPacket));
   reply.SetupReply(arp.sender_proto_addr, net.GetSelfIPv4Addr(),
                    arp.sender_eth_addr, net.GetSelfEtherAddr());
-  net.SendPacket();
+  net.QueuePacket();
   return true;
 }
 
@@ -193,20 +242,24 @@ static void SendICMPEchoReply(const ICMPPacket& req, size_t req_frame_size) {
   memcpy(&reply, &req, req_frame_size);
   // Setup ICMP
   reply.type = ICMPPacket::Type::kEchoReply;
-  reply.csum.Clear();
-  reply.csum = Network::InternetChecksum::Calc(
-      &reply, offsetof(ICMPPacket, type), req_frame_size);
-  // Setup IP
+  if (net.OffloadsTXChecksum()) {
+    reply.csum.Clear();
+    net.SetTXChecksumOffload(
+        offsetof(ICMPPacket, type),
+        offsetof(ICMPPacket, csum) - offsetof(ICMPPacket, type));
+  } else {
+    // Only the word of type and code is changed.
+    reply.csum = req.csum.Update(InternetChecksum::Load<uint16_t>(&req.type),
+                                 InternetChecksum::Load<uint16_t>(&reply.type));
+  }
+  // Setup IP. Swapping the addresses keeps the checksum.
   reply.ip.dst_ip = req.ip.src_ip;
   reply.ip.src_ip = req.ip.dst_ip;
-  reply.ip.csum.Clear();
-  reply.ip.csum = Network::InternetChecksum::Calc(
-      &reply, offsetof(IPv4Packet, version_and_ihl), req_frame_size);
   // Setup Eth
   reply.ip.eth.dst = req.ip.eth.src;
   reply.ip.eth.src = net.GetSelfEtherAddr();
   // Send
-  net.SendPacket();
+  net.QueuePacket();
   PutString("Reply sent!: ");
 
   // UDP
@@ -224,9 +277,19 @@ static void SendICMPEchoReply(const ICMPPacket& req, size_t req_frame_size) {
   p.SetSourcePort(12345);
   p.SetDataSize(strlen(s));
   p.csum.Clear();
-  p.csum = Network::CalcUDPChecksum(&p, offsetof(IPv4UDPPacket, src_port),
-                                    packet_size, req.ip.dst_ip, req.ip.src_ip,
-                                    p.length);
+  if (net.OffloadsTXChecksum()) {
+    p.csum = Network::CalcUDPPseudoHeaderChecksum(req.ip.dst_ip,
+                                                  req.ip.src_ip, p.length);
+    net.SetTXChecksumOffload(
+        offsetof(IPv4UDPPacket, src_port),
+        offsetof(IPv4UDPPacket, csum) - offsetof(IPv4UDPPacket, src_port));
+  } else {
+    // This runs in the NetworkManager task, which may use SIMD.
+    const uint64_t sum = InternetChecksum::SumWithSIMD(
+        &p.src_port, packet_size - offsetof(IPv4UDPPacket, src_port),
+        Network::SumUDPPseudoHeader(req.ip.dst_ip, req.ip.src_ip, p.length));
+    p.csum = InternetChecksum::FromSum(sum);
+  }
   // Setup IP
   p.ip.protocol = IPv4Packet::Protocol::kUDP;
   p.ip.SetDataLength(packet_size - sizeof(IPv4Packet));
@@ -239,7 +302,7 @@ static void SendICMPEchoReply(const ICMPPacket& req, size_t req_frame_size) {
   p.ip.eth.dst = req.ip.eth.src;
   p.ip.eth.src = net.GetSelfEtherAddr();
   // Send
-  net.SendPacket();
+  net.QueuePacket();
 }
 
 static bool ICMPPacketHandler(IPv4Packet& p, size_t frame_size) {
@@ -335,40 +398,131 @@ static bool IPv4PacketHandler(uint8_t* frame_data, size_t frame_size) {
   return true;
 }
 
-void Net::ProcessPacket(uint8_t* buf, size_t buf_size) {
-  size_t frame_size = buf_size - sizeof(Net::PacketBufHeader);
-  uint8_t* frame_data = buf + sizeof(Net::PacketBufHeader);
+void Net::ProcessPacket(PacketBuffer& buf) {
+  size_t frame_size = buf.GetFrameSize();
+  uint8_t* frame_data = buf.GetFrame();
   ARPPacketHandler(frame_data, frame_size) ||
       IPv4PacketHandler(frame_data, frame_size);
-  Network::GetInstance().PushToRXBuffer(frame_data, 0, frame_size);
+  Network::GetInstance().DeliverToSockets(buf);
 }
 
-void Net::PollRXQueue() {
-  auto& rxq = vq_[kIndexOfRXVirtqueue];
-  auto& rxq_cursor_ = vq_cursor_[kIndexOfRXVirtqueue];
-  if (rxq.GetUsedRingIndex() == rxq_cursor_) {
-    return;
+int Net::PollRXQueue(QueuePair& pair, int budget) {
+  auto& rxq = pair.rxq;
+  if (rxq.GetUsedRingIndex() == pair.rx_cursor) {
+    return 0;
   }
-  while (rxq.GetUsedRingIndex() != rxq_cursor_) {
-    int idx = rxq_cursor_ % vq_size_[kIndexOfRXVirtqueue];
-    Net::ProcessPacket(rxq.GetDescriptorBuf(idx),
-                       rxq.GetUsedRingEntry(idx).len);
+  pair.num_of_rx_polls++;
+  polling_pair_ = &pair;
+  const uint16_t old_avail_idx = pair.rx_cursor + pair.rx_size;
+  int num_of_processed = 0;
+  for (; num_of_processed < budget && rxq.GetUsedRingIndex() != pair.rx_cursor;
+       num_of_processed++) {
+    int idx = pair.rx_cursor % pair.rx_size;
+    const uint32_t len = rxq.GetUsedRingEntry(idx).len;
+    PacketBuffer& buf = PacketBuffer::FromData(rxq.GetDescriptorBuf(idx));
+    // The buffer is replaced before processing, since sockets may keep it.
+    // If no buffer is left, the frame is dropped and the buffer is reused.
+    PacketBuffer* fresh = pair.rx_pool.Alloc();
+    if (fresh && len >= sizeof(PacketBufHeader)) {
+      rxq.SetDescriptor(idx, fresh->GetData(),
+                        static_cast<uint32_t>(PacketBuffer::kDataSize),
+                        2 /* device write only */, 0);
+      buf.SetFrame(sizeof(PacketBufHeader), len - sizeof(PacketBufHeader));
+      ProcessPacket(buf);
+      buf.Unref();
+      pair.num_of_rx_packets++;
+    } else {
+      if (fresh)
+        fresh->Unref();
+      pair.num_of_rx_drops++;
+    }
     rxq.GetUsedRingEntry(idx).len = 0;
-    rxq_cursor_++;
+    pair.rx_cursor++;
   }
-  rxq.SetAvailableRingIndex(rxq_cursor_ - 1);
-  WriteConfigReg16(16 /* Queue Notify */, kIndexOfRXVirtqueue);
+  polling_pair_ = nullptr;
+  // Each processed descriptor is given back to the device in the same slot,
+  // so the whole ring stays available.
+  const uint16_t avail_idx = pair.rx_cursor + pair.rx_size;
+  rxq.SetAvailableRingIndex(avail_idx);
+  if (rxq.NeedsNotification(old_avail_idx, avail_idx))
+    WriteConfigReg16(16 /* Queue Notify */, 2 * pair.index);
+  return num_of_processed;
 }
 
-void Net::SendPacket() {
-  const int idx =
-      vq_cursor_[kIndexOfTXVirtqueue] % vq_size_[kIndexOfTXVirtqueue];
-  auto& txq = vq_[kIndexOfTXVirtqueue];
-  uint8_t* data = txq.GetDescriptorBuf(idx);
-  uint32_t data_size = txq.GetDescriptorSize(idx);
-  if (debug_mode_enabled_) {
-    kprintbuf("SendPacket data", data, sizeof(PacketBufHeader), data_size);
+bool Net::PollRXQueues(int budget) {
+  if (!initialized_)
+    return false;
+  bool is_busy = false;
+  for (int i = 0; i < num_of_queue_pairs_; i++) {
+    if (PollRXQueue(queue_pairs_[i], budget) == budget)
+      is_busy = true;
   }
+  // Frames sent while processing them are kicked at once.
+  KickTXQueue();
+  return is_busy;
+}
+
+void Net::WaitForRXPackets() {
+  uint16_t cursors[kMaxNumOfQueuePairs];
+  for (int i = 0; i < num_of_queue_pairs_; i++) {
+    cursors[i] = queue_pairs_[i].rx_cursor;
+    queue_pairs_[i].rxq.EnableInterrupts(cursors[i]);
+  }
+  rx_wait_queue_.WaitUntil([this, &cursors] {
+    for (int i = 0; i < num_of_queue_pairs_; i++) {
+      if (queue_pairs_[i].rxq.GetUsedRingIndex() != cursors[i])
+        return true;
+    }
+    return false;
+  });
+  // Frames are polled without interrupts until the queues are drained.
+  for (int i = 0; i < num_of_queue_pairs_; i++)
+    queue_pairs_[i].rxq.SuppressInterrupts();
+}
+
+void Net::RXInterruptHandler(uint64_t intcode, InterruptInfo*) {
+  Net& net = GetInstance();
+  for (int i = 0; i < net.num_of_queue_pairs_; i++) {
+    QueuePair& pair = net.queue_pairs_[i];
+    if (pair.rx_vector != intcode)
+      continue;
+    pair.num_of_rx_interrupts++;
+    pair.rxq.SuppressInterrupts();
+  }
+  net.rx_wait_queue_.WakeUpAll();
+  liumos->bsp_local_apic->SendEndOfInterrupt();
+}
+
+void Net::ReclaimTXDescriptors(QueuePair& pair) {
+  // The device uses TX descriptors in order, so the used index tells how
+  // many of them can be reused.
+  pair.tx_reclaimed_idx = pair.txq.GetUsedRingIndex();
+}
+
+uint8_t* Net::AllocTXPacketBuf(size_t size, QueuePair& pair) {
+  if (!initialized_) {
+    Panic("Virtio::Net not initialized yet");
+  }
+  uint32_t buf_size = static_cast<uint32_t>(sizeof(PacketBufHeader) + size);
+  assert(buf_size < kPageSize);
+  tx_irq_was_enabled_ = DisableInterrupts();
+  tx_pair_ = &pair;
+  const uint16_t cursor = pair.tx_cursor;
+  ReclaimTXDescriptors(pair);
+  if (static_cast<uint16_t>(cursor - pair.tx_reclaimed_idx) >= pair.tx_size) {
+    // Backpressure: makes sure that the device sees the queued frames and
+    // waits for it to complete one.
+    pair.num_of_tx_ring_full++;
+    KickTXQueue(pair);
+    do {
+      __builtin_ia32_pause();
+      ReclaimTXDescriptors(pair);
+    } while (static_cast<uint16_t>(cursor - pair.tx_reclaimed_idx) >=
+             pair.tx_size);
+  }
+  auto& txq = pair.txq;
+  const int idx = cursor % pair.tx_size;
+  txq.SetDescriptor(idx, txq.GetDescriptorBuf(idx), buf_size, 0, 0);
   PacketBufHeader& hdr = *txq.GetDescriptorBuf<PacketBufHeader*>(idx);
   hdr.flags = 0;
   hdr.gso_type = PacketBufHeader::kGSOTypeNone;
@@ -376,16 +530,85 @@ void Net::SendPacket() {
   hdr.gso_size = 0;
   hdr.csum_start = 0;
   hdr.csum_offset = 0;
+  return txq.GetDescriptorBuf(idx) + sizeof(PacketBufHeader);
+}
+
+void Net::SetTXChecksumOffload(size_t csum_start, size_t csum_offset) {
+  assert(offloads_tx_checksum_);
+  QueuePair& pair = *tx_pair_;
+  const int idx = pair.tx_cursor % pair.tx_size;
+  auto& txq = pair.txq;
+  assert(sizeof(PacketBufHeader) + csum_start + csum_offset + 2 <=
+         txq.GetDescriptorSize(idx));
+  PacketBufHeader& hdr = *txq.GetDescriptorBuf<PacketBufHeader*>(idx);
+  hdr.flags = PacketBufHeader::kFlagNeedsChecksum;
+  hdr.csum_start = static_cast<uint16_t>(csum_start);
+  hdr.csum_offset = static_cast<uint16_t>(csum_offset);
+  pair.num_of_tx_checksum_offloads++;
+}
+
+void Net::QueuePacket() {
+  QueuePair& pair = *tx_pair_;
+  const int idx = pair.tx_cursor % pair.tx_size;
+  auto& txq = pair.txq;
+  uint8_t* data = txq.GetDescriptorBuf(idx);
+  uint32_t data_size = txq.GetDescriptorSize(idx);
+  if (debug_mode_enabled_) {
+    kprintbuf("SendPacket data", data, sizeof(PacketBufHeader), data_size);
+  }
   txq.SetAvailableRingEntry(idx, idx);
-  vq_cursor_[kIndexOfTXVirtqueue]++;
-  txq.SetAvailableRingIndex(idx + 1);
-  WriteConfigReg16(16 /* Queue Notify */, kIndexOfTXVirtqueue);
+  pair.tx_cursor++;
+  txq.SetAvailableRingIndex(pair.tx_cursor);
+  pair.num_of_tx_packets++;
+  if (static_cast<uint16_t>(pair.tx_cursor - pair.tx_kicked_idx) >=
+      kMaxTXBatchSize)
+    KickTXQueue(pair);
+  RestoreInterrupts(tx_irq_was_enabled_);
+}
+
+void Net::KickTXQueue() {
+  const bool was_enabled = DisableInterrupts();
+  for (int i = 0; i < num_of_queue_pairs_; i++)
+    KickTXQueue(queue_pairs_[i]);
+  RestoreInterrupts(was_enabled);
+}
+
+void Net::KickTXQueue(QueuePair& pair) {
+  const uint16_t cursor = pair.tx_cursor;
+  if (cursor == pair.tx_kicked_idx)
+    return;
+  const bool needs_notification =
+      pair.txq.NeedsNotification(pair.tx_kicked_idx, cursor);
+  pair.tx_kicked_idx = cursor;
+  if (!needs_notification)
+    return;
+  // A port I/O write, which exits to the hypervisor
+  WriteConfigReg16(16 /* Queue Notify */, 2 * pair.index + 1);
+  pair.num_of_tx_kicks++;
+}
+
+void Net::PrintStatistics() {
+  PutStringAndBool("RX interrupts enabled", uses_rx_interrupt_);
+  for (int i = 0; i < num_of_queue_pairs_; i++) {
+    QueuePair& pair = queue_pairs_[i];
+    PutStringAndDecimal("Queue pair", i);
+    PutStringAndDecimal("  RX packets", pair.num_of_rx_packets);
+    PutStringAndDecimal("  RX drops without buffers", pair.num_of_rx_drops);
+    PutStringAndDecimal("  Free RX buffers",
+                        pair.rx_pool.GetNumOfFreeBuffers());
+    PutStringAndDecimal("  RX interrupts", pair.num_of_rx_interrupts);
+    PutStringAndDecimal("  RX polls", pair.num_of_rx_polls);
+    PutStringAndDecimal("  TX packets", pair.num_of_tx_packets);
+    PutStringAndDecimal("  TX notifications", pair.num_of_tx_kicks);
+    PutStringAndDecimal("  TX queue full", pair.num_of_tx_ring_full);
+    PutStringAndDecimal("  TX checksum offloads",
+                        pair.num_of_tx_checksum_offloads);
+  }
 }
 
 Net& Net::GetInstance() {
   if (!net_) {
-    net_ = liumos->kernel_heap_allocator->Alloc<Net>();
-    bzero(net_, sizeof(Net));
+    net_ = AllocKernelObject<Net>();
     new (net_) Net();
   }
   assert(net_);
@@ -425,63 +648,202 @@ void Net::Init() {
     PutStringAndHex("common_cfg_size", common_cfg_size);
   }
 
+  uses_rx_interrupt_ = false;
+  has_msix_ = msix_.Init(dev_);
+  PutStringAndBool("MSI-X", has_msix_);
+  if (has_msix_)
+    msix_.Enable();
+  // 4.1.4.8 Legacy Interfaces: A Note on PCI Device Layout
+  device_config_ofs_ = has_msix_ ? 24 : 20;
+
   // http://www.dumais.io/index.php?article=aca38a9a2b065b24dfa1dee728062a12
   // 3.1.1 Driver Requirements: Device Initialization
   WriteDeviceStatus(ReadDeviceStatus() | kDeviceStatusAcknowledge);
   WriteDeviceStatus(ReadDeviceStatus() | kDeviceStatusDriver);
   // 5.1.4.2 Driver Requirements: Device configuration layout
   // A driver SHOULD negotiate VIRTIO_NET_F_MAC if the device offers it
-  SetFeatures(kFeaturesStatus | kFeaturesMAC);
+  // Received frames may have partial checksums with GUEST_CSUM, which is
+  // fine since checksums of them are not verified.
+  uint32_t features =
+      ReadConfigReg32(0 /* Device Features */) &
+      (kFeaturesChecksum | kFeaturesGuestChecksum | kFeaturesStatus |
+       kFeaturesMAC | kFeaturesEventIndex | kFeaturesControlVirtqueue |
+       kFeaturesMultiQueue);
+  // The number of queue pairs is set with the control virtqueue.
+  if (!(features & kFeaturesControlVirtqueue))
+    features &= ~kFeaturesMultiQueue;
+  SetFeatures(features);
   WriteDeviceStatus(ReadDeviceStatus() | kDeviceStatusFeaturesOK);
+  uses_event_idx_ = features & kFeaturesEventIndex;
+  offloads_tx_checksum_ = features & kFeaturesChecksum;
+  PutStringAndBool("VIRTIO_NET_F_CSUM", offloads_tx_checksum_);
+  PutStringAndBool("VIRTIO_F_EVENT_IDX", uses_event_idx_);
+  PutStringAndBool("VIRTIO_NET_F_MQ", features & kFeaturesMultiQueue);
+  if (has_msix_)
+    WriteConfigReg16(20 /* config_msix_vector */, kMSIXNoVector);
+
+  // 5.1.4 Device configuration layout
+  // max_virtqueue_pairs follows mac and status.
+  const int max_num_of_queue_pairs =
+      features & kFeaturesMultiQueue ? ReadConfigReg16(device_config_ofs_ + 8)
+                                     : 1;
+  // Each RX queue has its own MSI-X entry and vector.
+  int num_of_queue_pairs = max_num_of_queue_pairs;
+  if (num_of_queue_pairs > kMaxNumOfQueuePairs)
+    num_of_queue_pairs = kMaxNumOfQueuePairs;
+  if (num_of_queue_pairs > GetNumOfProcessors())
+    num_of_queue_pairs = GetNumOfProcessors();
+  if (has_msix_ && num_of_queue_pairs > msix_.GetNumOfEntries())
+    num_of_queue_pairs = msix_.GetNumOfEntries();
 
   // 5.1.5 Device Initialization
   // 4.1.5.1.3 Virtqueue Configuration
-  for (int i = 0; i < kNumOfVirtqueues; i++) {
-    WriteConfigReg16(14 /* queue_select */, i);
-    uint16_t queue_size = ReadConfigReg16(12);
-    if (!queue_size)
+  // RX interrupts are sent to the BSP, where the network stack runs.
+  // Without MSI-X, RX queues are polled on every tick.
+  bool uses_rx_interrupt = has_msix_;
+  num_of_queue_pairs_ = 0;
+  for (int i = 0; i < num_of_queue_pairs; i++) {
+    QueuePair& pair = queue_pairs_[i];
+    pair.index = i;
+    const uint16_t msix_vector =
+        has_msix_ ? static_cast<uint16_t>(i) : kMSIXNoVector;
+    pair.rx_size = InitVirtqueue(2 * i, pair.rxq, msix_vector);
+    if (has_msix_ && ReadConfigReg16(22 /* queue_msix_vector */) != i)
+      uses_rx_interrupt = false;
+    pair.tx_size = InitVirtqueue(2 * i + 1, pair.txq, kMSIXNoVector);
+    if (!pair.rx_size || !pair.tx_size)
       break;
-    PutStringAndHex("Queue Select(RW)   ", ReadConfigReg16(14));
-    PutStringAndHex("Queue Size(R)      ", queue_size);
-    vq_[i].Alloc(queue_size);
-    vq_size_[i] = queue_size;
-    vq_cursor_[i] = 0;
-    PutStringAndHex("Queue Addr(phys)   ", vq_[i].GetPhysAddr());
-    uint64_t vq_pfn = vq_[i].GetPhysAddr() >> kPageSizeExponent;
-    assert(vq_pfn == (vq_pfn & 0xFFFF'FFFF));
-    WriteConfigReg32(8, static_cast<uint32_t>(vq_pfn));
-    PutStringAndHex("Queue Addr(RW)     ", ReadConfigReg32(8));
+    if (has_msix_) {
+      pair.rx_vector = IDT::GetInstance().AllocDeviceVector(RXInterruptHandler);
+      msix_.SetEntry(i, liumos->bsp_local_apic->GetID(), pair.rx_vector);
+    }
+    num_of_queue_pairs_++;
+  }
+  assert(num_of_queue_pairs_ > 0);
+  ctrlq_index_ = 2 * max_num_of_queue_pairs;
+  ctrlq_size_ = 0;
+  if (features & kFeaturesControlVirtqueue) {
+    ctrlq_size_ = InitVirtqueue(ctrlq_index_, ctrlq_, kMSIXNoVector);
+    if (ctrlq_size_)
+      ctrlq_.SuppressInterrupts();
   }
 
   WriteDeviceStatus(ReadDeviceStatus() | kDeviceStatusDriverOK);
 
+  if (num_of_queue_pairs_ > 1 && !SetNumOfQueuePairs(num_of_queue_pairs_)) {
+    PutString("Failed to set the number of queue pairs\n");
+    num_of_queue_pairs_ = 1;
+  }
+  PutStringAndDecimal("Queue pairs", num_of_queue_pairs_);
+
+  polling_pair_ = nullptr;
+  tx_pair_ = nullptr;
+  for (int i = 0; i < num_of_queue_pairs_; i++)
+    InitQueuePair(queue_pairs_[i]);
   initialized_ = true;
 
   PutString("MAC Addr: ");
   for (int i = 0; i < 6; i++) {
-    mac_addr_.mac[i] = ReadConfigReg8(0x14 + i);
+    mac_addr_.mac[i] = ReadConfigReg8(device_config_ofs_ + i);
   }
   mac_addr_.Print();
   PutChar('\n');
 
+  PutStringAndBool("RX interrupt", uses_rx_interrupt);
+  uses_rx_interrupt_ = uses_rx_interrupt;
+  SendDHCPRequest();
+}
+
+uint16_t Net::InitVirtqueue(int index, Virtqueue& vq, uint16_t msix_vector) {
+  // Returns the size of the queue, or 0 if it does not exist.
+  WriteConfigReg16(14 /* queue_select */, index);
+  uint16_t queue_size = ReadConfigReg16(12);
+  if (!queue_size)
+    return 0;
+  PutStringAndHex("Queue Select(RW)   ", ReadConfigReg16(14));
+  PutStringAndHex("Queue Size(R)      ", queue_size);
+  vq.Alloc(queue_size);
+  vq.SetUsesEventIndex(uses_event_idx_);
+  PutStringAndHex("Queue Addr(phys)   ", vq.GetPhysAddr());
+  uint64_t vq_pfn = vq.GetPhysAddr() >> kPageSizeExponent;
+  assert(vq_pfn == (vq_pfn & 0xFFFF'FFFF));
+  WriteConfigReg32(8, static_cast<uint32_t>(vq_pfn));
+  PutStringAndHex("Queue Addr(RW)     ", ReadConfigReg32(8));
+  if (has_msix_)
+    WriteConfigReg16(22 /* queue_msix_vector */, msix_vector);
+  return queue_size;
+}
+
+bool Net::SetNumOfQueuePairs(int num_of_queue_pairs) {
+  // 5.1.6.5.5 Automatic receive steering in multiqueue mode
+  // Returns whether the device accepted the command. Only the first pair
+  // is used until then. This is the only command sent, once at boot.
+  if (!ctrlq_size_)
+    return false;
+  packed_struct ControlCommand {
+    uint8_t class_;
+    uint8_t command;
+    uint16_t virtqueue_pairs;
+  };
+  uint8_t* buf = AllocMemoryForMappedIO<uint8_t*>(kPageSize);
+  ControlCommand& cmd = *reinterpret_cast<ControlCommand*>(buf);
+  cmd.class_ = 4;   // VIRTIO_NET_CTRL_MQ
+  cmd.command = 0;  // VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET
+  cmd.virtqueue_pairs = static_cast<uint16_t>(num_of_queue_pairs);
+  volatile uint8_t& ack = buf[sizeof(ControlCommand)];
+  ack = 1;  // VIRTIO_NET_ERR
+  ctrlq_.SetDescriptor(0, &cmd, sizeof(cmd), 1 /* next */, 1);
+  ctrlq_.SetDescriptor(1, const_cast<uint8_t*>(&ack), 1,
+                      2 /* device write only */, 0);
+  ctrlq_.SetAvailableRingEntry(0, 0);
+  ctrlq_.SetAvailableRingIndex(1);
+  WriteConfigReg16(16 /* Queue Notify */, static_cast<uint16_t>(ctrlq_index_));
+  while (ctrlq_.GetUsedRingIndex() != 1) {
+    __builtin_ia32_pause();
+  }
+  return ack == 0;  // VIRTIO_NET_OK
+}
+
+void Net::InitQueuePair(QueuePair& pair) {
   // Populate RX Buffer
-  auto& rxq = vq_[kIndexOfRXVirtqueue];
-  vq_cursor_[kIndexOfRXVirtqueue] = 0;
-  for (int i = 0; i < vq_size_[kIndexOfRXVirtqueue]; i++) {
-    rxq.SetDescriptor(i, AllocMemoryForMappedIO<void*>(kPageSize), kPageSize,
+  // Frames are read by the CPU after DMA, so the buffers are cacheable
+  // memory, which is coherent with DMA on x86.
+  static_assert(kNumOfRXPacketBuffers > Virtqueue::kMaxQueueSize);
+  pair.rx_pool.Init(
+      AllocKernelMemory<void*>(kNumOfRXPacketBuffers * kPageSize),
+      kNumOfRXPacketBuffers);
+  pair.num_of_rx_packets = 0;
+  pair.num_of_rx_drops = 0;
+  pair.num_of_rx_interrupts = 0;
+  pair.num_of_rx_polls = 0;
+  auto& rxq = pair.rxq;
+  pair.rx_cursor = 0;
+  for (int i = 0; i < pair.rx_size; i++) {
+    PacketBuffer* buf = pair.rx_pool.Alloc();
+    assert(buf);
+    rxq.SetDescriptor(i, buf->GetData(),
+                      static_cast<uint32_t>(PacketBuffer::kDataSize),
                       2 /* device write only */, 0);
     rxq.SetAvailableRingEntry(i, i);
     rxq.SetAvailableRingIndex(i + 1);
   }
-  WriteConfigReg16(16 /* Queue Notify */, kIndexOfRXVirtqueue);
+  WriteConfigReg16(16 /* Queue Notify */, 2 * pair.index);
 
   // Populate TX Buffer
-  auto& txq = vq_[kIndexOfTXVirtqueue];
-  vq_cursor_[kIndexOfTXVirtqueue] = 0;
-  for (int i = 0; i < vq_size_[kIndexOfTXVirtqueue]; i++) {
+  // Completed descriptors are reclaimed when new frames are sent, so no
+  // interrupt is needed.
+  auto& txq = pair.txq;
+  pair.tx_cursor = 0;
+  pair.tx_kicked_idx = 0;
+  pair.tx_reclaimed_idx = 0;
+  pair.num_of_tx_packets = 0;
+  pair.num_of_tx_kicks = 0;
+  pair.num_of_tx_ring_full = 0;
+  pair.num_of_tx_checksum_offloads = 0;
+  txq.SuppressInterrupts();
+  for (int i = 0; i < pair.tx_size; i++) {
     txq.SetDescriptor(i, AllocMemoryForMappedIO<void*>(kPageSize), kPageSize,
                       0 /* device read only */, 0);
   }
-  SendDHCPRequest();
 }
 }  // namespace Virtio
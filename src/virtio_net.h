@@ -61,41 +61,63 @@ class Net {
     }
     void SetAvailableRingEntry(int idx, uint16_t desc_idx) {
       assert(0 <= idx && idx < queue_size_);
-      volatile uint16_t* ring = reinterpret_cast<volatile uint16_t*>(
-          base_ + sizeof(Descriptor) * queue_size_ + sizeof(uint16_t) * 2);
-      ring[idx] = desc_idx;
+      GetAvailableRing()[2 + idx] = desc_idx;
     }
     void SetAvailableRingIndex(int idx) {
-      volatile uint16_t& pidx = *reinterpret_cast<volatile uint16_t*>(
-          base_ + sizeof(Descriptor) * queue_size_ + sizeof(uint16_t));
-      pidx = idx;
+      // Descriptors and buffers should be visible before the index.
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      GetAvailableRing()[1] = static_cast<uint16_t>(idx);
     }
     uint16_t GetUsedRingIndex();
     UsedRingEntry& GetUsedRingEntry(int idx);
+    // Notification suppression
+    void SetUsesEventIndex(bool uses_event_idx) {
+      uses_event_idx_ = uses_event_idx;
+    }
+    void SuppressInterrupts();
+    // Asks the device to interrupt once the used index passes used_idx.
+    void EnableInterrupts(uint16_t used_idx);
+    void SetUsedEvent(uint16_t idx);
+    // Returns whether the device should be notified after the available
+    // index is moved from old_idx to new_idx.
+    bool NeedsNotification(uint16_t old_idx, uint16_t new_idx);
+    static constexpr int kMaxQueueSize = 0x100;
 
    private:
-    static constexpr int kMaxQueueSize = 0x100;
+    volatile uint16_t* GetAvailableRing();
+    uint8_t* GetUsedRing();
     int queue_size_;
+    bool uses_event_idx_;
     uint8_t* base_;
     void* buf_[kMaxQueueSize];
   };
 
-  void PollRXQueue();
+  // Processes at most budget frames of each RX queue. Returns whether any
+  // queue used up the budget.
+  bool PollRXQueues(int budget);
+  // Blocks until a frame is received, with RX interrupts enabled only while
+  // blocked.
+  void WaitForRXPackets();
+  bool UsesRXInterrupt() const { return uses_rx_interrupt_; }
   void Init();
+  void PrintStatistics();
 
+  // Returns the buffer of the next frame to send, which should be passed to
+  // the device by QueuePacket or SendPacket. Waits if the TX queue is full.
+  // Interrupts are disabled until then, so frames of senders do not mix.
+  // Replies sent while processing received frames use the queue pair of
+  // them, and others use the first one.
   template <typename T = uint8_t*>
   T GetNextTXPacketBuf(size_t size) {
-    if (!initialized_) {
-      Panic("Virtio::Net not initialized yet");
-    }
-    uint32_t buf_size = static_cast<uint32_t>(sizeof(PacketBufHeader) + size);
-    assert(buf_size < kPageSize);
-    auto& txq = vq_[kIndexOfTXVirtqueue];
-    const int idx =
-        vq_cursor_[kIndexOfTXVirtqueue] % vq_size_[kIndexOfTXVirtqueue];
-    txq.SetDescriptor(idx, txq.GetDescriptorBuf(idx), buf_size, 0, 0);
-    return reinterpret_cast<T>(txq.GetDescriptorBuf(idx) +
-                               sizeof(PacketBufHeader));
+    return reinterpret_cast<T>(AllocTXPacketBuf(
+        size, polling_pair_ ? *polling_pair_ : queue_pairs_[0]));
+  }
+  // Frames of a flow are sent from one queue pair, and the device steers
+  // the frames received for the flow to the same pair.
+  template <typename T = uint8_t*>
+  T GetNextTXPacketBufForFlow(size_t size, uint32_t flow_hash) {
+    return reinterpret_cast<T>(AllocTXPacketBuf(
+        size, queue_pairs_[flow_hash % num_of_queue_pairs_]));
   }
   const Network::IPv4Addr GetSelfIPv4Addr() { return self_ip_; }
   void SetSelfIPv4Addr(Network::IPv4Addr addr) {
@@ -105,28 +127,99 @@ class Net {
     Network::GetInstance().RegisterARPResolution(self_ip_, mac_addr_);
   }
   const Network::EtherAddr GetSelfEtherAddr() { return {mac_addr_}; }
-  void SendPacket();
+  // Whether the device computes checksums of frames to send, which are
+  // requested by SetTXChecksumOffload.
+  bool OffloadsTXChecksum() const { return offloads_tx_checksum_; }
+  // Asks the device to compute the Internet checksum of the frame being
+  // built, from csum_start to the end, and to add it to the 16-bit field at
+  // csum_start + csum_offset. The field should have the checksum of the
+  // pseudo-header, if any, without complement.
+  void SetTXChecksumOffload(size_t csum_start, size_t csum_offset);
+  // Makes the frame available to the device without notifying it, so
+  // frames are sent in a batch by KickTXQueue.
+  void QueuePacket();
+  // Notifies the device of queued frames unless it asked not to be.
+  void KickTXQueue();
+  void SendPacket() {
+    QueuePacket();
+    KickTXQueue();
+  }
 
   static Net& GetInstance();
 
  private:
-  static constexpr int kNumOfVirtqueues = 3;
+  // With VIRTIO_NET_F_MQ, up to this many pairs of RX and TX virtqueues are
+  // used. Virtqueues 2N and 2N + 1 are RX and TX of the pair N.
+  static constexpr int kMaxNumOfQueuePairs = 4;
+  // Shared by the RX virtqueue of a pair and the sockets which keep received
+  // frames
+  static constexpr int kNumOfRXPacketBuffers = 512;
+  // QueuePacket kicks the device when this many frames are queued.
+  static constexpr int kMaxTXBatchSize = 32;
 
-  static constexpr int kIndexOfRXVirtqueue = 0;
-  static constexpr int kIndexOfTXVirtqueue = 1;
+  struct QueuePair {
+    int index;
+    Virtqueue rxq;
+    uint16_t rx_size;
+    uint16_t rx_cursor;
+    uint8_t rx_vector;
+    PacketBufferPool rx_pool;
+    uint64_t num_of_rx_packets;
+    // Frames dropped since no buffer was left to replace the RX buffer
+    uint64_t num_of_rx_drops;
+    uint64_t num_of_rx_interrupts;
+    uint64_t num_of_rx_polls;
+    Virtqueue txq;
+    uint16_t tx_size;
+    uint16_t tx_cursor;
+    // Available index of TX when the device was kicked last
+    uint16_t tx_kicked_idx;
+    // Used index of TX up to which descriptors are reused
+    uint16_t tx_reclaimed_idx;
+    uint64_t num_of_tx_packets;
+    uint64_t num_of_tx_kicks;
+    uint64_t num_of_tx_ring_full;
+    uint64_t num_of_tx_checksum_offloads;
+  };
 
   static Net* net_;
   bool initialized_;
   PCI::DeviceLocation dev_;
   Network::EtherAddr mac_addr_;
   uint16_t config_io_addr_base_;
-  Virtqueue vq_[kNumOfVirtqueues];
-  uint16_t vq_size_[kNumOfVirtqueues];
-  uint16_t vq_cursor_[kNumOfVirtqueues];
+  // Offset of the device specific configuration, which follows the MSI-X
+  // vector registers if MSI-X is enabled.
+  int device_config_ofs_;
+  bool has_msix_;
+  PCI::MSIX msix_;
+  bool uses_event_idx_;
+  // VIRTIO_NET_F_CSUM
+  bool offloads_tx_checksum_;
+  bool uses_rx_interrupt_;
+  WaitQueue rx_wait_queue_;
+  QueuePair queue_pairs_[kMaxNumOfQueuePairs];
+  int num_of_queue_pairs_;
+  // Control virtqueue, which exists with VIRTIO_NET_F_CTRL_VQ
+  Virtqueue ctrlq_;
+  uint16_t ctrlq_size_;
+  int ctrlq_index_;
+  // Pair whose RX queue is being polled
+  QueuePair* polling_pair_;
+  // Pair of the buffer given by AllocTXPacketBuf
+  QueuePair* tx_pair_;
+  bool tx_irq_was_enabled_;
   Network::IPv4Addr self_ip_;
   bool debug_mode_enabled_;
 
-  void ProcessPacket(uint8_t* buf, size_t buf_size);
+  uint16_t InitVirtqueue(int index, Virtqueue& vq, uint16_t msix_vector);
+  bool SetNumOfQueuePairs(int num_of_queue_pairs);
+  void InitQueuePair(QueuePair& pair);
+  int PollRXQueue(QueuePair& pair, int budget);
+  uint8_t* AllocTXPacketBuf(size_t size, QueuePair& pair);
+  void ReclaimTXDescriptors(QueuePair& pair);
+  void KickTXQueue(QueuePair& pair);
+  void ProcessPacket(PacketBuffer& buf);
+  static void RXInterruptHandler(uint64_t intcode, InterruptInfo* info);
 
   uint8_t ReadConfigReg8(int ofs);
   uint16_t ReadConfigReg16(int ofs);
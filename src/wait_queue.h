@@ -0,0 +1,38 @@
+#pragma once
+
+#include "asm.h"
+
+class Process;
+
+class WaitQueue {
+  // Processes blocked until an event happens. Blocked processes are out of
+  // the run queues of the Scheduler until WakeUpAll is called, which is safe
+  // to call from interrupt handlers.
+ public:
+  constexpr WaitQueue() : head_(nullptr), tail_(nullptr) {}
+  template <class TCond>
+  void WaitUntil(TCond cond) {
+    // The current process is put into this queue before checking cond, so a
+    // wakeup between the check and switching, even from another processor,
+    // is not lost.
+    const bool was_enabled = DisableInterrupts();
+    for (;;) {
+      PrepareToWait();
+      if (cond())
+        break;
+      Sleep();
+    }
+    CancelWait();
+    RestoreInterrupts(was_enabled);
+  }
+  void WakeUpAll();
+  bool IsEmpty() const { return !head_; }
+  friend class Scheduler;
+
+ private:
+  void PrepareToWait();
+  void CancelWait();
+
+  Process* head_;
+  Process* tail_;
+};